@@ -0,0 +1,88 @@
+#!/usr/bin/env python3
+# Copyright (c) 2015-2016 Xiaowei Zhu, Tsinghua University
+#
+#    Licensed under the Apache License, Version 2.0 (the "License");
+#    you may not use this file except in compliance with the License.
+#    You may obtain a copy of the License at
+#
+#        http://www.apache.org/licenses/LICENSE-2.0
+#
+#    Unless required by applicable law or agreed to in writing, software
+#    distributed under the License is distributed on an "AS IS" BASIS,
+#    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+#    See the License for the specific language governing permissions and
+#    limitations under the License.
+
+"""Check that bc resumed from a checkpoint gives the results of an uninterrupted run.
+
+bc runs on a bidirectional path from vertex 0, whose levels are the vertices
+themselves: with n vertices, checkpoint steps 0..n-1 belong to the forward
+phase and n..2n-2 to the backward one. For each kill step, a run with
+GEMINI_CHECKPOINT_ABORT aborts right after that checkpoint is written, and a
+second run (maybe with another number of ranks) resumes from it. The
+dependencies and path counts it prints must equal those of a run without
+checkpoints.
+"""
+
+import argparse
+import os
+import re
+import shlex
+import struct
+import subprocess
+import sys
+import tempfile
+
+ROOT_DIR = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+
+
+def run(args, ranks, path, env):
+    cmd = shlex.split(args.mpirun) + ['-np', str(ranks), os.path.join(ROOT_DIR, 'toolkits', 'bc'), path, str(args.vertices), '0']
+    proc = subprocess.run(cmd, env=env, stdout=subprocess.PIPE, stderr=subprocess.STDOUT, universal_newlines=True)
+    # the values of the first run of compute()
+    return proc.returncode, re.findall(r'^(-?[0-9.]+ -?[0-9.]+)$', proc.stdout, re.M)[:20]
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('--vertices', type=int, default=600)
+    parser.add_argument('--ranks', type=int, default=2, help='ranks of the run that is killed')
+    parser.add_argument('--resume-ranks', type=int, default=3, help='ranks of the run that resumes')
+    parser.add_argument('--steps', help='comma-separated kill steps; one early and one late step of each phase by default')
+    parser.add_argument('--mpirun', default='mpirun', help='launcher command, e.g. "mpirun --oversubscribe"')
+    args = parser.parse_args()
+
+    n = args.vertices
+    steps = [int(x) for x in args.steps.split(',')] if args.steps else [n // 3, n - 1, n + n // 3, 2 * n - 3]
+    failures = 0
+    with tempfile.TemporaryDirectory() as work_dir:
+        path = os.path.join(work_dir, 'path.bin')
+        with open(path, 'wb') as f:
+            for v in range(n - 1):
+                f.write(struct.pack('<IIII', v, v + 1, v + 1, v))
+        env = dict(os.environ)
+        env.pop('GEMINI_CHECKPOINT', None)
+        env.pop('GEMINI_CHECKPOINT_ABORT', None)
+        returncode, expected = run(args, args.ranks, path, env)
+        assert returncode == 0 and len(expected) == min(n, 20), 'the uninterrupted run failed'
+        for step in steps:
+            prefix = os.path.join(work_dir, 'checkpoint%d' % step)
+            env['GEMINI_CHECKPOINT'] = prefix
+            env['GEMINI_CHECKPOINT_ABORT'] = str(step)
+            returncode, _ = run(args, args.ranks, path, env)
+            assert returncode != 0 and os.path.exists(prefix + '.checkpoint'), 'no checkpoint of step %d' % step
+            del env['GEMINI_CHECKPOINT_ABORT']
+            returncode, values = run(args, args.resume_ranks, path, env)
+            phase = 'forward' if step < n else 'backward'
+            if returncode != 0 or values != expected:
+                failures += 1
+                print('FAIL resumed after %s step %d: %s' % (phase, step, values[0] if values else 'no output'))
+            else:
+                print('ok   resumed after %s step %d' % (phase, step))
+            sys.stdout.flush()
+    if failures > 0:
+        sys.exit(1)
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,120 @@
+/*
+Copyright (c) 2015-2016 Xiaowei Zhu, Tsinghua University
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <omp.h>
+
+#include <random>
+#include <vector>
+#include <algorithm>
+
+#include "core/type.hpp"
+
+// edges generated per block; each block has its own random stream so the output
+// only depends on the seed, not on the number of threads
+#define GEN_BLOCK_EDGES (1ul << 20)
+
+typedef float Weight;
+
+// R-MAT with the Graph500 parameters (a=0.57, b=c=0.19, d=0.05)
+void rmat_edge(std::mt19937_64 & rng, int scale, VertexId & src, VertexId & dst) {
+  std::uniform_real_distribution<double> dist(0.0, 1.0);
+  src = 0;
+  dst = 0;
+  for (int level=0;level<scale;level++) {
+    double p = dist(rng);
+    src = (src << 1) | (p >= 0.76);
+    dst = (dst << 1) | ((p >= 0.57 && p < 0.76) || p >= 0.95);
+  }
+}
+
+int main(int argc, char ** argv) {
+  if (argc<5) {
+    printf("gen_graph [rmat|uniform] [scale] [edge factor] [output] [weighted=0] [seed=1]\n");
+    exit(-1);
+  }
+  bool rmat = strcmp(argv[1], "rmat")==0;
+  assert(rmat || strcmp(argv[1], "uniform")==0);
+  int scale = std::atoi(argv[2]);
+  assert(scale > 0 && scale < (int)sizeof(VertexId) * 8);
+  EdgeId edge_factor = std::atol(argv[3]);
+  bool weighted = argc > 5 && std::atoi(argv[5])!=0;
+  unsigned long seed = argc > 6 ? std::atol(argv[6]) : 1;
+
+  VertexId vertices = (VertexId)1 << scale;
+  EdgeId edges = edge_factor * vertices;
+  size_t edge_unit_size = weighted ? sizeof(EdgeUnit<Weight>) : sizeof(EdgeUnit<Empty>);
+
+  // R-MAT concentrates the hubs at small ids; scramble them like the Graph500 generator
+  std::vector<VertexId> permutation(vertices);
+  for (VertexId v_i=0;v_i<vertices;v_i++) {
+    permutation[v_i] = v_i;
+  }
+  if (rmat) {
+    std::mt19937_64 rng(seed);
+    std::shuffle(permutation.begin(), permutation.end(), rng);
+  }
+
+  int fout = open(argv[4], O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  assert(fout!=-1);
+  EdgeId blocks = (edges + GEN_BLOCK_EDGES - 1) / GEN_BLOCK_EDGES;
+  #pragma omp parallel
+  {
+    char * buffer = new char [edge_unit_size * GEN_BLOCK_EDGES];
+    #pragma omp for schedule(dynamic, 1)
+    for (EdgeId b_i=0;b_i<blocks;b_i++) {
+      std::mt19937_64 rng(seed * 1000003 + b_i + 1);
+      std::uniform_int_distribution<VertexId> vertex_dist(0, vertices - 1);
+      std::uniform_real_distribution<Weight> weight_dist(1, 64);
+      EdgeId begin_e_i = b_i * GEN_BLOCK_EDGES;
+      EdgeId end_e_i = std::min(begin_e_i + GEN_BLOCK_EDGES, edges);
+      for (EdgeId e_i=begin_e_i;e_i<end_e_i;e_i++) {
+        VertexId src, dst;
+        if (rmat) {
+          rmat_edge(rng, scale, src, dst);
+          src = permutation[src];
+          dst = permutation[dst];
+        } else {
+          src = vertex_dist(rng);
+          dst = vertex_dist(rng);
+        }
+        char * unit = buffer + edge_unit_size * (e_i - begin_e_i);
+        memcpy(unit, &src, sizeof(VertexId));
+        memcpy(unit + sizeof(VertexId), &dst, sizeof(VertexId));
+        if (weighted) {
+          Weight weight = weight_dist(rng);
+          memcpy(unit + sizeof(VertexId) * 2, &weight, sizeof(Weight));
+        }
+      }
+      size_t bytes = edge_unit_size * (end_e_i - begin_e_i);
+      size_t written = 0;
+      while (written < bytes) {
+        ssize_t ret = pwrite(fout, buffer + written, bytes - written, edge_unit_size * begin_e_i + written);
+        assert(ret > 0);
+        written += ret;
+      }
+    }
+    delete [] buffer;
+  }
+  close(fout);
+  printf("%s: |V| = %" PRIvid ", |E| = %lu\n", argv[4], vertices, edges);
+  return 0;
+}
@@ -0,0 +1,180 @@
+#!/usr/bin/env python3
+# Copyright (c) 2015-2016 Xiaowei Zhu, Tsinghua University
+#
+#    Licensed under the Apache License, Version 2.0 (the "License");
+#    you may not use this file except in compliance with the License.
+#    You may obtain a copy of the License at
+#
+#        http://www.apache.org/licenses/LICENSE-2.0
+#
+#    Unless required by applicable law or agreed to in writing, software
+#    distributed under the License is distributed on an "AS IS" BASIS,
+#    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+#    See the License for the specific language governing permissions and
+#    limitations under the License.
+
+"""Run the toolkits on generated graphs and report preprocessing / compute times.
+
+Every toolkit process loads the graph once and runs compute() several times;
+the first run is treated as warm-up. Preprocessing times come from the
+"load" records of GEMINI_METRICS (max over partitions), compute times from
+the exec_time lines. Results are written as JSON; --compare flags
+configurations whose median compute time regressed against an earlier file.
+"""
+
+import argparse
+import json
+import os
+import re
+import shlex
+import statistics
+import struct
+import subprocess
+import sys
+import tempfile
+
+ROOT_DIR = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+
+# toolkit -> (weighted input, extra argument builder)
+TOOLKITS = {
+    'pagerank': (False, lambda args, root: [str(args.pagerank_iterations)]),
+    'bfs': (False, lambda args, root: [str(root)]),
+    'cc': (False, lambda args, root: []),
+    'sssp': (True, lambda args, root: [str(root)]),
+    'bc': (False, lambda args, root: [str(root)]),
+}
+
+
+def percentile(values, p):
+    values = sorted(values)
+    k = (len(values) - 1) * p / 100.0
+    lo = int(k)
+    hi = min(lo + 1, len(values) - 1)
+    return values[lo] + (values[hi] - values[lo]) * (k - lo)
+
+
+def summarize(values):
+    return {
+        'median': statistics.median(values),
+        'p10': percentile(values, 10),
+        'p90': percentile(values, 90),
+        'min': min(values),
+        'max': max(values),
+        'samples': len(values),
+    }
+
+
+def generate(args, kind, weighted):
+    name = '%s-s%d-e%d%s%s.bin' % (kind, args.scale, args.edge_factor, '-w' if weighted else '',
+                                   '-v64' if args.vertex_id_bits == 64 else '')
+    path = os.path.join(args.graph_dir, name)
+    if not os.path.exists(path):
+        os.makedirs(args.graph_dir, exist_ok=True)
+        subprocess.check_call([os.path.join(ROOT_DIR, 'bench', 'gen_graph'), kind, str(args.scale),
+                               str(args.edge_factor), path, '1' if weighted else '0', str(args.seed)])
+    return path
+
+
+def default_root(args, path):
+    # the source of the first edge is never isolated
+    with open(path, 'rb') as f:
+        return struct.unpack('<Q' if args.vertex_id_bits == 64 else '<I', f.read(args.vertex_id_bits // 8))[0]
+
+
+def run_once(args, toolkit, path, ranks, threads):
+    vertices = 1 << args.scale
+    with tempfile.TemporaryDirectory() as metrics_dir:
+        env = dict(os.environ)
+        env['GEMINI_THREADS'] = str(threads)
+        env['GEMINI_METRICS'] = os.path.join(metrics_dir, 'metrics')
+        env['GEMINI_METRICS_FORMAT'] = 'json'
+        cmd = shlex.split(args.mpirun) + ['-np', str(ranks), os.path.join(ROOT_DIR, 'toolkits', toolkit), path, str(vertices)]
+        cmd += TOOLKITS[toolkit][1](args, default_root(args, path) if args.root is None else args.root)
+        proc = subprocess.run(cmd, env=env, stdout=subprocess.PIPE, stderr=subprocess.STDOUT, universal_newlines=True)
+        if proc.returncode != 0:
+            sys.stderr.write(proc.stdout)
+            raise RuntimeError('%s failed with exit code %d' % (' '.join(cmd), proc.returncode))
+        exec_times = [float(x) for x in re.findall(r'exec_time=([0-9.eE+-]+)\(s\)', proc.stdout)]
+        load_time = 0.0
+        for i in range(ranks):
+            with open(os.path.join(metrics_dir, 'metrics.%d' % i)) as f:
+                for line in f:
+                    record = json.loads(line)
+                    if record['call'] == 'load':
+                        load_time = max(load_time, record['total_time'])
+    return load_time, exec_times[1:] if len(exec_times) > 1 else exec_times
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('--graphs', default='rmat,uniform', help='comma-separated list of rmat, uniform')
+    parser.add_argument('--scale', type=int, default=18, help='log2 of the number of vertices')
+    parser.add_argument('--edge-factor', type=int, default=16, help='edges per vertex')
+    parser.add_argument('--seed', type=int, default=1)
+    parser.add_argument('--graph-dir', default=os.path.join(ROOT_DIR, 'bench', 'graphs'))
+    parser.add_argument('--toolkits', default=','.join(TOOLKITS))
+    parser.add_argument('--threads', default=str(os.cpu_count()), help='comma-separated thread counts per rank')
+    parser.add_argument('--ranks', default='1', help='comma-separated MPI rank counts')
+    parser.add_argument('--repeats', type=int, default=3, help='toolkit processes per configuration')
+    parser.add_argument('--root', type=int, help='root of bfs, sssp and bc; the source of the first edge by default')
+    parser.add_argument('--vertex-id-bits', type=int, choices=[32, 64], default=32,
+                        help='64 for toolkits and gen_graph built with MACROS="-D VERTEXID_64"')
+    parser.add_argument('--pagerank-iterations', type=int, default=20)
+    parser.add_argument('--mpirun', default='mpirun', help='launcher command, e.g. "mpirun --oversubscribe"')
+    parser.add_argument('--output', default=os.path.join(ROOT_DIR, 'bench', 'results.json'))
+    parser.add_argument('--compare', help='earlier results file to check for regressions')
+    parser.add_argument('--tolerance', type=float, default=0.10, help='allowed slowdown of the median compute time')
+    args = parser.parse_args()
+
+    results = []
+    for kind in args.graphs.split(','):
+        for toolkit in args.toolkits.split(','):
+            path = generate(args, kind, TOOLKITS[toolkit][0])
+            edge_unit_size = args.vertex_id_bits // 4 + (4 if TOOLKITS[toolkit][0] else 0)
+            edges = os.path.getsize(path) // edge_unit_size
+            for ranks in [int(x) for x in args.ranks.split(',')]:
+                for threads in [int(x) for x in args.threads.split(',')]:
+                    load_times = []
+                    exec_times = []
+                    for _ in range(args.repeats):
+                        load_time, times = run_once(args, toolkit, path, ranks, threads)
+                        load_times.append(load_time)
+                        exec_times += times
+                    compute = summarize(exec_times)
+                    # pagerank touches every edge in each iteration, the traversals once per run
+                    traversed = edges * (args.pagerank_iterations if toolkit == 'pagerank' else 1)
+                    result = {
+                        'graph': kind, 'scale': args.scale, 'edge_factor': args.edge_factor, 'edges': edges,
+                        'toolkit': toolkit, 'ranks': ranks, 'threads': threads,
+                        'preprocessing': summarize(load_times), 'compute': compute,
+                        'gteps': traversed / compute['median'] / 1e9,
+                    }
+                    results.append(result)
+                    print('%-8s %-8s ranks=%-3d threads=%-3d load=%8.3fs compute=%8.3fs (p90 %8.3fs) %7.3f GTEPS' % (
+                        kind, toolkit, ranks, threads, result['preprocessing']['median'],
+                        compute['median'], compute['p90'], result['gteps']))
+                    sys.stdout.flush()
+
+    with open(args.output, 'w') as f:
+        json.dump(results, f, indent=2)
+
+    if args.compare:
+        with open(args.compare) as f:
+            baseline = {(r['graph'], r['scale'], r['edge_factor'], r['toolkit'], r['ranks'], r['threads']): r for r in json.load(f)}
+        regressions = 0
+        for r in results:
+            key = (r['graph'], r['scale'], r['edge_factor'], r['toolkit'], r['ranks'], r['threads'])
+            if key not in baseline:
+                continue
+            ratio = r['compute']['median'] / baseline[key]['compute']['median']
+            if ratio > 1 + args.tolerance:
+                regressions += 1
+                print('REGRESSION %s %s ranks=%d threads=%d: %.3fs -> %.3fs (x%.2f)' % (
+                    r['graph'], r['toolkit'], r['ranks'], r['threads'],
+                    baseline[key]['compute']['median'], r['compute']['median'], ratio))
+        if regressions > 0:
+            sys.exit(1)
+
+
+if __name__ == '__main__':
+    main()
@@ -17,6 +17,9 @@ Copyright (c) 2015-2016 Xiaowei Zhu, Tsinghua University
 #ifndef BITMAP_HPP
 #define BITMAP_HPP
 
+#include <assert.h>
+#include <stddef.h>
+
 #define WORD_OFFSET(i) ((i) >> 6)
 #define BIT_OFFSET(i) ((i) & 0x3f)
 
@@ -56,8 +59,80 @@ public:
   void set_bit(size_t i) {
     __sync_fetch_and_or(data+WORD_OFFSET(i), 1ul<<BIT_OFFSET(i));
   }
+  void clear_bit(size_t i) {
+    __sync_fetch_and_and(data+WORD_OFFSET(i), ~(1ul<<BIT_OFFSET(i)));
+  }
+  // only for a caller owning the word of bit i, e.g. process_vertices, whose threads take whole words
+  void set_bit_nonatomic(size_t i) {
+    data[WORD_OFFSET(i)] |= 1ul<<BIT_OFFSET(i);
+  }
+  // the number of set bits in [begin, end)
+  size_t count(size_t begin, size_t end) {
+    if (begin >= end) return 0;
+    size_t begin_w = WORD_OFFSET(begin);
+    size_t end_w = WORD_OFFSET(end - 1);
+    unsigned long first = ~0ul << BIT_OFFSET(begin);
+    unsigned long last = ~0ul >> (63 - BIT_OFFSET(end - 1));
+    if (begin_w==end_w) {
+      return __builtin_popcountl(data[begin_w] & first & last);
+    }
+    size_t bits = __builtin_popcountl(data[begin_w] & first) + __builtin_popcountl(data[end_w] & last);
+    #pragma omp parallel for reduction(+:bits)
+    for (size_t i=begin_w+1;i<end_w;i++) {
+      bits += __builtin_popcountl(data[i]);
+    }
+    return bits;
+  }
+  size_t count() {
+    return count(0, size);
+  }
+  bool any() {
+    size_t bm_size = WORD_OFFSET(size);
+    unsigned long any = 0;
+    #pragma omp parallel for reduction(|:any)
+    for (size_t i=0;i<=bm_size;i++) {
+      any |= data[i];
+    }
+    return any!=0;
+  }
+  // this |= other
+  void unite(Bitmap * other) {
+    assert(other->size==size);
+    size_t bm_size = WORD_OFFSET(size);
+    #pragma omp parallel for
+    for (size_t i=0;i<=bm_size;i++) {
+      data[i] |= other->data[i];
+    }
+  }
+  // this &= other
+  void intersect(Bitmap * other) {
+    assert(other->size==size);
+    size_t bm_size = WORD_OFFSET(size);
+    #pragma omp parallel for
+    for (size_t i=0;i<=bm_size;i++) {
+      data[i] &= other->data[i];
+    }
+  }
+  // this &= ~other
+  void subtract(Bitmap * other) {
+    assert(other->size==size);
+    size_t bm_size = WORD_OFFSET(size);
+    #pragma omp parallel for
+    for (size_t i=0;i<=bm_size;i++) {
+      data[i] &= ~other->data[i];
+    }
+  }
 };
 
+// call process(base + i) for every bit i set in word, in increasing order
+template <typename Process>
+inline void for_each_bit(unsigned long word, size_t base, Process process) {
+  while (word != 0) {
+    process(base + __builtin_ctzl(word));
+    word &= word - 1;
+  }
+}
+
 typedef Bitmap VertexSubset;
 
 #endif
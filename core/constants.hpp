@@ -19,5 +19,6 @@ Copyright (c) 2015-2016 Xiaowei Zhu, Tsinghua University
 
 #define CHUNKSIZE (1<<20)
 #define PAGESIZE (1<<12)
+#define ADJ_GROUP_EDGES 64 // compressed adjacency lists restart delta coding every ADJ_GROUP_EDGES edges
 
 #endif
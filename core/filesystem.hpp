@@ -21,9 +21,15 @@ Copyright (c) 2015-2016 Xiaowei Zhu, Tsinghua University
 #include <stdlib.h>
 #include <assert.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 
+#include <algorithm>
+#include <string>
+#include <vector>
+
 inline bool file_exists(std::string filename) {
   struct stat st;
   return stat(filename.c_str(), &st)==0;
@@ -35,4 +41,30 @@ inline long file_size(std::string filename) {
   return st.st_size;
 }
 
+// the modification time of a file, in nanoseconds
+inline long file_mtime(std::string filename) {
+  struct stat st;
+  assert(stat(filename.c_str(), &st)==0);
+  return st.st_mtim.tv_sec * 1000000000l + st.st_mtim.tv_nsec;
+}
+
+// FNV-1a hash of the first and the last bytes bytes of a file (or of all of it, twice, if it is smaller)
+inline unsigned long file_ends_hash(std::string filename, size_t bytes) {
+  long size = file_size(filename);
+  int fd = open(filename.c_str(), O_RDONLY);
+  assert(fd!=-1);
+  std::vector<char> buffer (bytes);
+  unsigned long hash = 14695981039346656037ul;
+  long offsets[2] = {0, std::max(0l, size - (long)bytes)};
+  for (int i=0;i<2;i++) {
+    ssize_t ret = pread(fd, buffer.data(), bytes, offsets[i]);
+    assert(ret>=0);
+    for (ssize_t b_i=0;b_i<ret;b_i++) {
+      hash = (hash ^ (unsigned char)buffer[b_i]) * 1099511628211ul;
+    }
+  }
+  assert(close(fd)==0);
+  return hash;
+}
+
 #endif
\ No newline at end of file
@@ -23,7 +23,9 @@ Copyright (c) 2015-2016 Xiaowei Zhu, Tsinghua University
 #include <unistd.h>
 #include <fcntl.h>
 #include <malloc.h>
+#include <limits.h>
 #include <sys/mman.h>
+#include <sched.h>
 #include <numa.h>
 #include <omp.h>
 
@@ -31,24 +33,63 @@ Copyright (c) 2015-2016 Xiaowei Zhu, Tsinghua University
 #include <vector>
 #include <thread>
 #include <mutex>
+#include <condition_variable>
+#include <algorithm>
+#include <functional>
+#include <cstddef>
+#include <type_traits>
 
 #include "core/atomic.hpp"
 #include "core/bitmap.hpp"
 #include "core/constants.hpp"
 #include "core/filesystem.hpp"
+#include "core/metrics.hpp"
 #include "core/mpi.hpp"
+#include "core/queue.hpp"
 #include "core/time.hpp"
 #include "core/type.hpp"
+#include "core/varint.hpp"
+#include "core/vertex_file.hpp"
 
 enum ThreadStatus {
   WORKING,
   STEALING
 };
 
+enum ShuffleTarget {
+  SrcOwner,
+  DstOwner,
+  DstOwnerSymmetric, // the owner of dst, plus the owner of src for the reversed edge
+  BothOwners // the owners of src and dst (once if they coincide)
+};
+
+enum VertexOrder {
+  OriginalOrder,
+  DegreeOrder,
+  HubOrder
+};
+
+enum DirectionPolicy {
+  FixedThreshold, // sparse if the active vertices have fewer than sparse_threshold * |E| out-edges
+  CostModel, // Beamer-style: compare frontier edges with the edges of unexplored vertices, with hysteresis
+  AutoTuned // fit the measured time of both modes and pick the one predicted to be faster
+};
+
+enum LoadedDirections {
+  BothDirections,
+  OutgoingOnly, // only the sparse-mode (push) structures; process_edges always runs in sparse mode
+  IncomingOnly // only the dense-mode (pull) structures; process_edges always runs in dense mode
+};
+
 enum MessageTag {
   ShuffleGraph,
   PassMessage,
-  GatherVertexArray
+  AsyncMessage, // batches of process_edges_async
+  GatherVertexArray,
+  NodeMessage, // NodeBatch [sockets]; a batch of process_edges waiting in the node message window
+  NodeForward, // NodeBatch [sockets]; a batch for another node, handed to the leader of this node
+  NodeAggregate, // NodeBatch list, then the messages; the batches of one node for the partitions of another
+  StreamMessage // + the sending socket; chunks of a streamed send buffer
 };
 
 struct ThreadState {
@@ -66,10 +107,10 @@ struct MessageBuffer {
     count = 0;
     data = NULL;
   }
-  void init (int socket_id) {
+  void init (int node_id) {
     capacity = 4096;
     count = 0;
-    data = (char*)numa_alloc_onnode(capacity, socket_id);
+    data = (char*)numa_alloc_onnode(capacity, node_id);
   }
   void resize(size_t new_capacity) {
     if (new_capacity > capacity) {
@@ -79,6 +120,16 @@ struct MessageBuffer {
       capacity = new_capacity;
     }
   }
+  // give back the memory beyond new_capacity bytes (keeping at least the initial page)
+  void shrink(size_t new_capacity) {
+    new_capacity = std::max(new_capacity, (size_t)4096);
+    if (new_capacity < capacity) {
+      char * new_data = (char*)numa_realloc(data, capacity, new_capacity);
+      assert(new_data!=NULL);
+      data = new_data;
+      capacity = new_capacity;
+    }
+  }
 };
 
 template <typename MsgData>
@@ -87,11 +138,156 @@ struct MsgUnit {
   MsgData msg_data;
 } __attribute__((packed));
 
+// an edge inserted into or deleted from the adjacency list of key on a local socket by update_edges
+template <typename EdgeData>
+struct AdjUpdate {
+  int socket;
+  VertexId key;
+  bool deleted;
+  AdjUnit<EdgeData> unit;
+};
+
+// announces a chunk appended to recv_buffer[partition][socket] in streaming mode
+struct StreamChunk {
+  int partition;
+  int socket;
+  VertexId messages; // fewer than a full chunk ends the stream of the socket
+};
+
+enum WireEncoding {
+  RawWire, // packed MsgUnit<M> array
+  BitmapWire, // bitmap over the vertex range, then the payloads in vertex order
+  VarintWire // varint gaps between the sorted vertices, then the payloads in vertex order
+};
+
+// locates the messages from partition source to partition target (-1: all partitions, in sparse mode) on one socket
+// in the node message window
+struct NodeBatch {
+  int source;
+  int target;
+  int owner; // the node rank whose segment holds the messages
+  int count; // messages
+  size_t offset; // bytes into the segment of owner
+};
+
+// leads every PassMessage batch if adaptive wire encoding is enabled
+struct WireHeader {
+  int encoding; // WireEncoding
+  int count; // messages
+  int index_bytes; // bytes of the bitmap or of the varint gaps
+  int payload_size; // bytes per payload; sizeof(float) for lossy doubles
+};
+
+// payloads are stored as they are, except for lossy doubles
+template <typename M>
+inline void write_wire_payload(const M & value, unsigned char * out, bool lossy) {
+  memcpy(out, &value, sizeof(M));
+}
+
+inline void write_wire_payload(const double & value, unsigned char * out, bool lossy) {
+  if (lossy) {
+    float narrowed = value;
+    memcpy(out, &narrowed, sizeof(float));
+  } else {
+    memcpy(out, &value, sizeof(double));
+  }
+}
+
+template <typename M>
+inline void read_wire_payload(M & value, const unsigned char * in, bool lossy) {
+  memcpy(&value, in, sizeof(M));
+}
+
+inline void read_wire_payload(double & value, const unsigned char * in, bool lossy) {
+  if (lossy) {
+    float narrowed;
+    memcpy(&narrowed, in, sizeof(float));
+    value = narrowed;
+  } else {
+    memcpy(&value, in, sizeof(double));
+  }
+}
+
+#define SNAPSHOT_MAGIC 0x544e5350494d4547ul // "GEMIPSNT"
+#define SNAPSHOT_VERSION 7
+
+#define SNAPSHOT_INPUT_HASH_BYTES (1ul<<20) // bytes hashed at either end of the input file
+
+// identifies the edge file a snapshot was built from
+struct SnapshotInput {
+  long size;
+  long mtime; // nanoseconds
+  unsigned long hash; // of the first and last SNAPSHOT_INPUT_HASH_BYTES bytes
+} __attribute__((packed));
+
+struct SnapshotHeader {
+  unsigned long magic;
+  int version;
+  int vertex_id_size; // sizeof(VertexId) of the build that wrote it
+  int partitions;
+  int partition_id;
+  int sockets;
+  int threads;
+  int symmetric;
+  int vertex_order;
+  int directions;
+  long hub_split_threshold;
+  int adj_compression;
+  EdgeId max_adj_edges;
+  size_t edge_unit_size;
+  VertexId vertices;
+  EdgeId edges;
+  SnapshotInput input;
+} __attribute__((packed));
+
+#define GATHER_PIECE (1ul<<28) // values per message of gather_vertex_array
+#define NODE_AGGREGATE_PIECE (1ul<<30) // bytes per message of an aggregate between node leaders (unless one batch is larger)
+
+#define CHECKPOINT_MAGIC 0x544e504b43494d47ul // "GMICKPNT"
+
+struct CheckpointHeader {
+  unsigned long magic;
+  int iteration;
+  int slot; // the vertex arrays and subsets are in [GEMINI_CHECKPOINT].[name].[slot]
+  int vertex_id_size;
+  VertexId vertices;
+  int entries; // CheckpointEntryHeader (each followed by the bytes of a value) following the header
+} __attribute__((packed));
+
+struct CheckpointEntryHeader {
+  char name[64];
+  int per_vertex;
+  size_t value_size;
+} __attribute__((packed));
+
+// a vertex array, vertex subset or value registered with the checkpoints
+struct CheckpointEntry {
+  std::string name;
+  bool per_vertex; // a vertex array or subset, written to a file of its own; otherwise a value kept in the manifest
+  size_t value_size; // bytes of a vertex value, or of the value
+  std::function<void(char *)> save; // copy the owned vertex values in input vertex order (or the value) to a buffer
+  std::function<void(char *)> load; // copy them back from such a buffer
+};
+
 template <typename EdgeData = Empty>
 class Graph {
 public:
   int partition_id;
   int partitions;
+  MPI_Comm node_comm; // the partitions on this node, which share node vertex arrays; just this one if GEMINI_NODE_SHARED=0
+  MPI_Comm leader_comm; // the first partition of every node (node_rank 0); MPI_COMM_NULL on the others
+  int node_rank;
+  int node_partitions;
+  std::vector<std::pair<void *, MPI_Win>> node_windows; // the node vertex arrays and their shared-memory windows
+  std::vector<int> node_of; // [partitions]; the node of every partition, nodes being numbered in the order of their leaders
+  std::vector<std::vector<int>> node_members; // [nodes]; the partitions of every node, by node rank
+  bool node_messages; // the batches of process_edges are read in place on a node and aggregated between nodes (GEMINI_NODE_MESSAGES)
+  MPI_Win node_message_win; // a segment per partition of this node holding its batches; MPI_WIN_NULL until first used
+  std::vector<char *> node_message_base; // [node_partitions]; the segments of node_message_win
+  std::vector<size_t> node_message_bytes; // [node_partitions]; the bytes for batches at the beginning of each segment
+  size_t node_recv_bytes; // the bytes after them in the segment of the leader, for the batches from other nodes
+  MessageBuffer *** node_send_buffer; // MessageBuffer* [partitions] [sockets]; views of the batches of this partition
+  MessageBuffer *** node_recv_buffer; // MessageBuffer* [partitions] [sockets]; views of the received batches
 
   size_t alpha;
 
@@ -109,6 +305,10 @@ public:
   VertexId * out_degree; // VertexId [vertices]; numa-aware
   VertexId * in_degree; // VertexId [vertices]; numa-aware
 
+  int vertex_order; // VertexOrder of the internal vertex ids
+  VertexId * original_id; // VertexId [vertices]; internal id -> input id; NULL if not reordered
+  VertexId * internal_id; // VertexId [vertices]; input id -> internal id; NULL if not reordered
+
   VertexId * partition_offset; // VertexId [partitions+1]
   VertexId * local_partition_offset; // VertexId [sockets+1]
 
@@ -136,13 +336,84 @@ public:
   MessageBuffer ** local_send_buffer; // MessageBuffer* [threads]; numa-aware
 
   int current_send_part_id;
-  MessageBuffer *** send_buffer; // MessageBuffer* [partitions] [sockets]; numa-aware
-  MessageBuffer *** recv_buffer; // MessageBuffer* [partitions] [sockets]; numa-aware
+  MessageBuffer *** send_buffer; // MessageBuffer* [partitions] [sockets]; the send buffer set currently assigned to each partition
+  MessageBuffer *** send_buffer_sets; // MessageBuffer* [partitions] [sockets]; numa-aware; the pool send_buffer is drawn from
+  MessageBuffer *** recv_buffer; // MessageBuffer* [partitions] [sockets]; numa-aware; grown to the batches actually received
+  size_t message_budget; // bytes the dense-mode send buffers are limited to (flow-controlling the sends); 0 if unlimited
+  size_t peak_message_bytes; // the largest message_bytes() at the end of a process_edges call
+
+  std::string snapshot_path; // per-partition snapshots of the preprocessed graph; empty if disabled
+  SnapshotInput snapshot_input; // the edge file being loaded
+  std::string staging_path; // "memory" or a spill directory for single-pass loading; empty to re-read the edge file
+  std::string adj_storage_path; // directory holding the adjacency lists in mapped (unlinked) files; empty to keep them in memory
+  char * snapshot_adj_data; // the mapped snapshot that out-of-core adjacency lists point into; NULL if they have their own storage
+  long snapshot_adj_bytes;
+  long hub_split_threshold; // dense-mode adjacency lists longer than this are split across threads; 0 if disabled, -1 if automatic
+  VertexId hub_split_replicas; // extra dense-mode entries per socket caused by hub splitting (max over all partitions)
+  bool adj_compression; // adjacency lists are delta + varint encoded and all adjacency indices are byte offsets
+  EdgeId max_adj_edges; // the longest local adjacency list of a vertex
+  AdjUnit<EdgeData> ** adj_scratch; // AdjUnit<EdgeData> [threads] [max_adj_edges]; numa-aware; decoded lists if compressed
+
+  int direction_policy; // DirectionPolicy used by process_edges
+  int loaded_directions; // LoadedDirections; the other direction has no edges and forces the mode of process_edges
+  double sparse_threshold; // FixedThreshold: fraction of |E| below which process_edges runs in sparse mode
+  double async_threshold; // fraction of |V| active vertices below which async_frontier holds (GEMINI_ASYNC); 0 never
+  double direction_alpha; // CostModel: switch to dense mode once frontier edges exceed unexplored edges / direction_alpha
+  double direction_beta; // CostModel: switch back to sparse mode once active vertices drop below |V| / direction_beta
+  bool last_sparse; // the mode chosen by the previous process_edges call
+  double sparse_samples[5]; // AutoTuned: decayed sums of n, x, y, x*x, x*y over sparse calls (x = active edges, y = time)
+  double dense_samples[2]; // AutoTuned: decayed sums of n, y over dense calls
+
+  char * combine_buffer; // M [largest partition]; numa-interleaved; dense-mode messages merged per target vertex
+  size_t combine_buffer_size;
+  Bitmap * combine_present; // [largest partition]; target vertices holding a merged message
+  Bitmap * combine_lock; // [largest partition]; per-vertex spin locks while merging
+
+  bool wire_adaptive; // PassMessage batches are sent in the smallest WireEncoding
+  bool wire_lossy; // double payloads are sent as float
+  MessageBuffer ** wire_send_buffer; // MessageBuffer* [sockets]; encoded batches being sent
+  MessageBuffer ** wire_recv_buffer; // MessageBuffer* [partitions]; encoded batches being received
+  std::vector<unsigned long> wire_bitmap; // encoder scratch (send thread only)
+  std::vector<VertexId> wire_rank; // encoder scratch: set bits before each bitmap word
+  std::vector<VertexId> wire_order; // encoder scratch: message indices in vertex order
+
+  size_t stream_chunk_bytes; // messages are streamed in chunks of about this size; 0 if disabled
+  VertexId stream_chunk; // messages per chunk in the current process_edges call; 0 if not streaming
+  size_t stream_chunks; // chunks per send buffer in the current process_edges call
+  std::vector<VertexId> stream_filled; // [partitions][sockets][stream_chunks]; messages flushed into each chunk
+
+  bool dump_compression; // dump_vertex_array writes compressed files
+  std::vector<std::pair<std::string, std::thread>> dump_threads; // background writers of dump_vertex_array_async and their paths
+  std::string checkpoint_path; // prefix of the checkpoint files; empty if disabled
+  double checkpoint_interval; // seconds from one checkpoint to the next
+  double checkpoint_time; // when the last checkpoint was taken (on partition 0)
+  int checkpoint_slot; // the file set of the last checkpoint taken or restored; the next one uses the other
+  int checkpoint_abort; // GEMINI_CHECKPOINT_ABORT: abort the job once the checkpoint of this iteration is written, -1 never
+  std::vector<CheckpointEntry> checkpoint_entries; // the registered variables
+  std::thread checkpoint_thread; // the writer of the last checkpoint
+
+  cpu_set_t comm_cpus; // CPUs reserved for the communication threads of process_edges; empty if they are not pinned
+
+  MetricsWriter metrics; // per-call measurements written to GEMINI_METRICS.[partition id]; disabled if unset
+  bool in_process_edges; // process_vertices calls made by process_edges are not recorded separately
 
   Graph() {
+    assert( numa_available() != -1 );
     threads = numa_num_configured_cpus();
-    sockets = 1; //numa_num_configured_nodes();
+    sockets = numa_num_configured_nodes();
+    // GEMINI_THREADS and GEMINI_SOCKETS override the detected topology;
+    // sockets beyond the number of NUMA nodes are mapped to the nodes round-robin
+    const char * env_threads = getenv("GEMINI_THREADS");
+    if (env_threads!=NULL) {
+      threads = std::atoi(env_threads);
+    }
+    const char * env_sockets = getenv("GEMINI_SOCKETS");
+    if (env_sockets!=NULL) {
+      sockets = std::atoi(env_sockets);
+    }
+    assert(sockets > 0 && threads >= sockets);
     threads_per_socket = threads / sockets;
+    threads = threads_per_socket * sockets;
 
     init();
   }
@@ -151,6 +422,11 @@ public:
     return thread_id / threads_per_socket;
   }
 
+  // the NUMA node holding the memory and the threads of a socket
+  inline int get_socket_node(int socket_id) {
+    return socket_id % numa_num_configured_nodes();
+  }
+
   inline int get_socket_offset(int thread_id) {
     return thread_id % threads_per_socket;
   }
@@ -163,14 +439,14 @@ public:
     assert( numa_available() != -1 );
     assert( sizeof(unsigned long) == 8 ); // assume unsigned long is 64-bit
 
-    char nodestring[sockets*2+1];
-    nodestring[0] = '0';
-    for (int s_i=1;s_i<sockets;s_i++) {
-      nodestring[s_i*2-1] = ',';
-      nodestring[s_i*2] = '0'+s_i;
+    std::string nodestring = "0";
+    for (int s_i=1;s_i<std::min(sockets, numa_num_configured_nodes());s_i++) {
+      nodestring += "," + std::to_string(s_i);
     }
-    struct bitmask * nodemask = numa_parse_nodestring(nodestring);
+    struct bitmask * nodemask = numa_parse_nodestring(nodestring.c_str());
+    assert(nodemask!=NULL);
     numa_set_interleave_mask(nodemask);
+    numa_bitmask_free(nodemask);
 
     omp_set_dynamic(0);
     omp_set_num_threads(threads);
@@ -178,43 +454,207 @@ public:
     local_send_buffer_limit = 16;
     local_send_buffer = new MessageBuffer * [threads];
     for (int t_i=0;t_i<threads;t_i++) {
-      thread_state[t_i] = (ThreadState*)numa_alloc_onnode( sizeof(ThreadState), get_socket_id(t_i));
-      local_send_buffer[t_i] = (MessageBuffer*)numa_alloc_onnode( sizeof(MessageBuffer), get_socket_id(t_i));
-      local_send_buffer[t_i]->init(get_socket_id(t_i));
+      thread_state[t_i] = (ThreadState*)numa_alloc_onnode( sizeof(ThreadState), get_socket_node(get_socket_id(t_i)));
+      local_send_buffer[t_i] = (MessageBuffer*)numa_alloc_onnode( sizeof(MessageBuffer), get_socket_node(get_socket_id(t_i)));
+      local_send_buffer[t_i]->init(get_socket_node(get_socket_id(t_i)));
     }
-    #pragma omp parallel for
-    for (int t_i=0;t_i<threads;t_i++) {
+    // GEMINI_COMM_CPUS (e.g. "23" or "22-23") reserves CPUs for the communication threads
+    CPU_ZERO(&comm_cpus);
+    const char * env_comm_cpus = getenv("GEMINI_COMM_CPUS");
+    if (env_comm_cpus!=NULL) {
+      struct bitmask * cpumask = numa_parse_cpustring(env_comm_cpus);
+      assert(cpumask!=NULL);
+      for (unsigned int cpu=0;cpu<numa_bitmask_nbytes(cpumask)*8 && cpu<CPU_SETSIZE;cpu++) {
+        if (numa_bitmask_isbitset(cpumask, cpu)) {
+          CPU_SET(cpu, &comm_cpus);
+        }
+      }
+      numa_bitmask_free(cpumask);
+      assert(CPU_COUNT(&comm_cpus) > 0);
+    }
+    // bind each OpenMP thread to the node of its socket, except for the reserved CPUs;
+    // the runtime keeps reusing the same threads
+    #pragma omp parallel
+    {
+      int t_i = omp_get_thread_num();
       int s_i = get_socket_id(t_i);
-      assert(numa_run_on_node(s_i)==0);
+      assert(numa_run_on_node(get_socket_node(s_i))==0);
+      if (CPU_COUNT(&comm_cpus) > 0) {
+        cpu_set_t cpus;
+        assert(sched_getaffinity(0, sizeof(cpus), &cpus)==0);
+        for (int cpu=0;cpu<CPU_SETSIZE;cpu++) {
+          if (CPU_ISSET(cpu, &comm_cpus)) {
+            CPU_CLR(cpu, &cpus);
+          }
+        }
+        if (CPU_COUNT(&cpus) > 0) {
+          assert(sched_setaffinity(0, sizeof(cpus), &cpus)==0);
+        }
+      }
       #ifdef PRINT_DEBUG_MESSAGES
       // printf("thread-%d bound to socket-%d\n", t_i, s_i);
       #endif
     }
     #ifdef PRINT_DEBUG_MESSAGES
-    // printf("threads=%d*%d\n", sockets, threads_per_socket);
-    // printf("interleave on %s\n", nodestring);
+    printf("threads=%d*%d\n", sockets, threads_per_socket);
+    printf("interleave on %s\n", nodestring.c_str());
     #endif
 
     MPI_Comm_rank(MPI_COMM_WORLD, &partition_id);
     MPI_Comm_size(MPI_COMM_WORLD, &partitions);
     send_buffer = new MessageBuffer ** [partitions];
+    send_buffer_sets = new MessageBuffer ** [partitions];
     recv_buffer = new MessageBuffer ** [partitions];
     for (int i=0;i<partitions;i++) {
-      send_buffer[i] = new MessageBuffer * [sockets];
+      send_buffer_sets[i] = new MessageBuffer * [sockets];
       recv_buffer[i] = new MessageBuffer * [sockets];
       for (int s_i=0;s_i<sockets;s_i++) {
-        send_buffer[i][s_i] = (MessageBuffer*)numa_alloc_onnode( sizeof(MessageBuffer), s_i);
-        send_buffer[i][s_i]->init(s_i);
-        recv_buffer[i][s_i] = (MessageBuffer*)numa_alloc_onnode( sizeof(MessageBuffer), s_i);
-        recv_buffer[i][s_i]->init(s_i);
+        send_buffer_sets[i][s_i] = (MessageBuffer*)numa_alloc_onnode( sizeof(MessageBuffer), get_socket_node(s_i));
+        send_buffer_sets[i][s_i]->init(get_socket_node(s_i));
+        recv_buffer[i][s_i] = (MessageBuffer*)numa_alloc_onnode( sizeof(MessageBuffer), get_socket_node(s_i));
+        recv_buffer[i][s_i]->init(get_socket_node(s_i));
       }
+      send_buffer[i] = send_buffer_sets[i];
     }
 
     alpha = 8 * (partitions - 1);
 
+    const char * env_snapshot_path = getenv("GEMINI_SNAPSHOT");
+    snapshot_path = env_snapshot_path==NULL ? "" : env_snapshot_path;
+    const char * env_staging_path = getenv("GEMINI_STAGING");
+    staging_path = env_staging_path==NULL ? "" : env_staging_path;
+    const char * env_adj_storage_path = getenv("GEMINI_ADJ_STORAGE");
+    adj_storage_path = env_adj_storage_path==NULL ? "" : env_adj_storage_path;
+    snapshot_adj_data = NULL;
+    snapshot_adj_bytes = 0;
+    const char * env_vertex_order = getenv("GEMINI_REORDER");
+    vertex_order = OriginalOrder;
+    if (env_vertex_order!=NULL && strcmp(env_vertex_order, "degree")==0) {
+      vertex_order = DegreeOrder;
+    } else if (env_vertex_order!=NULL && strcmp(env_vertex_order, "hub")==0) {
+      vertex_order = HubOrder;
+    } else {
+      assert(env_vertex_order==NULL || strcmp(env_vertex_order, "none")==0);
+    }
+    original_id = NULL;
+    internal_id = NULL;
+    const char * env_node_shared = getenv("GEMINI_NODE_SHARED");
+    if (env_node_shared==NULL || strcmp(env_node_shared, "0")!=0) {
+      MPI_Comm_split_type(MPI_COMM_WORLD, MPI_COMM_TYPE_SHARED, partition_id, MPI_INFO_NULL, &node_comm);
+    } else {
+      MPI_Comm_dup(MPI_COMM_SELF, &node_comm);
+    }
+    MPI_Comm_rank(node_comm, &node_rank);
+    MPI_Comm_size(node_comm, &node_partitions);
+    MPI_Comm_split(MPI_COMM_WORLD, node_rank==0 ? 0 : MPI_UNDEFINED, partition_id, &leader_comm);
+    const char * env_hub_split = getenv("GEMINI_HUB_SPLIT");
+    hub_split_threshold = 0;
+    if (env_hub_split!=NULL && strcmp(env_hub_split, "auto")==0) {
+      hub_split_threshold = -1;
+    } else if (env_hub_split!=NULL) {
+      hub_split_threshold = std::atol(env_hub_split);
+      assert(hub_split_threshold >= 0);
+    }
+    hub_split_replicas = 0;
+    const char * env_adj_compression = getenv("GEMINI_COMPRESS_ADJ");
+    adj_compression = env_adj_compression!=NULL && strcmp(env_adj_compression, "0")!=0;
+    max_adj_edges = 0;
+    adj_scratch = NULL;
+    const char * env_direction_policy = getenv("GEMINI_DIRECTION");
+    direction_policy = FixedThreshold;
+    if (env_direction_policy!=NULL && strcmp(env_direction_policy, "cost")==0) {
+      direction_policy = CostModel;
+    } else if (env_direction_policy!=NULL && strcmp(env_direction_policy, "auto")==0) {
+      direction_policy = AutoTuned;
+    } else {
+      assert(env_direction_policy==NULL || strcmp(env_direction_policy, "fixed")==0);
+    }
+    const char * env_sparse_threshold = getenv("GEMINI_SPARSE_THRESHOLD");
+    sparse_threshold = env_sparse_threshold==NULL ? 0.05 : std::atof(env_sparse_threshold);
+    const char * env_async = getenv("GEMINI_ASYNC");
+    async_threshold = env_async==NULL ? 0 : std::atof(env_async);
+    direction_alpha = 14;
+    direction_beta = 24;
+    last_sparse = true;
+    loaded_directions = BothDirections;
+    for (int i=0;i<5;i++) {
+      sparse_samples[i] = 0;
+    }
+    for (int i=0;i<2;i++) {
+      dense_samples[i] = 0;
+    }
+    const char * env_wire = getenv("GEMINI_WIRE");
+    assert(env_wire==NULL || strcmp(env_wire, "raw")==0 || strcmp(env_wire, "adaptive")==0 || strcmp(env_wire, "lossy")==0);
+    wire_adaptive = env_wire!=NULL && strcmp(env_wire, "raw")!=0;
+    wire_lossy = env_wire!=NULL && strcmp(env_wire, "lossy")==0;
+    wire_send_buffer = NULL;
+    wire_recv_buffer = NULL;
+    if (wire_adaptive) {
+      wire_send_buffer = new MessageBuffer * [sockets];
+      for (int s_i=0;s_i<sockets;s_i++) {
+        wire_send_buffer[s_i] = (MessageBuffer*)numa_alloc_onnode( sizeof(MessageBuffer), get_socket_node(s_i));
+        wire_send_buffer[s_i]->init(get_socket_node(s_i));
+      }
+      wire_recv_buffer = new MessageBuffer * [partitions];
+      for (int i=0;i<partitions;i++) {
+        wire_recv_buffer[i] = (MessageBuffer*)numa_alloc_onnode( sizeof(MessageBuffer), get_socket_node(0));
+        wire_recv_buffer[i]->init(get_socket_node(0));
+      }
+    }
+    const char * env_stream = getenv("GEMINI_STREAM");
+    stream_chunk_bytes = env_stream==NULL ? 0 : std::atol(env_stream);
+    assert(stream_chunk_bytes==0 || !wire_adaptive);
+    const char * env_message_budget = getenv("GEMINI_MESSAGE_BUDGET");
+    message_budget = env_message_budget==NULL ? 0 : std::atol(env_message_budget);
+    init_node_messages();
+    peak_message_bytes = 0;
+    stream_chunk = 0;
+    stream_chunks = 0;
+    combine_buffer = NULL;
+    combine_buffer_size = 0;
+    combine_present = NULL;
+    combine_lock = NULL;
+    in_process_edges = false;
+    const char * env_dump_compression = getenv("GEMINI_DUMP_COMPRESS");
+    dump_compression = env_dump_compression!=NULL && strcmp(env_dump_compression, "0")!=0;
+    const char * env_checkpoint_path = getenv("GEMINI_CHECKPOINT");
+    checkpoint_path = env_checkpoint_path==NULL ? "" : env_checkpoint_path;
+    const char * env_checkpoint_interval = getenv("GEMINI_CHECKPOINT_INTERVAL");
+    checkpoint_interval = env_checkpoint_interval==NULL ? 0 : std::atof(env_checkpoint_interval);
+    checkpoint_time = get_time();
+    checkpoint_slot = 0;
+    const char * env_checkpoint_abort = getenv("GEMINI_CHECKPOINT_ABORT");
+    checkpoint_abort = env_checkpoint_abort==NULL ? -1 : std::atoi(env_checkpoint_abort);
+    const char * env_metrics_path = getenv("GEMINI_METRICS");
+    if (env_metrics_path!=NULL) {
+      const char * env_metrics_format = getenv("GEMINI_METRICS_FORMAT");
+      assert(env_metrics_format==NULL || strcmp(env_metrics_format, "json")==0 || strcmp(env_metrics_format, "csv")==0);
+      metrics.open(env_metrics_path, env_metrics_format!=NULL && strcmp(env_metrics_format, "csv")==0 ? CsvMetrics : JsonMetrics, partition_id);
+    }
+
     MPI_Barrier(MPI_COMM_WORLD);
   }
 
+  // the background dumps have to be finished before MPI is finalized
+  ~Graph() {
+    wait_vertex_array_dumps();
+    if (checkpoint_thread.joinable()) {
+      checkpoint_thread.join();
+    }
+    for (auto & node_window : node_windows) {
+      MPI_Win_unlock_all(node_window.second);
+      MPI_Win_free(&node_window.second);
+    }
+    if (node_message_win!=MPI_WIN_NULL) {
+      MPI_Win_unlock_all(node_message_win);
+      MPI_Win_free(&node_message_win);
+    }
+    if (leader_comm!=MPI_COMM_NULL) {
+      MPI_Comm_free(&leader_comm);
+    }
+    MPI_Comm_free(&node_comm);
+  }
+
   // fill a vertex array with a specific value
   template<typename T>
   void fill_vertex_array(T * array, T value) {
@@ -230,14 +670,14 @@ public:
     char * array = (char *)mmap(NULL, sizeof(T) * vertices, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
     assert(array!=NULL);
     for (int s_i=0;s_i<sockets;s_i++) {
-      numa_tonode_memory(array + sizeof(T) * local_partition_offset[s_i], sizeof(T) * (local_partition_offset[s_i+1] - local_partition_offset[s_i]), s_i);
+      numa_tonode_memory(array + sizeof(T) * local_partition_offset[s_i], sizeof(T) * (local_partition_offset[s_i+1] - local_partition_offset[s_i]), get_socket_node(s_i));
     }
     return (T*)array;
   }
 
   // deallocate a vertex array
   template<typename T>
-  T * dealloc_vertex_array(T * array) {
+  void dealloc_vertex_array(T * array) {
     numa_free(array, sizeof(T) * vertices);
   }
 
@@ -249,157 +689,1070 @@ public:
     return array;
   }
 
-  // dump a vertex array to path
+  // allocate a numa-oblivious vertex array held once per node, in a shared-memory window of the partitions on it;
+  // they either write disjoint parts of it or leave the writing to node_rank 0, and sync_node_vertex_array publishes it
   template<typename T>
-  void dump_vertex_array(T * array, std::string path) {
-    long file_length = sizeof(T) * vertices;
-    if (!file_exists(path) || file_size(path) != file_length) {
-      if (partition_id==0) {
-        FILE * fout = fopen(path.c_str(), "wb");
-        char * buffer = new char [PAGESIZE];
-        for (long offset=0;offset<file_length;) {
-          if (file_length - offset >= PAGESIZE) {
-            fwrite(buffer, 1, PAGESIZE, fout);
-            offset += PAGESIZE;
-          } else {
-            fwrite(buffer, 1, file_length - offset, fout);
-            offset += file_length - offset;
-          }
+  T * alloc_node_vertex_array() {
+    if (node_partitions==1) {
+      return alloc_interleaved_vertex_array<T>();
+    }
+    T * array;
+    MPI_Win win;
+    int ret = MPI_Win_allocate_shared(node_rank==0 ? sizeof(T) * vertices : 0, sizeof(T), MPI_INFO_NULL, node_comm, &array, &win);
+    assert(ret==MPI_SUCCESS);
+    MPI_Aint bytes;
+    int disp_unit;
+    MPI_Win_shared_query(win, 0, &bytes, &disp_unit, &array);
+    if (node_rank==0) {
+      // the pages inside the window are interleaved like those of alloc_interleaved_vertex_array
+      char * begin = (char *)(((unsigned long)array + PAGESIZE - 1) / PAGESIZE * PAGESIZE);
+      char * end = (char *)(((unsigned long)array + bytes) / PAGESIZE * PAGESIZE);
+      if (begin < end) {
+        numa_interleave_memory(begin, end - begin, numa_all_nodes_ptr);
+      }
+    }
+    MPI_Win_lock_all(MPI_MODE_NOCHECK, win);
+    node_windows.emplace_back(array, win);
+    return array;
+  }
+
+  // deallocate a vertex array of alloc_node_vertex_array, on all partitions of the node
+  template<typename T>
+  void dealloc_node_vertex_array(T * array) {
+    if (node_partitions==1) {
+      numa_free(array, sizeof(T) * vertices);
+      return;
+    }
+    for (auto it=node_windows.begin();it!=node_windows.end();it++) {
+      if (it->first==(void *)array) {
+        MPI_Win_unlock_all(it->second);
+        MPI_Win_free(&it->second);
+        node_windows.erase(it);
+        return;
+      }
+    }
+    assert(false);
+  }
+
+  // make the writes to a node vertex array visible to all partitions of the node
+  void sync_node_vertex_array(void * array) {
+    if (node_partitions==1) return;
+    for (auto & node_window : node_windows) {
+      if (node_window.first==array) {
+        MPI_Win_sync(node_window.second);
+        MPI_Barrier(node_comm);
+        MPI_Win_sync(node_window.second);
+        return;
+      }
+    }
+    assert(false);
+  }
+
+  // sum a node vertex array, which the partitions of each node may have added to concurrently, over all nodes;
+  // only the node leaders exchange it
+  template<typename T>
+  void allreduce_node_vertex_array(T * array) {
+    sync_node_vertex_array(array);
+    if (node_rank==0) {
+      MPI_Allreduce(MPI_IN_PLACE, array, vertices, get_mpi_data_type<T>(), MPI_SUM, leader_comm);
+    }
+    sync_node_vertex_array(array);
+  }
+
+  // find the nodes of all partitions and set up the views of the node message path, unless GEMINI_NODE_MESSAGES=0,
+  // every node has a single partition, or the batches are streamed, encoded or held within a budget
+  void init_node_messages() {
+    int leader = partition_id;
+    MPI_Bcast(&leader, 1, MPI_INT, 0, node_comm);
+    std::vector<int> leaders (partitions);
+    MPI_Allgather(&leader, 1, MPI_INT, leaders.data(), 1, MPI_INT, MPI_COMM_WORLD);
+    std::vector<int> leader_node (partitions);
+    node_of.assign(partitions, 0);
+    node_members.clear();
+    for (int i=0;i<partitions;i++) {
+      if (leaders[i]==i) {
+        leader_node[i] = node_members.size();
+        node_members.emplace_back();
+      }
+      node_of[i] = leader_node[leaders[i]];
+      node_members[node_of[i]].push_back(i);
+    }
+    const char * env_node_messages = getenv("GEMINI_NODE_MESSAGES");
+    node_messages = (env_node_messages==NULL || strcmp(env_node_messages, "0")!=0) && (int)node_members.size() < partitions
+      && stream_chunk_bytes==0 && !wire_adaptive && message_budget==0;
+    node_message_win = MPI_WIN_NULL;
+    node_message_bytes.assign(node_partitions, 0);
+    node_recv_bytes = 0;
+    node_send_buffer = NULL;
+    node_recv_buffer = NULL;
+    if (node_messages) {
+      node_send_buffer = new MessageBuffer ** [partitions];
+      node_recv_buffer = new MessageBuffer ** [partitions];
+      for (int i=0;i<partitions;i++) {
+        node_send_buffer[i] = new MessageBuffer * [sockets];
+        node_recv_buffer[i] = new MessageBuffer * [sockets];
+        for (int s_i=0;s_i<sockets;s_i++) {
+          node_send_buffer[i][s_i] = new MessageBuffer();
+          node_recv_buffer[i][s_i] = new MessageBuffer();
         }
-        fclose(fout);
       }
-      MPI_Barrier(MPI_COMM_WORLD);
     }
-    int fd = open(path.c_str(), O_RDWR);
-    assert(fd!=-1);
-    long offset = sizeof(T) * partition_offset[partition_id];
-    long end_offset = sizeof(T) * partition_offset[partition_id+1];
-    void * data = (void *)array;
-    assert(lseek(fd, offset, SEEK_SET)!=-1);
-    while (offset < end_offset) {
-      long bytes = write(fd, data + offset, end_offset - offset);
-      assert(bytes!=-1);
-      offset += bytes;
+  }
+
+  // the dense-mode messages to partition i per socket
+  size_t node_dense_units(int i) {
+    return (size_t)(partition_offset[i+1] - partition_offset[i]) * sockets + hub_split_replicas;
+  }
+
+  // where the batch of socket s_i to partition i (dense mode) or to all partitions (sparse mode) begins, in bytes into
+  // the segment of this partition
+  size_t node_send_offset(size_t unit, bool sparse, int i, int s_i) {
+    if (sparse) {
+      return unit * owned_vertices * sockets * s_i;
     }
-    assert(close(fd)==0);
+    size_t units = 0;
+    for (int j=0;j<i;j++) {
+      units += node_dense_units(j) * sockets;
+    }
+    return unit * (units + node_dense_units(i) * s_i);
+  }
+
+  // make room in the node message window for the batches of messages of unit bytes of every partition of this node,
+  // in either mode, and in the segment of the leader also for those from all other nodes; all partitions of the node
+  // take the same decision, since the sizes only depend on the partitioning
+  void alloc_node_message_window(size_t unit) {
+    int node_id = node_of[partition_id];
+    size_t dense_units = 0;
+    for (int i=0;i<partitions;i++) {
+      dense_units += node_dense_units(i) * sockets;
+    }
+    size_t node_dense = 0;
+    for (int i : node_members[node_id]) {
+      node_dense += node_dense_units(i) * sockets;
+    }
+    std::vector<size_t> batch_bytes (node_partitions);
+    bool fits = node_message_win!=MPI_WIN_NULL;
+    for (int r_i=0;r_i<node_partitions;r_i++) {
+      int i = node_members[node_id][r_i];
+      size_t sparse_units = (size_t)(partition_offset[i+1] - partition_offset[i]) * sockets * sockets;
+      batch_bytes[r_i] = std::max(node_batch_bytes[r_i], unit * std::max(sparse_units, dense_units));
+      fits = fits && batch_bytes[r_i]==node_batch_bytes[r_i];
+    }
+    size_t recv_sparse_units = 0;
+    size_t recv_dense_units = 0;
+    for (int i=0;i<partitions;i++) {
+      if (node_of[i]!=node_id) {
+        recv_sparse_units += (size_t)(partition_offset[i+1] - partition_offset[i]) * sockets * sockets;
+        recv_dense_units += node_dense;
+      }
+    }
+    size_t recv_bytes = std::max(node_recv_bytes, unit * std::max(recv_sparse_units, recv_dense_units));
+    if (fits && recv_bytes==node_recv_bytes) return;
+    if (node_message_win!=MPI_WIN_NULL) {
+      MPI_Win_unlock_all(node_message_win);
+      MPI_Win_free(&node_message_win);
+    }
+    node_message_bytes = batch_bytes;
+    node_recv_bytes = recv_bytes;
+    // the segments are sized for full batches but only the pages written to are backed, on the socket writing them
+    MPI_Info info;
+    MPI_Info_create(&info);
+    MPI_Info_set(info, "alloc_shared_noncontig", "true");
+    char * base;
+    size_t bytes = node_message_bytes[node_rank] + (node_rank==0 ? node_recv_bytes : 0);
+    int ret = MPI_Win_allocate_shared(bytes, 1, info, node_comm, &base, &node_message_win);
+    assert(ret==MPI_SUCCESS);
+    MPI_Info_free(&info);
+    node_message_base.assign(node_partitions, NULL);
+    for (int r_i=0;r_i<node_partitions;r_i++) {
+      MPI_Aint segment_bytes;
+      int disp_unit;
+      MPI_Win_shared_query(node_message_win, r_i, &segment_bytes, &disp_unit, &node_message_base[r_i]);
+    }
+    MPI_Win_lock_all(MPI_MODE_NOCHECK, node_message_win);
+  }
+
+  // dump a vertex array to path, in input vertex order; compressed if GEMINI_DUMP_COMPRESS is set
+  template<typename T>
+  void dump_vertex_array(T * array, std::string path) {
+    T * data = array + partition_offset[partition_id];
+    T * ordered = NULL;
+    if (original_id!=NULL) {
+      // the file is in input vertex order; partition i writes the input ids in [partition_offset[i], partition_offset[i+1])
+      ordered = new T [owned_vertices];
+      permute_owned_values(array + partition_offset[partition_id], original_id + partition_offset[partition_id], ordered);
+      data = ordered;
+    }
+    write_vertex_file(path, (const char *)data, partition_offset[partition_id], owned_vertices, vertices, sizeof(T), dump_compression, true, MPI_COMM_WORLD);
+    if (ordered!=NULL) {
+      delete [] ordered;
+    }
+  }
+
+  // dump a vertex array to path like dump_vertex_array, but write it in the background; the array can be
+  // changed once this returns, and wait_vertex_array_dumps has to be called before the file is read
+  template<typename T>
+  void dump_vertex_array_async(T * array, std::string path) {
+    // an earlier dump to the same path is finished first
+    for (auto it=dump_threads.begin();it!=dump_threads.end();) {
+      if (it->first==path) {
+        it->second.join();
+        it = dump_threads.erase(it);
+      } else {
+        it++;
+      }
+    }
+    T * data = new T [owned_vertices];
+    save_owned_values(array + partition_offset[partition_id], data);
+    // the writer's collective calls must not interleave with those of the caller
+    MPI_Comm comm;
+    MPI_Comm_dup(MPI_COMM_WORLD, &comm);
+    VertexId begin = partition_offset[partition_id];
+    VertexId count = owned_vertices;
+    dump_threads.emplace_back(path, std::thread([=]() mutable {
+      write_vertex_file(path, (const char *)data, begin, count, vertices, sizeof(T), dump_compression, false, comm);
+      MPI_Comm_free(&comm);
+      delete [] data;
+    }));
+  }
+
+  // wait for the background writers of dump_vertex_array_async
+  void wait_vertex_array_dumps() {
+    for (auto & dump_thread : dump_threads) {
+      dump_thread.second.join();
+    }
+    dump_threads.clear();
   }
 
-  // restore a vertex array from path
+  // restore a vertex array from path, which may be compressed
   template<typename T>
   void restore_vertex_array(T * array, std::string path) {
-    long file_length = sizeof(T) * vertices;
-    if (!file_exists(path) || file_size(path) != file_length) {
-      assert(false);
+    assert(file_exists(path));
+    T * data = array + partition_offset[partition_id];
+    T * ordered = NULL;
+    if (original_id!=NULL) {
+      ordered = new T [owned_vertices];
+      data = ordered;
     }
-    int fd = open(path.c_str(), O_RDWR);
-    assert(fd!=-1);
-    long offset = sizeof(T) * partition_offset[partition_id];
-    long end_offset = sizeof(T) * partition_offset[partition_id+1];
-    void * data = (void *)array;
-    assert(lseek(fd, offset, SEEK_SET)!=-1);
-    while (offset < end_offset) {
-      long bytes = read(fd, data + offset, end_offset - offset);
-      assert(bytes!=-1);
-      offset += bytes;
+    read_vertex_file(path, (char *)data, partition_offset[partition_id], owned_vertices, vertices, sizeof(T), MPI_COMM_WORLD);
+    if (ordered!=NULL) {
+      permute_owned_values(ordered, internal_id + partition_offset[partition_id], array + partition_offset[partition_id]);
+      delete [] ordered;
     }
-    assert(close(fd)==0);
   }
 
-  // gather a vertex array
+  // gather a vertex array to root, in input vertex order
   template<typename T>
   void gather_vertex_array(T * array, int root) {
+    MPI_Datatype value_t;
+    MPI_Type_contiguous(sizeof(T), MPI_CHAR, &value_t);
+    MPI_Type_commit(&value_t);
+    // every partition sends its range in pieces of at most GATHER_PIECE values, whose counts fit an int
+    std::vector<MPI_Request> requests;
+    auto post_pieces = [&](int i) {
+      for (VertexId begin=partition_offset[i];begin<partition_offset[i+1];begin+=GATHER_PIECE) {
+        int count = std::min((VertexId)GATHER_PIECE, partition_offset[i+1] - begin);
+        requests.emplace_back();
+        if (i==partition_id) {
+          MPI_Isend(array + begin, count, value_t, root, GatherVertexArray, MPI_COMM_WORLD, &requests.back());
+        } else {
+          MPI_Irecv(array + begin, count, value_t, i, GatherVertexArray, MPI_COMM_WORLD, &requests.back());
+        }
+      }
+    };
     if (partition_id!=root) {
-      MPI_Send(array + partition_offset[partition_id], sizeof(T) * owned_vertices, MPI_CHAR, root, GatherVertexArray, MPI_COMM_WORLD);
+      post_pieces(partition_id);
     } else {
       for (int i=0;i<partitions;i++) {
-        if (i==partition_id) continue;
-        MPI_Status recv_status;
-        MPI_Recv(array + partition_offset[i], sizeof(T) * (partition_offset[i + 1] - partition_offset[i]), MPI_CHAR, i, GatherVertexArray, MPI_COMM_WORLD, &recv_status);
-        int length;
-        MPI_Get_count(&recv_status, MPI_CHAR, &length);
-        assert(length == sizeof(T) * (partition_offset[i + 1] - partition_offset[i]));
+        if (i!=partition_id) {
+          post_pieces(i);
+        }
+      }
+    }
+    MPI_Waitall(requests.size(), requests.data(), MPI_STATUSES_IGNORE);
+    if (partition_id==root && original_id!=NULL) {
+      T * ordered = new T [vertices];
+      #pragma omp parallel for
+      for (VertexId v_i=0;v_i<vertices;v_i++) {
+        ordered[original_id[v_i]] = array[v_i];
       }
+      memcpy(array, ordered, sizeof(T) * vertices);
+      delete [] ordered;
     }
+    MPI_Type_free(&value_t);
   }
 
-  // allocate a vertex subset
-  VertexSubset * alloc_vertex_subset() {
-    return new VertexSubset(vertices);
+  // copy the values of the owned vertices to ordered, in input vertex order
+  template<typename T>
+  void save_owned_values(T * values, T * ordered) {
+    if (original_id!=NULL) {
+      permute_owned_values(values, original_id + partition_offset[partition_id], ordered);
+    } else {
+      memcpy(ordered, values, sizeof(T) * owned_vertices);
+    }
   }
 
-  int get_partition_id(VertexId v_i){
-    for (int i=0;i<partitions;i++) {
-      if (v_i >= partition_offset[i] && v_i < partition_offset[i+1]) {
-        return i;
-      }
+  // copy the values of the owned input vertex ids back to values, in internal vertex order
+  template<typename T>
+  void load_owned_values(T * ordered, T * values) {
+    if (internal_id!=NULL) {
+      permute_owned_values(ordered, internal_id + partition_offset[partition_id], values);
+    } else {
+      memcpy(values, ordered, sizeof(T) * owned_vertices);
     }
-    assert(false);
   }
 
-  int get_local_partition_id(VertexId v_i){
-    for (int s_i=0;s_i<sockets;s_i++) {
-      if (v_i >= local_partition_offset[s_i] && v_i < local_partition_offset[s_i+1]) {
-        return s_i;
+  // register a vertex array with the checkpoints; the variable is kept, so that swapping arrays is followed
+  template<typename T>
+  void checkpoint_vertex_array(T * & array, std::string name) {
+    T ** variable = &array;
+    CheckpointEntry entry;
+    entry.name = name;
+    entry.per_vertex = true;
+    entry.value_size = sizeof(T);
+    entry.save = [this, variable](char * buffer) {
+      save_owned_values(*variable + partition_offset[partition_id], (T *)buffer);
+    };
+    entry.load = [this, variable](char * buffer) {
+      load_owned_values((T *)buffer, *variable + partition_offset[partition_id]);
+    };
+    add_checkpoint_entry(entry);
+  }
+
+  // register a vertex subset with the checkpoints, like a vertex array; only the bits of the owned vertices are kept
+  void checkpoint_vertex_subset(VertexSubset * & subset, std::string name) {
+    VertexSubset ** variable = &subset;
+    CheckpointEntry entry;
+    entry.name = name;
+    entry.per_vertex = true;
+    entry.value_size = sizeof(unsigned char);
+    entry.save = [this, variable](char * buffer) {
+      unsigned char * bits = new unsigned char [owned_vertices];
+      #pragma omp parallel for
+      for (VertexId v_i=partition_offset[partition_id];v_i<partition_offset[partition_id+1];v_i++) {
+        bits[v_i - partition_offset[partition_id]] = (*variable)->get_bit(v_i)!=0;
       }
-    }
-    assert(false);
+      save_owned_values(bits, (unsigned char *)buffer);
+      delete [] bits;
+    };
+    entry.load = [this, variable](char * buffer) {
+      unsigned char * bits = new unsigned char [owned_vertices];
+      load_owned_values((unsigned char *)buffer, bits);
+      #pragma omp parallel for
+      for (VertexId v_i=partition_offset[partition_id];v_i<partition_offset[partition_id+1];v_i++) {
+        if (bits[v_i - partition_offset[partition_id]]) {
+          (*variable)->set_bit(v_i);
+        } else {
+          (*variable)->clear_bit(v_i);
+        }
+      }
+      delete [] bits;
+    };
+    add_checkpoint_entry(entry);
   }
 
-  // load a directed graph and make it undirected
-  void load_undirected_from_directed(std::string path, VertexId vertices) {
-    double prep_time = 0;
-    prep_time -= MPI_Wtime();
+  // register a value with the checkpoints, e.g. a convergence measure; the value of partition 0 is kept
+  template<typename T>
+  void checkpoint_value(T & value, std::string name) {
+    T * variable = &value;
+    CheckpointEntry entry;
+    entry.name = name;
+    entry.per_vertex = false;
+    entry.value_size = sizeof(T);
+    entry.save = [variable](char * buffer) {
+      memcpy(buffer, variable, sizeof(T));
+    };
+    entry.load = [variable](char * buffer) {
+      memcpy(variable, buffer, sizeof(T));
+    };
+    add_checkpoint_entry(entry);
+  }
 
-    symmetric = true;
+  // add a registered variable, in the same order on all partitions
+  void add_checkpoint_entry(CheckpointEntry & entry) {
+    assert(entry.name.size() < sizeof(CheckpointEntryHeader::name));
+    for (auto & other : checkpoint_entries) {
+      assert(other.name!=entry.name);
+    }
+    checkpoint_entries.push_back(entry);
+  }
 
-    MPI_Datatype vid_t = get_mpi_data_type<VertexId>();
+  // get the file of a registered vertex array or subset in a checkpoint slot
+  std::string get_checkpoint_filename(std::string name, int slot) {
+    return checkpoint_path + "." + name + "." + std::to_string(slot);
+  }
 
-    this->vertices = vertices;
-    long total_bytes = file_size(path.c_str());
-    this->edges = total_bytes / edge_unit_size;
+  // checkpoint the registered variables after an iteration if GEMINI_CHECKPOINT is set and GEMINI_CHECKPOINT_INTERVAL
+  // seconds have passed since the last checkpoint; the values are copied at once and written in the background, and
+  // the checkpoint replaces the previous one once all of it is written
+  bool checkpoint(int iteration) {
+    if (checkpoint_path=="") return false;
+    int take = get_time() - checkpoint_time >= checkpoint_interval;
+    if (checkpoint_interval > 0) {
+      MPI_Bcast(&take, 1, MPI_INT, 0, MPI_COMM_WORLD);
+    }
+    if (!take) return false;
+    double checkpoint_call_time = 0;
+    checkpoint_call_time -= MPI_Wtime();
+    // a slow writer holds the computation back rather than falling behind by more than a checkpoint
+    if (checkpoint_thread.joinable()) {
+      checkpoint_thread.join();
+    }
+    int slot = 1 - checkpoint_slot;
+    checkpoint_slot = slot;
+    std::vector<char> manifest (sizeof(CheckpointHeader));
+    CheckpointHeader header;
+    header.magic = CHECKPOINT_MAGIC;
+    header.iteration = iteration;
+    header.slot = slot;
+    header.vertex_id_size = sizeof(VertexId);
+    header.vertices = vertices;
+    header.entries = checkpoint_entries.size();
+    memcpy(manifest.data(), &header, sizeof(CheckpointHeader));
+    std::vector<std::string> filenames;
+    std::vector<size_t> value_sizes;
+    std::vector<char *> buffers;
+    for (auto & entry : checkpoint_entries) {
+      CheckpointEntryHeader entry_header;
+      memset(&entry_header, 0, sizeof(CheckpointEntryHeader));
+      strcpy(entry_header.name, entry.name.c_str());
+      entry_header.per_vertex = entry.per_vertex;
+      entry_header.value_size = entry.value_size;
+      size_t offset = manifest.size();
+      manifest.resize(offset + sizeof(CheckpointEntryHeader) + (entry.per_vertex ? 0 : entry.value_size));
+      memcpy(manifest.data() + offset, &entry_header, sizeof(CheckpointEntryHeader));
+      if (entry.per_vertex) {
+        char * buffer = new char [entry.value_size * owned_vertices];
+        entry.save(buffer);
+        filenames.push_back(get_checkpoint_filename(entry.name, slot));
+        value_sizes.push_back(entry.value_size);
+        buffers.push_back(buffer);
+      } else {
+        entry.save(manifest.data() + offset + sizeof(CheckpointEntryHeader));
+      }
+    }
+    MPI_Comm comm;
+    MPI_Comm_dup(MPI_COMM_WORLD, &comm);
+    checkpoint_thread = std::thread([this, comm, manifest, filenames, value_sizes, buffers]() mutable {
+      for (size_t f_i=0;f_i<filenames.size();f_i++) {
+        write_vertex_file(filenames[f_i], buffers[f_i], partition_offset[partition_id], owned_vertices, vertices, value_sizes[f_i], dump_compression, false, comm);
+        delete [] buffers[f_i];
+      }
+      MPI_Barrier(comm);
+      // the manifest names the slot, so that it replaces the previous checkpoint at once
+      if (partition_id==0) {
+        std::string filename = checkpoint_path + ".checkpoint";
+        std::string tmp_filename = filename + ".tmp";
+        int fd = open(tmp_filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        assert(fd!=-1);
+        write_snapshot_section(fd, manifest.data(), manifest.size());
+        assert(fsync(fd)==0);
+        assert(close(fd)==0);
+        assert(rename(tmp_filename.c_str(), filename.c_str())==0);
+      }
+      MPI_Comm_free(&comm);
+    });
+    checkpoint_time = get_time();
+    checkpoint_call_time += MPI_Wtime();
+    record_load_metrics(checkpoint_call_time, "checkpoint");
+    if (iteration==checkpoint_abort) {
+      // a failure right after the checkpoint, for testing the recovery
+      checkpoint_thread.join();
+      MPI_Barrier(MPI_COMM_WORLD);
+      MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+    return true;
+  }
+
+  // restore the registered variables from the last complete checkpoint; returns its iteration, or -1 if there is none
+  int restore_checkpoint() {
+    if (checkpoint_path=="") return -1;
+    std::string filename = checkpoint_path + ".checkpoint";
+    long manifest_bytes = 0;
+    if (partition_id==0 && file_exists(filename)) {
+      manifest_bytes = file_size(filename);
+    }
+    MPI_Bcast(&manifest_bytes, 1, MPI_LONG, 0, MPI_COMM_WORLD);
+    if (manifest_bytes==0) return -1;
+    std::vector<char> manifest (manifest_bytes);
+    if (partition_id==0) {
+      FILE * fin = fopen(filename.c_str(), "rb");
+      assert(fin!=NULL);
+      assert(fread(manifest.data(), 1, manifest_bytes, fin)==(size_t)manifest_bytes);
+      fclose(fin);
+    }
+    MPI_Bcast(manifest.data(), manifest_bytes, MPI_CHAR, 0, MPI_COMM_WORLD);
+    CheckpointHeader header;
+    memcpy(&header, manifest.data(), sizeof(CheckpointHeader));
+    assert(header.magic==CHECKPOINT_MAGIC && header.vertex_id_size==(int)sizeof(VertexId) && header.vertices==vertices);
+    assert(header.entries==(int)checkpoint_entries.size());
+    size_t offset = sizeof(CheckpointHeader);
+    for (auto & entry : checkpoint_entries) {
+      CheckpointEntryHeader entry_header;
+      memcpy(&entry_header, manifest.data() + offset, sizeof(CheckpointEntryHeader));
+      offset += sizeof(CheckpointEntryHeader);
+      assert(entry.name==entry_header.name && entry_header.per_vertex==entry.per_vertex && entry_header.value_size==entry.value_size);
+      if (entry.per_vertex) {
+        char * buffer = new char [entry.value_size * owned_vertices];
+        read_vertex_file(get_checkpoint_filename(entry.name, header.slot), buffer, partition_offset[partition_id], owned_vertices, vertices, entry.value_size, MPI_COMM_WORLD);
+        entry.load(buffer);
+        delete [] buffer;
+      } else {
+        entry.load(manifest.data() + offset);
+        offset += entry.value_size;
+      }
+    }
+    checkpoint_slot = header.slot;
+    checkpoint_time = get_time();
     #ifdef PRINT_DEBUG_MESSAGES
     if (partition_id==0) {
-      printf("|V| = %u, |E| = %lu\n", vertices, edges);
+      printf("resumed after iteration %d from %s.*\n", header.iteration, checkpoint_path.c_str());
     }
     #endif
+    return header.iteration;
+  }
 
-    EdgeId read_edges = edges / partitions;
-    if (partition_id==partitions-1) {
-      read_edges += edges % partitions;
+  // forget the registered variables and remove the checkpoints, once the computation is complete
+  void finish_checkpoints() {
+    if (checkpoint_thread.joinable()) {
+      checkpoint_thread.join();
     }
-    long bytes_to_read = edge_unit_size * read_edges;
-    long read_offset = edge_unit_size * (edges / partitions * partition_id);
-    long read_bytes;
-    int fin = open(path.c_str(), O_RDONLY);
-    EdgeUnit<EdgeData> * read_edge_buffer = new EdgeUnit<EdgeData> [CHUNKSIZE];
-
-    out_degree = alloc_interleaved_vertex_array<VertexId>();
-    for (VertexId v_i=0;v_i<vertices;v_i++) {
-      out_degree[v_i] = 0;
-    }
-    assert(lseek(fin, read_offset, SEEK_SET)==read_offset);
-    read_bytes = 0;
-    while (read_bytes < bytes_to_read) {
-      long curr_read_bytes;
-      if (bytes_to_read - read_bytes > edge_unit_size * CHUNKSIZE) {
-        curr_read_bytes = read(fin, read_edge_buffer, edge_unit_size * CHUNKSIZE);
-      } else {
-        curr_read_bytes = read(fin, read_edge_buffer, bytes_to_read - read_bytes);
+    if (checkpoint_path!="" && partition_id==0) {
+      std::string filename = checkpoint_path + ".checkpoint";
+      if (file_exists(filename)) {
+        assert(unlink(filename.c_str())==0);
       }
-      assert(curr_read_bytes>=0);
-      read_bytes += curr_read_bytes;
-      EdgeId curr_read_edges = curr_read_bytes / edge_unit_size;
-      // #pragma omp parallel for
-      for (EdgeId e_i=0;e_i<curr_read_edges;e_i++) {
-        VertexId src = read_edge_buffer[e_i].src;
-        VertexId dst = read_edge_buffer[e_i].dst;
-        __sync_fetch_and_add(&out_degree[src], 1);
-        __sync_fetch_and_add(&out_degree[dst], 1);
+      for (auto & entry : checkpoint_entries) {
+        for (int slot=0;slot<2;slot++) {
+          std::string entry_filename = get_checkpoint_filename(entry.name, slot);
+          if (file_exists(entry_filename)) {
+            assert(unlink(entry_filename.c_str())==0);
+          }
+        }
       }
     }
-    MPI_Allreduce(MPI_IN_PLACE, out_degree, vertices, vid_t, MPI_SUM, MPI_COMM_WORLD);
+    checkpoint_entries.clear();
+    checkpoint_time = get_time();
+  }
 
-    // locality-aware chunking
+  // move values[i], which belongs to vertex partition_offset[partition_id] + i, to slot
+  // keys[i] - partition_offset[j] of permuted on the partition j whose range holds keys[i]
+  template<typename T>
+  void permute_owned_values(T * values, VertexId * keys, T * permuted) {
+    MPI_Datatype vid_t = get_mpi_data_type<VertexId>();
+    // the values are sent as opaque elements of sizeof(T) bytes, so that the counts stay element counts
+    MPI_Datatype value_t;
+    MPI_Type_contiguous(sizeof(T), MPI_CHAR, &value_t);
+    MPI_Type_commit(&value_t);
+    int * send_count = new int [partitions];
+    int * send_displ = new int [partitions];
+    int * recv_count = new int [partitions];
+    int * recv_displ = new int [partitions];
+    // bucket the keys by destination in parallel: every thread counts and then places the keys of its own range
+    int bucket_threads = omp_get_max_threads();
+    int * key_partition = new int [owned_vertices];
+    VertexId * thread_pos = new VertexId [bucket_threads * partitions];
+    for (int i=0;i<bucket_threads * partitions;i++) {
+      thread_pos[i] = 0;
+    }
+    auto thread_range = [&](int t_i, VertexId & begin, VertexId & end) {
+      begin = (VertexId)((unsigned long)owned_vertices * t_i / bucket_threads);
+      end = (VertexId)((unsigned long)owned_vertices * (t_i + 1) / bucket_threads);
+    };
+    #pragma omp parallel num_threads(bucket_threads)
+    {
+      int t_i = omp_get_thread_num();
+      VertexId begin, end;
+      thread_range(t_i, begin, end);
+      for (VertexId v_i=begin;v_i<end;v_i++) {
+        key_partition[v_i] = get_partition_id(keys[v_i]);
+        thread_pos[t_i * partitions + key_partition[v_i]] += 1;
+      }
+    }
+    // thread_pos[t_i * partitions + i]: from counts to the first slot of thread t_i in the bucket of partition i
+    VertexId offset = 0;
+    for (int i=0;i<partitions;i++) {
+      send_displ[i] = offset;
+      for (int t_i=0;t_i<bucket_threads;t_i++) {
+        VertexId count = thread_pos[t_i * partitions + i];
+        thread_pos[t_i * partitions + i] = offset;
+        offset += count;
+      }
+      send_count[i] = offset - send_displ[i];
+    }
+    MPI_Alltoall(send_count, 1, MPI_INT, recv_count, 1, MPI_INT, MPI_COMM_WORLD);
+    recv_displ[0] = 0;
+    for (int i=1;i<partitions;i++) {
+      recv_displ[i] = recv_displ[i-1] + recv_count[i-1];
+    }
+    assert(recv_displ[partitions-1] + recv_count[partitions-1] == (int)owned_vertices);
+    VertexId * send_keys = new VertexId [owned_vertices];
+    VertexId * recv_keys = new VertexId [owned_vertices];
+    T * send_values = new T [owned_vertices];
+    T * recv_values = new T [owned_vertices];
+    #pragma omp parallel num_threads(bucket_threads)
+    {
+      int t_i = omp_get_thread_num();
+      VertexId begin, end;
+      thread_range(t_i, begin, end);
+      VertexId * pos = thread_pos + t_i * partitions;
+      for (VertexId v_i=begin;v_i<end;v_i++) {
+        VertexId p = pos[key_partition[v_i]]++;
+        send_keys[p] = keys[v_i];
+        send_values[p] = values[v_i];
+      }
+    }
+    MPI_Alltoallv(send_keys, send_count, send_displ, vid_t, recv_keys, recv_count, recv_displ, vid_t, MPI_COMM_WORLD);
+    MPI_Alltoallv(send_values, send_count, send_displ, value_t, recv_values, recv_count, recv_displ, value_t, MPI_COMM_WORLD);
+    MPI_Type_free(&value_t);
+    #pragma omp parallel for
+    for (VertexId v_i=0;v_i<owned_vertices;v_i++) {
+      permuted[recv_keys[v_i] - partition_offset[partition_id]] = recv_values[v_i];
+    }
+    delete [] send_count;
+    delete [] send_displ;
+    delete [] recv_count;
+    delete [] recv_displ;
+    delete [] key_partition;
+    delete [] thread_pos;
+    delete [] send_keys;
+    delete [] recv_keys;
+    delete [] send_values;
+    delete [] recv_values;
+  }
+
+  // translate an input vertex id to the id used inside the engine
+  VertexId get_internal_id(VertexId v_i) {
+    return internal_id==NULL ? v_i : internal_id[v_i];
+  }
+
+  // translate an engine vertex id back to the input vertex id
+  VertexId get_original_id(VertexId v_i) {
+    return original_id==NULL ? v_i : original_id[v_i];
+  }
+
+  // renumber the vertices by vertex_order; degree is indexed by input ids and gets permuted in place
+  void reorder_vertices(VertexId * degree) {
+    original_id = alloc_node_vertex_array<VertexId>();
+    internal_id = alloc_node_vertex_array<VertexId>();
+    // the node vertex arrays (including degree) are computed once per node
+    if (node_rank==0) {
+      #pragma omp parallel for
+      for (VertexId v_i=0;v_i<vertices;v_i++) {
+        original_id[v_i] = v_i;
+      }
+      if (vertex_order==DegreeOrder) {
+        // high-degree vertices first, so that frequently read vertex data shares cache lines and pages
+        std::stable_sort(original_id, original_id + vertices, [&](VertexId a, VertexId b){
+          return degree[a] > degree[b];
+        });
+      } else if (vertex_order==HubOrder) {
+        // hub clustering: vertices with above-average degree first, otherwise keeping the input order
+        EdgeId average_degree = edges / vertices;
+        std::stable_partition(original_id, original_id + vertices, [&](VertexId v_i){
+          return degree[v_i] > average_degree;
+        });
+      }
+      #pragma omp parallel for
+      for (VertexId v_i=0;v_i<vertices;v_i++) {
+        internal_id[original_id[v_i]] = v_i;
+      }
+      permute_to_internal(degree);
+    }
+    sync_node_vertex_array(original_id);
+    sync_node_vertex_array(internal_id);
+    sync_node_vertex_array(degree);
+  }
+
+  // permute a numa-oblivious vertex array indexed by input ids to internal ids
+  template<typename T>
+  void permute_to_internal(T * array) {
+    T * permuted = new T [vertices];
+    #pragma omp parallel for
+    for (VertexId v_i=0;v_i<vertices;v_i++) {
+      permuted[v_i] = array[original_id[v_i]];
+    }
+    memcpy(array, permuted, sizeof(T) * vertices);
+    delete [] permuted;
+  }
+
+  // allocate a vertex subset
+  VertexSubset * alloc_vertex_subset() {
+    return new VertexSubset(vertices);
+  }
+
+  int get_partition_id(VertexId v_i){
+    assert(v_i < partition_offset[partitions]);
+    return std::upper_bound(partition_offset, partition_offset + partitions + 1, v_i) - partition_offset - 1;
+  }
+
+  int get_local_partition_id(VertexId v_i){
+    for (int s_i=0;s_i<sockets;s_i++) {
+      if (v_i >= local_partition_offset[s_i] && v_i < local_partition_offset[s_i+1]) {
+        return s_i;
+      }
+    }
+    assert(false);
+  }
+
+  // allocate a buffer for staged edges; kept in anonymous memory or in an unlinked file under staging_path
+  char * alloc_staging_buffer(size_t bytes, int * fd) {
+    size_t mapped_bytes = std::max(bytes, (size_t)PAGESIZE);
+    char * buffer;
+    if (staging_path=="memory") {
+      *fd = -1;
+      buffer = (char*)mmap(NULL, mapped_bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    } else {
+      *fd = create_unlinked_file(staging_path + "/gemini-staging-XXXXXX", mapped_bytes);
+      buffer = (char*)mmap(NULL, mapped_bytes, PROT_READ | PROT_WRITE, MAP_SHARED, *fd, 0);
+    }
+    assert(buffer!=MAP_FAILED);
+    return buffer;
+  }
+
+  // create a file of the given size from a mkstemp template and unlink it, so that it goes away with its last mapping
+  int create_unlinked_file(std::string filename, size_t bytes) {
+    std::vector<char> filename_buffer(filename.begin(), filename.end());
+    filename_buffer.push_back('\0');
+    int fd = mkstemp(filename_buffer.data());
+    assert(fd!=-1);
+    unlink(filename_buffer.data());
+    int ret = ftruncate(fd, bytes);
+    assert(ret==0);
+    return fd;
+  }
+
+  // release a buffer from alloc_staging_buffer
+  void free_staging_buffer(char * buffer, size_t bytes, int fd) {
+    munmap(buffer, std::max(bytes, (size_t)PAGESIZE));
+    if (fd!=-1) {
+      close(fd);
+    }
+  }
+
+  // allocate the adjacency list of socket s_i; on the node of the socket, or mapped from a file under adj_storage_path
+  AdjUnit<EdgeData> * alloc_adj_list(size_t bytes, int s_i) {
+    if (adj_storage_path=="") {
+      return (AdjUnit<EdgeData>*)numa_alloc_onnode(bytes, get_socket_node(s_i));
+    }
+    size_t mapped_bytes = std::max(bytes, (size_t)PAGESIZE);
+    int fd = create_unlinked_file(adj_storage_path + "/gemini-adj-XXXXXX", mapped_bytes);
+    char * adj_list = (char*)mmap(NULL, mapped_bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    assert(adj_list!=MAP_FAILED);
+    assert(close(fd)==0);
+    return (AdjUnit<EdgeData>*)adj_list;
+  }
+
+  // release a list from alloc_adj_list
+  void free_adj_list(AdjUnit<EdgeData> * adj_list, size_t bytes) {
+    if (adj_storage_path=="") {
+      numa_free(adj_list, bytes);
+    } else {
+      munmap(adj_list, std::max(bytes, (size_t)PAGESIZE));
+    }
+  }
+
+  // have the kernel read ahead the dense-mode adjacency lists that the signals of partition i will scan, if they are out of core
+  void prefetch_dense_adj_lists(int i) {
+    if (adj_storage_path=="") return;
+    for (int s_i=0;s_i<sockets;s_i++) {
+      VertexId begin_p_v_i = tuned_chunks_dense[i][s_i * threads_per_socket].curr;
+      VertexId end_p_v_i = tuned_chunks_dense[i][(s_i + 1) * threads_per_socket - 1].end;
+      if (begin_p_v_i >= end_p_v_i) continue;
+      size_t scale = adj_compression ? 1 : unit_size;
+      uintptr_t begin = (uintptr_t)incoming_adj_list[s_i] + scale * compressed_incoming_adj_index[s_i][begin_p_v_i].index;
+      uintptr_t end = (uintptr_t)incoming_adj_list[s_i] + scale * compressed_incoming_adj_index[s_i][end_p_v_i].index;
+      begin &= ~(uintptr_t)(PAGESIZE - 1);
+      if (end > begin) {
+        madvise((void*)begin, end - begin, MADV_WILLNEED);
+      }
+    }
+  }
+
+  // stream the byte range [read_offset, read_offset + bytes_to_read) of an edge file chunk by chunk;
+  // a reader thread keeps the following chunks in flight while process() works on the current one
+  template<typename F>
+  void read_edge_chunks(int fin, long read_offset, long bytes_to_read, F process) {
+    const int read_buffers = 3;
+    long chunk_bytes = edge_unit_size * CHUNKSIZE;
+    long chunks = (bytes_to_read + chunk_bytes - 1) / chunk_bytes;
+    EdgeUnit<EdgeData> * read_edge_buffer[read_buffers];
+    EdgeId read_edges[read_buffers];
+    for (int b_i=0;b_i<read_buffers;b_i++) {
+      read_edge_buffer[b_i] = new EdgeUnit<EdgeData> [CHUNKSIZE];
+    }
+    long filled_chunks = 0;
+    long consumed_chunks = 0;
+    std::mutex chunk_mutex;
+    std::condition_variable chunk_cond;
+    std::thread read_thread([&](){
+      for (long c_i=0;c_i<chunks;c_i++) {
+        {
+          std::unique_lock<std::mutex> lock(chunk_mutex);
+          chunk_cond.wait(lock, [&](){ return c_i - consumed_chunks < read_buffers; });
+        }
+        int b_i = c_i % read_buffers;
+        long offset = chunk_bytes * c_i;
+        long curr_read_bytes = std::min(chunk_bytes, bytes_to_read - offset);
+        char * data = (char *)read_edge_buffer[b_i];
+        for (long read_bytes=0;read_bytes<curr_read_bytes;) {
+          long bytes = pread(fin, data + read_bytes, curr_read_bytes - read_bytes, read_offset + offset + read_bytes);
+          assert(bytes>0);
+          read_bytes += bytes;
+        }
+        read_edges[b_i] = curr_read_bytes / edge_unit_size;
+        {
+          std::unique_lock<std::mutex> lock(chunk_mutex);
+          filled_chunks = c_i + 1;
+        }
+        chunk_cond.notify_all();
+      }
+    });
+    for (long c_i=0;c_i<chunks;c_i++) {
+      {
+        std::unique_lock<std::mutex> lock(chunk_mutex);
+        chunk_cond.wait(lock, [&](){ return filled_chunks > c_i; });
+      }
+      int b_i = c_i % read_buffers;
+      process(read_edge_buffer[b_i], read_edges[b_i]);
+      {
+        std::unique_lock<std::mutex> lock(chunk_mutex);
+        consumed_chunks = c_i + 1;
+      }
+      chunk_cond.notify_all();
+    }
+    read_thread.join();
+    for (int b_i=0;b_i<read_buffers;b_i++) {
+      delete [] read_edge_buffer[b_i];
+    }
+  }
+
+  // shuffle the local slice of an edge file to the partitions selected by target.
+  // Chunks are bucketed by all threads and sent with MPI_Isend from double-buffered staging areas,
+  // so reading, bucketing and sending overlap.
+  // recv_edges(buffer, count) is invoked from a receiving thread for every incoming batch.
+  template<typename F>
+  void shuffle_edges(int fin, long read_offset, long bytes_to_read, ShuffleTarget target, F recv_edges) {
+    shuffle_edge_chunks([&](std::function<void(EdgeUnit<EdgeData> *, EdgeId)> process){
+      read_edge_chunks(fin, read_offset, bytes_to_read, process);
+    }, target, recv_edges);
+  }
+
+  // shuffle edges held in memory like shuffle_edges; the edges are left unchanged
+  template<typename F>
+  void shuffle_edges(EdgeUnit<EdgeData> * edges, EdgeId count, ShuffleTarget target, F recv_edges) {
+    shuffle_edge_chunks([&](std::function<void(EdgeUnit<EdgeData> *, EdgeId)> process){
+      EdgeUnit<EdgeData> * chunk = new EdgeUnit<EdgeData> [CHUNKSIZE];
+      for (EdgeId begin_e_i=0;begin_e_i<count;begin_e_i+=CHUNKSIZE) {
+        EdgeId chunk_edges = std::min((EdgeId)CHUNKSIZE, count - begin_e_i);
+        memcpy(chunk, edges + begin_e_i, edge_unit_size * chunk_edges);
+        process(chunk, chunk_edges);
+      }
+      delete [] chunk;
+    }, target, recv_edges);
+  }
+
+  // shuffle the chunks that for_each_chunk(process) passes to process (which may modify them) to their target partitions
+  template<typename S, typename F>
+  void shuffle_edge_chunks(S for_each_chunk, ShuffleTarget target, F recv_edges) {
+    int units = (target==SrcOwner || target==DstOwner) ? 1 : 2;
+    EdgeUnit<EdgeData> * recv_buffer = new EdgeUnit<EdgeData> [CHUNKSIZE * units];
+    std::thread recv_thread([&](){
+      int finished_count = 0;
+      MPI_Status recv_status;
+      while (finished_count < partitions) {
+        MPI_Probe(MPI_ANY_SOURCE, ShuffleGraph, MPI_COMM_WORLD, &recv_status);
+        int i = recv_status.MPI_SOURCE;
+        assert(recv_status.MPI_TAG == ShuffleGraph && i >=0 && i < partitions);
+        int recv_bytes;
+        MPI_Get_count(&recv_status, MPI_CHAR, &recv_bytes);
+        if (recv_bytes==1) {
+          finished_count += 1;
+          char c;
+          MPI_Recv(&c, 1, MPI_CHAR, i, ShuffleGraph, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+          continue;
+        }
+        assert(recv_bytes % edge_unit_size == 0);
+        assert((size_t)recv_bytes <= edge_unit_size * CHUNKSIZE * units);
+        MPI_Recv(recv_buffer, recv_bytes, MPI_CHAR, i, ShuffleGraph, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+        recv_edges(recv_buffer, (EdgeId)(recv_bytes / edge_unit_size));
+      }
+    });
+
+    char * staging_buffer[2];
+    MPI_Request * send_requests[2];
+    int pending_requests[2];
+    for (int b_i=0;b_i<2;b_i++) {
+      staging_buffer[b_i] = new char [edge_unit_size * CHUNKSIZE * units];
+      send_requests[b_i] = new MPI_Request [partitions];
+      pending_requests[b_i] = 0;
+    }
+    int * unit_partition = new int [CHUNKSIZE * units];
+    EdgeId * partition_units = new EdgeId [threads * partitions]; // EdgeId [threads] [partitions]
+    EdgeId * partition_begin = new EdgeId [partitions + 1];
+    int curr_staging = 0;
+    for_each_chunk([&](EdgeUnit<EdgeData> * read_edge_buffer, EdgeId curr_read_edges){
+      int b_i = curr_staging;
+      curr_staging = 1 - curr_staging;
+      MPI_Waitall(pending_requests[b_i], send_requests[b_i], MPI_STATUSES_IGNORE);
+      pending_requests[b_i] = 0;
+      char * staging = staging_buffer[b_i];
+      EdgeId curr_units = curr_read_edges * units;
+      #pragma omp parallel
+      {
+        int t_i = omp_get_thread_num();
+        int t_n = omp_get_num_threads();
+        EdgeId * curr_partition_units = partition_units + partitions * t_i;
+        for (int i=0;i<partitions;i++) {
+          curr_partition_units[i] = 0;
+        }
+        if (internal_id!=NULL) {
+          EdgeId begin_e_i = curr_read_edges * t_i / t_n;
+          EdgeId end_e_i = curr_read_edges * (t_i + 1) / t_n;
+          for (EdgeId e_i=begin_e_i;e_i<end_e_i;e_i++) {
+            read_edge_buffer[e_i].src = internal_id[read_edge_buffer[e_i].src];
+            read_edge_buffer[e_i].dst = internal_id[read_edge_buffer[e_i].dst];
+          }
+          #pragma omp barrier
+        }
+        EdgeId begin_u_i = curr_units * t_i / t_n;
+        EdgeId end_u_i = curr_units * (t_i + 1) / t_n;
+        for (EdgeId u_i=begin_u_i;u_i<end_u_i;u_i++) {
+          EdgeUnit<EdgeData> & edge = read_edge_buffer[u_i / units];
+          bool second = (u_i % units) == 1;
+          int i = get_partition_id((target==SrcOwner || second) ? edge.src : edge.dst);
+          if (target==BothOwners && second && i==get_partition_id(edge.dst)) {
+            unit_partition[u_i] = -1;
+            continue;
+          }
+          unit_partition[u_i] = i;
+          curr_partition_units[i] += 1;
+        }
+        #pragma omp barrier
+        #pragma omp single
+        {
+          EdgeId offset = 0;
+          for (int i=0;i<partitions;i++) {
+            partition_begin[i] = offset;
+            for (int t_j=0;t_j<t_n;t_j++) {
+              EdgeId count = partition_units[partitions * t_j + i];
+              partition_units[partitions * t_j + i] = offset;
+              offset += count;
+            }
+          }
+          partition_begin[partitions] = offset;
+        }
+        for (EdgeId u_i=begin_u_i;u_i<end_u_i;u_i++) {
+          int i = unit_partition[u_i];
+          if (i==-1) continue;
+          EdgeUnit<EdgeData> & edge = read_edge_buffer[u_i / units];
+          EdgeUnit<EdgeData> * unit = (EdgeUnit<EdgeData> *)(staging + edge_unit_size * curr_partition_units[i]);
+          curr_partition_units[i] += 1;
+          memcpy(unit, &edge, edge_unit_size);
+          if (target==DstOwnerSymmetric && u_i % units == 1) {
+            unit->src = edge.dst;
+            unit->dst = edge.src;
+          }
+        }
+      }
+      for (int i=0;i<partitions;i++) {
+        EdgeId count = partition_begin[i+1] - partition_begin[i];
+        if (count==0) continue;
+        MPI_Isend(staging + edge_unit_size * partition_begin[i], edge_unit_size * count, MPI_CHAR, i, ShuffleGraph, MPI_COMM_WORLD, &send_requests[b_i][pending_requests[b_i]]);
+        pending_requests[b_i] += 1;
+      }
+    });
+    for (int b_i=0;b_i<2;b_i++) {
+      MPI_Waitall(pending_requests[b_i], send_requests[b_i], MPI_STATUSES_IGNORE);
+    }
+    for (int i=0;i<partitions;i++) {
+      char c = 0;
+      MPI_Send(&c, 1, MPI_CHAR, i, ShuffleGraph, MPI_COMM_WORLD);
+    }
+    recv_thread.join();
+    // batches of the next pass share the tag; nobody may send them before every rank got all end markers
+    MPI_Barrier(MPI_COMM_WORLD);
+
+    for (int b_i=0;b_i<2;b_i++) {
+      delete [] staging_buffer[b_i];
+      delete [] send_requests[b_i];
+    }
+    delete [] unit_partition;
+    delete [] partition_units;
+    delete [] partition_begin;
+    delete [] recv_buffer;
+  }
+
+  // write the preprocessing (or snapshot loading) time as a "load" record, or that of an edge batch as an "update_edges" one
+  void record_load_metrics(double prep_time, const char * call = "load") {
+    if (!metrics.enabled()) return;
+    CallMetrics call_metrics;
+    call_metrics.call = call;
+    call_metrics.total_time = prep_time;
+    metrics.write(call_metrics);
+  }
+
+  // load a directed graph and make it undirected
+  void load_undirected_from_directed(std::string path, VertexId vertices) {
+    double prep_time = 0;
+    prep_time -= MPI_Wtime();
+
+    loaded_directions = BothDirections;
+    if (snapshot_path!="" && check_snapshot(snapshot_path, path, vertices, file_size(path) / edge_unit_size, true)) {
+      load_snapshot(snapshot_path);
+      prep_time += MPI_Wtime();
+      record_load_metrics(prep_time);
+      return;
+    }
+
+    symmetric = true;
+
+    MPI_Datatype vid_t = get_mpi_data_type<VertexId>();
+
+    this->vertices = vertices;
+    long total_bytes = file_size(path.c_str());
+    this->edges = total_bytes / edge_unit_size;
+    #ifdef PRINT_DEBUG_MESSAGES
+    if (partition_id==0) {
+      printf("|V| = %" PRIvid ", |E| = %lu\n", vertices, edges);
+    }
+    #endif
+
+    EdgeId read_edges = edges / partitions;
+    if (partition_id==partitions-1) {
+      read_edges += edges % partitions;
+    }
+    long bytes_to_read = edge_unit_size * read_edges;
+    long read_offset = edge_unit_size * (edges / partitions * partition_id);
+    int fin = open(path.c_str(), O_RDONLY);
+    assert(fin!=-1);
+    posix_fadvise(fin, read_offset, bytes_to_read, POSIX_FADV_SEQUENTIAL);
+
+    bool staged = staging_path!="";
+    // the partitions of a node count into a single copy of the degrees
+    out_degree = alloc_node_vertex_array<VertexId>();
+    if (node_rank==0) {
+      #pragma omp parallel for
+      for (VertexId v_i=0;v_i<vertices;v_i++) {
+        out_degree[v_i] = 0;
+      }
+    }
+    sync_node_vertex_array(out_degree);
+    read_edge_chunks(fin, read_offset, bytes_to_read, [&](EdgeUnit<EdgeData> * read_edge_buffer, EdgeId curr_read_edges){
+      #pragma omp parallel for
+      for (EdgeId e_i=0;e_i<curr_read_edges;e_i++) {
+        VertexId src = read_edge_buffer[e_i].src;
+        VertexId dst = read_edge_buffer[e_i].dst;
+        __sync_fetch_and_add(&out_degree[src], 1);
+        __sync_fetch_and_add(&out_degree[dst], 1);
+      }
+    });
+    allreduce_node_vertex_array(out_degree);
+    if (vertex_order!=OriginalOrder) {
+      reorder_vertices(out_degree);
+    }
+
+    // locality-aware chunking
     partition_offset = new VertexId [partitions + 1];
     partition_offset[0] = 0;
     EdgeId remained_amount = edges * 2 + EdgeId(vertices) * alpha;
@@ -410,6 +1763,7 @@ public:
         partition_offset[i+1] = vertices;
       } else {
         EdgeId got_edges = 0;
+        partition_offset[i+1] = vertices;
         for (VertexId v_i=partition_offset[i];v_i<vertices;v_i++) {
           got_edges += out_degree[v_i] + alpha;
           if (got_edges > expected_chunk_size) {
@@ -442,7 +1796,7 @@ public:
         for (VertexId v_i=partition_offset[i];v_i<partition_offset[i+1];v_i++) {
           part_out_edges += out_degree[v_i];
         }
-        printf("|V'_%d| = %u |E_%d| = %lu\n", i, partition_offset[i+1] - partition_offset[i], i, part_out_edges);
+        printf("|V'_%d| = %" PRIvid " |E_%d| = %lu\n", i, partition_offset[i+1] - partition_offset[i], i, part_out_edges);
       }
     }
     MPI_Barrier(MPI_COMM_WORLD);
@@ -464,6 +1818,7 @@ public:
           local_partition_offset[s_i+1] = partition_offset[partition_id+1];
         } else {
           EdgeId got_edges = 0;
+          local_partition_offset[s_i+1] = partition_offset[partition_id+1];
           for (VertexId v_i=local_partition_offset[s_i];v_i<partition_offset[partition_id+1];v_i++) {
             got_edges += out_degree[v_i] + alpha;
             if (got_edges > expected_chunk_size) {
@@ -479,7 +1834,7 @@ public:
           sub_part_out_edges += out_degree[v_i];
         }
         #ifdef PRINT_DEBUG_MESSAGES
-        printf("|V'_%d_%d| = %u |E_%d| = %lu\n", partition_id, s_i, local_partition_offset[s_i+1] - local_partition_offset[s_i], partition_id, sub_part_out_edges);
+        printf("|V'_%d_%d| = %" PRIvid " |E_%d| = %lu\n", partition_id, s_i, local_partition_offset[s_i+1] - local_partition_offset[s_i], partition_id, sub_part_out_edges);
         #endif
       }
     }
@@ -488,17 +1843,10 @@ public:
     for (VertexId v_i=partition_offset[partition_id];v_i<partition_offset[partition_id+1];v_i++) {
       filtered_out_degree[v_i] = out_degree[v_i];
     }
-    numa_free(out_degree, sizeof(VertexId) * vertices);
+    dealloc_node_vertex_array(out_degree);
     out_degree = filtered_out_degree;
     in_degree = out_degree;
 
-    int * buffered_edges = new int [partitions];
-    std::vector<char> * send_buffer = new std::vector<char> [partitions];
-    for (int i=0;i<partitions;i++) {
-      send_buffer[i].resize(edge_unit_size * CHUNKSIZE);
-    }
-    EdgeUnit<EdgeData> * recv_buffer = new EdgeUnit<EdgeData> [CHUNKSIZE];
-
     // constructing symmetric edges
     EdgeId recv_outgoing_edges = 0;
     outgoing_edges = new EdgeId [sockets];
@@ -508,98 +1856,64 @@ public:
     for (int s_i=0;s_i<sockets;s_i++) {
       outgoing_adj_bitmap[s_i] = new Bitmap (vertices);
       outgoing_adj_bitmap[s_i]->clear();
-      outgoing_adj_index[s_i] = (EdgeId*)numa_alloc_onnode(sizeof(EdgeId) * (vertices+1), s_i);
+      outgoing_adj_index[s_i] = (EdgeId*)numa_alloc_onnode(sizeof(EdgeId) * (vertices+1), get_socket_node(s_i));
+      #pragma omp parallel for
+      for (VertexId v_i=0;v_i<=vertices;v_i++) {
+        outgoing_adj_index[s_i][v_i] = 0;
+      }
     }
-    {
-      std::thread recv_thread_dst([&](){
-        int finished_count = 0;
-        MPI_Status recv_status;
-        while (finished_count < partitions) {
-          MPI_Probe(MPI_ANY_SOURCE, ShuffleGraph, MPI_COMM_WORLD, &recv_status);
-          int i = recv_status.MPI_SOURCE;
-          assert(recv_status.MPI_TAG == ShuffleGraph && i >=0 && i < partitions);
-          int recv_bytes;
-          MPI_Get_count(&recv_status, MPI_CHAR, &recv_bytes);
-          if (recv_bytes==1) {
-            finished_count += 1;
-            char c;
-            MPI_Recv(&c, 1, MPI_CHAR, i, ShuffleGraph, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
-            continue;
-          }
-          assert(recv_bytes % edge_unit_size == 0);
-          int recv_edges = recv_bytes / edge_unit_size;
-          MPI_Recv(recv_buffer, edge_unit_size * recv_edges, MPI_CHAR, i, ShuffleGraph, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
-          // #pragma omp parallel for
-          for (EdgeId e_i=0;e_i<recv_edges;e_i++) {
-            VertexId src = recv_buffer[e_i].src;
-            VertexId dst = recv_buffer[e_i].dst;
-            assert(dst >= partition_offset[partition_id] && dst < partition_offset[partition_id+1]);
-            int dst_part = get_local_partition_id(dst);
-            if (!outgoing_adj_bitmap[dst_part]->get_bit(src)) {
-              outgoing_adj_bitmap[dst_part]->set_bit(src);
-              outgoing_adj_index[dst_part][src] = 0;
-            }
-            __sync_fetch_and_add(&outgoing_adj_index[dst_part][src], 1);
-          }
-          recv_outgoing_edges += recv_edges;
-        }
-      });
-      for (int i=0;i<partitions;i++) {
-        buffered_edges[i] = 0;
-      }
-      assert(lseek(fin, read_offset, SEEK_SET)==read_offset);
-      read_bytes = 0;
-      while (read_bytes < bytes_to_read) {
-        long curr_read_bytes;
-        if (bytes_to_read - read_bytes > edge_unit_size * CHUNKSIZE) {
-          curr_read_bytes = read(fin, read_edge_buffer, edge_unit_size * CHUNKSIZE);
-        } else {
-          curr_read_bytes = read(fin, read_edge_buffer, bytes_to_read - read_bytes);
-        }
-        assert(curr_read_bytes>=0);
-        read_bytes += curr_read_bytes;
-        EdgeId curr_read_edges = curr_read_bytes / edge_unit_size;
-        for (EdgeId e_i=0;e_i<curr_read_edges;e_i++) {
-          VertexId dst = read_edge_buffer[e_i].dst;
-          int i = get_partition_id(dst);
-          memcpy(send_buffer[i].data() + edge_unit_size * buffered_edges[i], &read_edge_buffer[e_i], edge_unit_size);
-          buffered_edges[i] += 1;
-          if (buffered_edges[i] == CHUNKSIZE) {
-            MPI_Send(send_buffer[i].data(), edge_unit_size * buffered_edges[i], MPI_CHAR, i, ShuffleGraph, MPI_COMM_WORLD);
-            buffered_edges[i] = 0;
-          }
-        }
-        for (EdgeId e_i=0;e_i<curr_read_edges;e_i++) {
-          // std::swap(read_edge_buffer[e_i].src, read_edge_buffer[e_i].dst);
-          VertexId tmp = read_edge_buffer[e_i].src;
-          read_edge_buffer[e_i].src = read_edge_buffer[e_i].dst;
-          read_edge_buffer[e_i].dst = tmp;
-        }
-        for (EdgeId e_i=0;e_i<curr_read_edges;e_i++) {
-          VertexId dst = read_edge_buffer[e_i].dst;
-          int i = get_partition_id(dst);
-          memcpy(send_buffer[i].data() + edge_unit_size * buffered_edges[i], &read_edge_buffer[e_i], edge_unit_size);
-          buffered_edges[i] += 1;
-          if (buffered_edges[i] == CHUNKSIZE) {
-            MPI_Send(send_buffer[i].data(), edge_unit_size * buffered_edges[i], MPI_CHAR, i, ShuffleGraph, MPI_COMM_WORLD);
-            buffered_edges[i] = 0;
-          }
-        }
+    auto count_edge = [&](EdgeUnit<EdgeData> & edge) {
+      VertexId src = edge.src;
+      VertexId dst = edge.dst;
+      assert(dst >= partition_offset[partition_id] && dst < partition_offset[partition_id+1]);
+      int dst_part = get_local_partition_id(dst);
+      if (!outgoing_adj_bitmap[dst_part]->get_bit(src)) {
+        outgoing_adj_bitmap[dst_part]->set_bit(src);
       }
-      for (int i=0;i<partitions;i++) {
-        if (buffered_edges[i]==0) continue;
-        MPI_Send(send_buffer[i].data(), edge_unit_size * buffered_edges[i], MPI_CHAR, i, ShuffleGraph, MPI_COMM_WORLD);
-        buffered_edges[i] = 0;
+      __sync_fetch_and_add(&outgoing_adj_index[dst_part][src], 1);
+    };
+    auto fill_edge = [&](EdgeUnit<EdgeData> & edge) {
+      VertexId src = edge.src;
+      VertexId dst = edge.dst;
+      int dst_part = get_local_partition_id(dst);
+      EdgeId pos = __sync_fetch_and_add(&outgoing_adj_index[dst_part][src], 1);
+      outgoing_adj_list[dst_part][pos].neighbour = dst;
+      if (!std::is_same<EdgeData, Empty>::value) {
+        outgoing_adj_list[dst_part][pos].edge_data = edge.edge_data;
       }
-      for (int i=0;i<partitions;i++) {
-        char c = 0;
-        MPI_Send(&c, 1, MPI_CHAR, i, ShuffleGraph, MPI_COMM_WORLD);
+    };
+
+    EdgeUnit<EdgeData> * staged_edges = nullptr;
+    int staged_edges_fd = -1;
+    if (staged) {
+      // shuffle the symmetric edges once and keep them in a local staging buffer
+      EdgeId staged_edges_capacity = 0;
+      for (VertexId v_i=partition_offset[partition_id];v_i<partition_offset[partition_id+1];v_i++) {
+        staged_edges_capacity += out_degree[v_i];
       }
-      recv_thread_dst.join();
-      #ifdef PRINT_DEBUG_MESSAGES
-      printf("machine(%d) got %lu symmetric edges\n", partition_id, recv_outgoing_edges);
-      #endif
+      staged_edges = (EdgeUnit<EdgeData> *)alloc_staging_buffer(edge_unit_size * staged_edges_capacity, &staged_edges_fd);
+      shuffle_edges(fin, read_offset, bytes_to_read, DstOwnerSymmetric, [&](EdgeUnit<EdgeData> * recv_buffer, EdgeId recv_edges){
+        assert(recv_outgoing_edges + recv_edges <= staged_edges_capacity);
+        memcpy(&staged_edges[recv_outgoing_edges], recv_buffer, edge_unit_size * recv_edges);
+        #pragma omp parallel for
+        for (EdgeId e_i=0;e_i<recv_edges;e_i++) {
+          count_edge(recv_buffer[e_i]);
+        }
+        recv_outgoing_edges += recv_edges;
+      });
+      assert(recv_outgoing_edges==staged_edges_capacity);
+    } else {
+      shuffle_edges(fin, read_offset, bytes_to_read, DstOwnerSymmetric, [&](EdgeUnit<EdgeData> * recv_buffer, EdgeId recv_edges){
+        #pragma omp parallel for
+        for (EdgeId e_i=0;e_i<recv_edges;e_i++) {
+          count_edge(recv_buffer[e_i]);
+        }
+        recv_outgoing_edges += recv_edges;
+      });
     }
+    #ifdef PRINT_DEBUG_MESSAGES
+    printf("machine(%d) got %lu symmetric edges\n", partition_id, recv_outgoing_edges);
+    #endif
     compressed_outgoing_adj_vertices = new VertexId [sockets];
     compressed_outgoing_adj_index = new CompressedAdjIndexUnit * [sockets];
     for (int s_i=0;s_i<sockets;s_i++) {
@@ -611,7 +1925,7 @@ public:
           compressed_outgoing_adj_vertices[s_i] += 1;
         }
       }
-      compressed_outgoing_adj_index[s_i] = (CompressedAdjIndexUnit*)numa_alloc_onnode( sizeof(CompressedAdjIndexUnit) * (compressed_outgoing_adj_vertices[s_i] + 1) , s_i );
+      compressed_outgoing_adj_index[s_i] = (CompressedAdjIndexUnit*)numa_alloc_onnode( sizeof(CompressedAdjIndexUnit) * (compressed_outgoing_adj_vertices[s_i] + 1) , get_socket_node(s_i) );
       compressed_outgoing_adj_index[s_i][0].index = 0;
       EdgeId last_e_i = 0;
       compressed_outgoing_adj_vertices[s_i] = 0;
@@ -632,93 +1946,21 @@ public:
       #ifdef PRINT_DEBUG_MESSAGES
       printf("part(%d) E_%d has %lu symmetric edges\n", partition_id, s_i, outgoing_edges[s_i]);
       #endif
-      outgoing_adj_list[s_i] = (AdjUnit<EdgeData>*)numa_alloc_onnode(unit_size * outgoing_edges[s_i], s_i);
+      outgoing_adj_list[s_i] = alloc_adj_list(unit_size * outgoing_edges[s_i], s_i);
     }
-    {
-      std::thread recv_thread_dst([&](){
-        int finished_count = 0;
-        MPI_Status recv_status;
-        while (finished_count < partitions) {
-          MPI_Probe(MPI_ANY_SOURCE, ShuffleGraph, MPI_COMM_WORLD, &recv_status);
-          int i = recv_status.MPI_SOURCE;
-          assert(recv_status.MPI_TAG == ShuffleGraph && i >=0 && i < partitions);
-          int recv_bytes;
-          MPI_Get_count(&recv_status, MPI_CHAR, &recv_bytes);
-          if (recv_bytes==1) {
-            finished_count += 1;
-            char c;
-            MPI_Recv(&c, 1, MPI_CHAR, i, ShuffleGraph, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
-            continue;
-          }
-          assert(recv_bytes % edge_unit_size == 0);
-          int recv_edges = recv_bytes / edge_unit_size;
-          MPI_Recv(recv_buffer, edge_unit_size * recv_edges, MPI_CHAR, i, ShuffleGraph, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
-          #pragma omp parallel for
-          for (EdgeId e_i=0;e_i<recv_edges;e_i++) {
-            VertexId src = recv_buffer[e_i].src;
-            VertexId dst = recv_buffer[e_i].dst;
-            assert(dst >= partition_offset[partition_id] && dst < partition_offset[partition_id+1]);
-            int dst_part = get_local_partition_id(dst);
-            EdgeId pos = __sync_fetch_and_add(&outgoing_adj_index[dst_part][src], 1);
-            outgoing_adj_list[dst_part][pos].neighbour = dst;
-            if (!std::is_same<EdgeData, Empty>::value) {
-              outgoing_adj_list[dst_part][pos].edge_data = recv_buffer[e_i].edge_data;
-            }
-          }
+    if (staged) {
+      #pragma omp parallel for
+      for (EdgeId e_i=0;e_i<recv_outgoing_edges;e_i++) {
+        fill_edge(staged_edges[e_i]);
+      }
+      free_staging_buffer((char *)staged_edges, edge_unit_size * recv_outgoing_edges, staged_edges_fd);
+    } else {
+      shuffle_edges(fin, read_offset, bytes_to_read, DstOwnerSymmetric, [&](EdgeUnit<EdgeData> * recv_buffer, EdgeId recv_edges){
+        #pragma omp parallel for
+        for (EdgeId e_i=0;e_i<recv_edges;e_i++) {
+          fill_edge(recv_buffer[e_i]);
         }
       });
-      for (int i=0;i<partitions;i++) {
-        buffered_edges[i] = 0;
-      }
-      assert(lseek(fin, read_offset, SEEK_SET)==read_offset);
-      read_bytes = 0;
-      while (read_bytes < bytes_to_read) {
-        long curr_read_bytes;
-        if (bytes_to_read - read_bytes > edge_unit_size * CHUNKSIZE) {
-          curr_read_bytes = read(fin, read_edge_buffer, edge_unit_size * CHUNKSIZE);
-        } else {
-          curr_read_bytes = read(fin, read_edge_buffer, bytes_to_read - read_bytes);
-        }
-        assert(curr_read_bytes>=0);
-        read_bytes += curr_read_bytes;
-        EdgeId curr_read_edges = curr_read_bytes / edge_unit_size;
-        for (EdgeId e_i=0;e_i<curr_read_edges;e_i++) {
-          VertexId dst = read_edge_buffer[e_i].dst;
-          int i = get_partition_id(dst);
-          memcpy(send_buffer[i].data() + edge_unit_size * buffered_edges[i], &read_edge_buffer[e_i], edge_unit_size);
-          buffered_edges[i] += 1;
-          if (buffered_edges[i] == CHUNKSIZE) {
-            MPI_Send(send_buffer[i].data(), edge_unit_size * buffered_edges[i], MPI_CHAR, i, ShuffleGraph, MPI_COMM_WORLD);
-            buffered_edges[i] = 0;
-          }
-        }
-        for (EdgeId e_i=0;e_i<curr_read_edges;e_i++) {
-          // std::swap(read_edge_buffer[e_i].src, read_edge_buffer[e_i].dst);
-          VertexId tmp = read_edge_buffer[e_i].src;
-          read_edge_buffer[e_i].src = read_edge_buffer[e_i].dst;
-          read_edge_buffer[e_i].dst = tmp;
-        }
-        for (EdgeId e_i=0;e_i<curr_read_edges;e_i++) {
-          VertexId dst = read_edge_buffer[e_i].dst;
-          int i = get_partition_id(dst);
-          memcpy(send_buffer[i].data() + edge_unit_size * buffered_edges[i], &read_edge_buffer[e_i], edge_unit_size);
-          buffered_edges[i] += 1;
-          if (buffered_edges[i] == CHUNKSIZE) {
-            MPI_Send(send_buffer[i].data(), edge_unit_size * buffered_edges[i], MPI_CHAR, i, ShuffleGraph, MPI_COMM_WORLD);
-            buffered_edges[i] = 0;
-          }
-        }
-      }
-      for (int i=0;i<partitions;i++) {
-        if (buffered_edges[i]==0) continue;
-        MPI_Send(send_buffer[i].data(), edge_unit_size * buffered_edges[i], MPI_CHAR, i, ShuffleGraph, MPI_COMM_WORLD);
-        buffered_edges[i] = 0;
-      }
-      for (int i=0;i<partitions;i++) {
-        char c = 0;
-        MPI_Send(&c, 1, MPI_CHAR, i, ShuffleGraph, MPI_COMM_WORLD);
-      }
-      recv_thread_dst.join();
     }
     for (int s_i=0;s_i<sockets;s_i++) {
       for (VertexId p_v_i=0;p_v_i<compressed_outgoing_adj_vertices[s_i];p_v_i++) {
@@ -737,16 +1979,19 @@ public:
     compressed_incoming_adj_index = compressed_outgoing_adj_index;
     MPI_Barrier(MPI_COMM_WORLD);
 
-    delete [] buffered_edges;
-    delete [] send_buffer;
-    delete [] read_edge_buffer;
-    delete [] recv_buffer;
     close(fin);
 
+    split_hubs();
+    compress_adjacency();
     tune_chunks();
     tuned_chunks_sparse = tuned_chunks_dense;
 
+    if (snapshot_path!="") {
+      save_snapshot(snapshot_path);
+    }
+
     prep_time += MPI_Wtime();
+    record_load_metrics(prep_time);
 
     #ifdef PRINT_DEBUG_MESSAGES
     if (partition_id==0) {
@@ -765,23 +2010,236 @@ public:
     std::swap(tuned_chunks_dense, tuned_chunks_sparse);
     std::swap(compressed_outgoing_adj_vertices, compressed_incoming_adj_vertices);
     std::swap(compressed_outgoing_adj_index, compressed_incoming_adj_index);
+    if (loaded_directions!=BothDirections) {
+      loaded_directions = loaded_directions==OutgoingOnly ? IncomingOnly : OutgoingOnly;
+    }
   }
 
-  // load a directed graph from path
-  void load_directed(std::string path, VertexId vertices) {
-    double prep_time = 0;
-    prep_time -= MPI_Wtime();
-
-    symmetric = false;
+  // split the dense-mode entries of vertices with more than threshold local edges into several
+  // consecutive entries, so that the edges of a hub are processed by several threads; every piece
+  // yields its own message, which the dense slots already combine
+  void split_adjacency(VertexId * compressed_adj_vertices, CompressedAdjIndexUnit ** compressed_adj_index, EdgeId * adj_edges) {
+    for (int s_i=0;s_i<sockets;s_i++) {
+      EdgeId threshold = hub_split_threshold;
+      if (hub_split_threshold==-1) {
+        threshold = std::max(adj_edges[s_i] / (threads_per_socket * 16), (EdgeId)1024);
+      }
+      // the edges per piece; compressed lists can only be cut where delta coding restarts
+      auto get_piece_edges = [&](EdgeId length) {
+        if (length <= threshold) return std::max(length, (EdgeId)1);
+        EdgeId pieces = (length + threshold - 1) / threshold;
+        EdgeId piece_edges = (length + pieces - 1) / pieces;
+        if (adj_compression) {
+          piece_edges = (piece_edges + ADJ_GROUP_EDGES - 1) / ADJ_GROUP_EDGES * ADJ_GROUP_EDGES;
+        }
+        return piece_edges;
+      };
+      VertexId split_vertices = 0;
+      for (VertexId p_v_i=0;p_v_i<compressed_adj_vertices[s_i];p_v_i++) {
+        EdgeId length = compressed_adj_index[s_i][p_v_i+1].index - compressed_adj_index[s_i][p_v_i].index;
+        EdgeId piece_edges = get_piece_edges(length);
+        split_vertices += length > piece_edges ? (length + piece_edges - 1) / piece_edges : 1;
+      }
+      if (split_vertices==compressed_adj_vertices[s_i]) continue;
+      CompressedAdjIndexUnit * split_adj_index = (CompressedAdjIndexUnit*)numa_alloc_onnode( sizeof(CompressedAdjIndexUnit) * (split_vertices + 1) , get_socket_node(s_i) );
+      VertexId split_p_v_i = 0;
+      for (VertexId p_v_i=0;p_v_i<compressed_adj_vertices[s_i];p_v_i++) {
+        EdgeId begin_e_i = compressed_adj_index[s_i][p_v_i].index;
+        EdgeId length = compressed_adj_index[s_i][p_v_i+1].index - begin_e_i;
+        EdgeId piece_edges = get_piece_edges(length);
+        EdgeId offset = 0;
+        do {
+          split_adj_index[split_p_v_i].vertex = compressed_adj_index[s_i][p_v_i].vertex;
+          split_adj_index[split_p_v_i].index = begin_e_i + offset;
+          split_p_v_i += 1;
+          offset += piece_edges;
+        } while (offset < length);
+      }
+      assert(split_p_v_i==split_vertices);
+      split_adj_index[split_vertices].index = compressed_adj_index[s_i][compressed_adj_vertices[s_i]].index;
+      numa_free(compressed_adj_index[s_i], sizeof(CompressedAdjIndexUnit) * (compressed_adj_vertices[s_i] + 1));
+      #ifdef PRINT_DEBUG_MESSAGES
+      printf("part(%d) E_%d split %" PRIvid " vertices into %" PRIvid " entries (threshold=%lu)\n", partition_id, s_i, compressed_adj_vertices[s_i], split_vertices, threshold);
+      #endif
+      compressed_adj_index[s_i] = split_adj_index;
+      compressed_adj_vertices[s_i] = split_vertices;
+    }
+  }
 
+  // count the extra dense-mode entries left by split_adjacency, which bound the extra messages per buffer
+  void count_hub_split_replicas() {
+    auto count_replicas = [&](VertexId * compressed_adj_vertices, CompressedAdjIndexUnit ** compressed_adj_index) {
+      for (int s_i=0;s_i<sockets;s_i++) {
+        VertexId replicas = 0;
+        for (VertexId p_v_i=1;p_v_i<compressed_adj_vertices[s_i];p_v_i++) {
+          if (compressed_adj_index[s_i][p_v_i].vertex==compressed_adj_index[s_i][p_v_i-1].vertex) {
+            replicas += 1;
+          }
+        }
+        hub_split_replicas = std::max(hub_split_replicas, replicas);
+      }
+    };
+    hub_split_replicas = 0;
+    count_replicas(compressed_incoming_adj_vertices, compressed_incoming_adj_index);
+    count_replicas(compressed_outgoing_adj_vertices, compressed_outgoing_adj_index);
     MPI_Datatype vid_t = get_mpi_data_type<VertexId>();
+    MPI_Allreduce(MPI_IN_PLACE, &hub_split_replicas, 1, vid_t, MPI_MAX, MPI_COMM_WORLD);
+  }
 
-    this->vertices = vertices;
-    long total_bytes = file_size(path.c_str());
-    this->edges = total_bytes / edge_unit_size;
-    #ifdef PRINT_DEBUG_MESSAGES
+  // split the adjacency lists of hubs in both directions when GEMINI_HUB_SPLIT is set
+  void split_hubs() {
+    if (hub_split_threshold==0) return;
+    split_adjacency(compressed_incoming_adj_vertices, compressed_incoming_adj_index, incoming_edges);
+    if (!symmetric) {
+      split_adjacency(compressed_outgoing_adj_vertices, compressed_outgoing_adj_index, outgoing_edges);
+    }
+    count_hub_split_replicas();
+  }
+
+  // encode a sorted neighbour range with delta varints, restarting from an absolute id every ADJ_GROUP_EDGES edges;
+  // edge data follows each neighbour verbatim. Returns the encoded size in bytes; only measures if out is NULL
+  size_t encode_adj_range(AdjUnit<EdgeData> * begin, AdjUnit<EdgeData> * end, unsigned char * out) {
+    size_t bytes = 0;
+    VertexId last = 0;
+    for (EdgeId e_i=0;begin+e_i<end;e_i++) {
+      VertexId neighbour = begin[e_i].neighbour;
+      bytes += encode_varint(e_i % ADJ_GROUP_EDGES==0 ? neighbour : neighbour - last, out==NULL ? NULL : out + bytes);
+      last = neighbour;
+      if (!std::is_same<EdgeData, Empty>::value) {
+        if (out!=NULL) memcpy(out + bytes, &begin[e_i].edge_data, edge_data_size);
+        bytes += edge_data_size;
+      }
+    }
+    return bytes;
+  }
+
+  // decode the bytes [begin, end) written by encode_adj_range to out; returns the end of the decoded units
+  AdjUnit<EdgeData> * decode_adj_range(const unsigned char * begin, const unsigned char * end, AdjUnit<EdgeData> * out) {
+    VertexId last = 0;
+    for (EdgeId e_i=0;begin<end;e_i++) {
+      VertexId value = decode_varint(begin);
+      last = e_i % ADJ_GROUP_EDGES==0 ? value : last + value;
+      out->neighbour = last;
+      if (!std::is_same<EdgeData, Empty>::value) {
+        memcpy(&out->edge_data, begin, edge_data_size);
+        begin += edge_data_size;
+      }
+      out++;
+    }
+    return out;
+  }
+
+  // the adjacency list at [begin, end) of adj_list; compressed lists are decoded to the scratch space of thread_id
+  inline VertexAdjList<EdgeData> get_adj_list(AdjUnit<EdgeData> * adj_list, EdgeId begin, EdgeId end, int thread_id) {
+    if (!adj_compression) {
+      return VertexAdjList<EdgeData>(adj_list + begin, adj_list + end);
+    }
+    unsigned char * data = (unsigned char *)adj_list;
+    return VertexAdjList<EdgeData>(adj_scratch[thread_id], decode_adj_range(data + begin, data + end, adj_scratch[thread_id]));
+  }
+
+  // the size in bytes of the adjacency list of a socket
+  size_t get_adj_list_bytes(EdgeId adj_edges, VertexId compressed_adj_vertices, CompressedAdjIndexUnit * compressed_adj_index) {
+    return adj_compression ? compressed_adj_index[compressed_adj_vertices].index : unit_size * adj_edges;
+  }
+
+  // sort the neighbours of every vertex and replace the adjacency lists of one direction by their encoding;
+  // every entry of the compressed index is encoded on its own, so hub pieces stay independently decodable
+  void compress_adjacency(EdgeId * adj_edges, EdgeId ** adj_index, VertexId * compressed_adj_vertices, CompressedAdjIndexUnit ** compressed_adj_index, AdjUnit<EdgeData> ** adj_list) {
+    for (int s_i=0;s_i<sockets;s_i++) {
+      CompressedAdjIndexUnit * index = compressed_adj_index[s_i];
+      VertexId entries = compressed_adj_vertices[s_i];
+      EdgeId local_max_adj_edges = 0;
+      #pragma omp parallel for schedule(dynamic, 64) reduction(max:local_max_adj_edges)
+      for (VertexId p_v_i=0;p_v_i<entries;p_v_i++) {
+        VertexId v_i = index[p_v_i].vertex;
+        if (p_v_i>0 && index[p_v_i-1].vertex==v_i) continue;
+        std::sort(adj_list[s_i] + adj_index[s_i][v_i], adj_list[s_i] + adj_index[s_i][v_i+1], [](const AdjUnit<EdgeData> & a, const AdjUnit<EdgeData> & b){
+          return a.neighbour < b.neighbour;
+        });
+        local_max_adj_edges = std::max(local_max_adj_edges, adj_index[s_i][v_i+1] - adj_index[s_i][v_i]);
+      }
+      max_adj_edges = std::max(max_adj_edges, local_max_adj_edges);
+      EdgeId * entry_offset = new EdgeId [entries + 1];
+      #pragma omp parallel for
+      for (VertexId p_v_i=0;p_v_i<entries;p_v_i++) {
+        entry_offset[p_v_i] = encode_adj_range(adj_list[s_i] + index[p_v_i].index, adj_list[s_i] + index[p_v_i+1].index, NULL);
+      }
+      EdgeId bytes = 0;
+      for (VertexId p_v_i=0;p_v_i<entries;p_v_i++) {
+        EdgeId entry_bytes = entry_offset[p_v_i];
+        entry_offset[p_v_i] = bytes;
+        bytes += entry_bytes;
+      }
+      entry_offset[entries] = bytes;
+      unsigned char * data = (unsigned char *)alloc_adj_list(bytes, s_i);
+      #pragma omp parallel for
+      for (VertexId p_v_i=0;p_v_i<entries;p_v_i++) {
+        encode_adj_range(adj_list[s_i] + index[p_v_i].index, adj_list[s_i] + index[p_v_i+1].index, data + entry_offset[p_v_i]);
+      }
+      #ifdef PRINT_DEBUG_MESSAGES
+      printf("part(%d) E_%d compressed %lu edges from %lu to %lu bytes\n", partition_id, s_i, adj_edges[s_i], unit_size * adj_edges[s_i], bytes);
+      #endif
+      free_adj_list(adj_list[s_i], unit_size * adj_edges[s_i]);
+      adj_list[s_i] = (AdjUnit<EdgeData> *)data;
+      for (VertexId p_v_i=0;p_v_i<=entries;p_v_i++) {
+        index[p_v_i].index = entry_offset[p_v_i];
+      }
+      delete [] entry_offset;
+      for (VertexId p_v_i=0;p_v_i<entries;p_v_i++) {
+        VertexId v_i = index[p_v_i].vertex;
+        if (p_v_i==0 || index[p_v_i-1].vertex!=v_i) {
+          adj_index[s_i][v_i] = index[p_v_i].index;
+        }
+        adj_index[s_i][v_i+1] = index[p_v_i+1].index;
+      }
+    }
+  }
+
+  // allocate the per-thread space that compressed adjacency lists are decoded to
+  void alloc_adj_scratch() {
+    adj_scratch = new AdjUnit<EdgeData> * [threads];
+    for (int t_i=0;t_i<threads;t_i++) {
+      adj_scratch[t_i] = (AdjUnit<EdgeData> *)numa_alloc_onnode(unit_size * std::max(max_adj_edges, (EdgeId)1), get_socket_node(get_socket_id(t_i)));
+    }
+  }
+
+  // compress the adjacency lists in both directions when GEMINI_COMPRESS_ADJ is set
+  void compress_adjacency() {
+    if (!adj_compression) return;
+    compress_adjacency(outgoing_edges, outgoing_adj_index, compressed_outgoing_adj_vertices, compressed_outgoing_adj_index, outgoing_adj_list);
+    if (!symmetric) {
+      compress_adjacency(incoming_edges, incoming_adj_index, compressed_incoming_adj_vertices, compressed_incoming_adj_index, incoming_adj_list);
+    }
+    alloc_adj_scratch();
+  }
+
+  // load a directed graph from path; with OutgoingOnly or IncomingOnly (LoadedDirections) only the structures of
+  // one mode are built, e.g. for pull-only algorithms, which saves the memory and the shuffles of the other one
+  void load_directed(std::string path, VertexId vertices, int directions = BothDirections) {
+    double prep_time = 0;
+    prep_time -= MPI_Wtime();
+
+    loaded_directions = directions;
+    bool load_outgoing = directions!=IncomingOnly;
+    bool load_incoming = directions!=OutgoingOnly;
+    if (snapshot_path!="" && check_snapshot(snapshot_path, path, vertices, file_size(path) / edge_unit_size, false)) {
+      load_snapshot(snapshot_path);
+      prep_time += MPI_Wtime();
+      record_load_metrics(prep_time);
+      return;
+    }
+
+    symmetric = false;
+
+    MPI_Datatype vid_t = get_mpi_data_type<VertexId>();
+
+    this->vertices = vertices;
+    long total_bytes = file_size(path.c_str());
+    this->edges = total_bytes / edge_unit_size;
+    #ifdef PRINT_DEBUG_MESSAGES
     if (partition_id==0) {
-      printf("|V| = %u, |E| = %lu\n", vertices, edges);
+      printf("|V| = %" PRIvid ", |E| = %lu\n", vertices, edges);
     }
     #endif
 
@@ -791,34 +2249,58 @@ public:
     }
     long bytes_to_read = edge_unit_size * read_edges;
     long read_offset = edge_unit_size * (edges / partitions * partition_id);
-    long read_bytes;
     int fin = open(path.c_str(), O_RDONLY);
-    EdgeUnit<EdgeData> * read_edge_buffer = new EdgeUnit<EdgeData> [CHUNKSIZE];
+    assert(fin!=-1);
+    posix_fadvise(fin, read_offset, bytes_to_read, POSIX_FADV_SEQUENTIAL);
 
-    out_degree = alloc_interleaved_vertex_array<VertexId>();
-    for (VertexId v_i=0;v_i<vertices;v_i++) {
-      out_degree[v_i] = 0;
-    }
-    assert(lseek(fin, read_offset, SEEK_SET)==read_offset);
-    read_bytes = 0;
-    while (read_bytes < bytes_to_read) {
-      long curr_read_bytes;
-      if (bytes_to_read - read_bytes > edge_unit_size * CHUNKSIZE) {
-        curr_read_bytes = read(fin, read_edge_buffer, edge_unit_size * CHUNKSIZE);
-      } else {
-        curr_read_bytes = read(fin, read_edge_buffer, bytes_to_read - read_bytes);
+    bool staged = staging_path!="";
+    // the partitions of a node count into a single copy of the degrees
+    out_degree = alloc_node_vertex_array<VertexId>();
+    if (node_rank==0) {
+      #pragma omp parallel for
+      for (VertexId v_i=0;v_i<vertices;v_i++) {
+        out_degree[v_i] = 0;
       }
-      assert(curr_read_bytes>=0);
-      read_bytes += curr_read_bytes;
-      EdgeId curr_read_edges = curr_read_bytes / edge_unit_size;
+    }
+    sync_node_vertex_array(out_degree);
+    // staged loading sizes its buffers from the global in-degrees as well, and without the sparse-mode edges
+    // they are not counted otherwise
+    bool count_in_degree = staged || !load_outgoing;
+    VertexId * global_in_degree = nullptr;
+    if (count_in_degree) {
+      global_in_degree = alloc_node_vertex_array<VertexId>();
+      if (node_rank==0) {
+        #pragma omp parallel for
+        for (VertexId v_i=0;v_i<vertices;v_i++) {
+          global_in_degree[v_i] = 0;
+        }
+      }
+      sync_node_vertex_array(global_in_degree);
+    }
+    read_edge_chunks(fin, read_offset, bytes_to_read, [&](EdgeUnit<EdgeData> * read_edge_buffer, EdgeId curr_read_edges){
       #pragma omp parallel for
       for (EdgeId e_i=0;e_i<curr_read_edges;e_i++) {
         VertexId src = read_edge_buffer[e_i].src;
         VertexId dst = read_edge_buffer[e_i].dst;
         __sync_fetch_and_add(&out_degree[src], 1);
+        if (count_in_degree) {
+          __sync_fetch_and_add(&global_in_degree[dst], 1);
+        }
+      }
+    });
+    allreduce_node_vertex_array(out_degree);
+    if (count_in_degree) {
+      allreduce_node_vertex_array(global_in_degree);
+    }
+    if (vertex_order!=OriginalOrder) {
+      reorder_vertices(out_degree);
+      if (count_in_degree) {
+        if (node_rank==0) {
+          permute_to_internal(global_in_degree);
+        }
+        sync_node_vertex_array(global_in_degree);
       }
     }
-    MPI_Allreduce(MPI_IN_PLACE, out_degree, vertices, vid_t, MPI_SUM, MPI_COMM_WORLD);
 
     // locality-aware chunking
     partition_offset = new VertexId [partitions + 1];
@@ -831,6 +2313,7 @@ public:
         partition_offset[i+1] = vertices;
       } else {
         EdgeId got_edges = 0;
+        partition_offset[i+1] = vertices;
         for (VertexId v_i=partition_offset[i];v_i<vertices;v_i++) {
           got_edges += out_degree[v_i] + alpha;
           if (got_edges > expected_chunk_size) {
@@ -863,7 +2346,7 @@ public:
         for (VertexId v_i=partition_offset[i];v_i<partition_offset[i+1];v_i++) {
           part_out_edges += out_degree[v_i];
         }
-        printf("|V'_%d| = %u |E^dense_%d| = %lu\n", i, partition_offset[i+1] - partition_offset[i], i, part_out_edges);
+        printf("|V'_%d| = %" PRIvid " |E^dense_%d| = %lu\n", i, partition_offset[i+1] - partition_offset[i], i, part_out_edges);
       }
     }
     #endif
@@ -884,6 +2367,7 @@ public:
           local_partition_offset[s_i+1] = partition_offset[partition_id+1];
         } else {
           EdgeId got_edges = 0;
+          local_partition_offset[s_i+1] = partition_offset[partition_id+1];
           for (VertexId v_i=local_partition_offset[s_i];v_i<partition_offset[partition_id+1];v_i++) {
             got_edges += out_degree[v_i] + alpha;
             if (got_edges > expected_chunk_size) {
@@ -899,7 +2383,7 @@ public:
           sub_part_out_edges += out_degree[v_i];
         }
         #ifdef PRINT_DEBUG_MESSAGES
-        printf("|V'_%d_%d| = %u |E^dense_%d_%d| = %lu\n", partition_id, s_i, local_partition_offset[s_i+1] - local_partition_offset[s_i], partition_id, s_i, sub_part_out_edges);
+        printf("|V'_%d_%d| = %" PRIvid " |E^dense_%d_%d| = %lu\n", partition_id, s_i, local_partition_offset[s_i+1] - local_partition_offset[s_i], partition_id, s_i, sub_part_out_edges);
         #endif
       }
     }
@@ -908,19 +2392,15 @@ public:
     for (VertexId v_i=partition_offset[partition_id];v_i<partition_offset[partition_id+1];v_i++) {
       filtered_out_degree[v_i] = out_degree[v_i];
     }
-    numa_free(out_degree, sizeof(VertexId) * vertices);
+    dealloc_node_vertex_array(out_degree);
     out_degree = filtered_out_degree;
     in_degree = alloc_vertex_array<VertexId>();
     for (VertexId v_i=partition_offset[partition_id];v_i<partition_offset[partition_id+1];v_i++) {
-      in_degree[v_i] = 0;
+      in_degree[v_i] = load_outgoing ? 0 : global_in_degree[v_i];
     }
-
-    int * buffered_edges = new int [partitions];
-    std::vector<char> * send_buffer = new std::vector<char> [partitions];
-    for (int i=0;i<partitions;i++) {
-      send_buffer[i].resize(edge_unit_size * CHUNKSIZE);
+    if (count_in_degree && !staged) {
+      dealloc_node_vertex_array(global_in_degree);
     }
-    EdgeUnit<EdgeData> * recv_buffer = new EdgeUnit<EdgeData> [CHUNKSIZE];
 
     EdgeId recv_outgoing_edges = 0;
     outgoing_edges = new EdgeId [sockets];
@@ -930,83 +2410,130 @@ public:
     for (int s_i=0;s_i<sockets;s_i++) {
       outgoing_adj_bitmap[s_i] = new Bitmap (vertices);
       outgoing_adj_bitmap[s_i]->clear();
-      outgoing_adj_index[s_i] = (EdgeId*)numa_alloc_onnode(sizeof(EdgeId) * (vertices+1), s_i);
+      outgoing_adj_index[s_i] = (EdgeId*)numa_alloc_onnode(sizeof(EdgeId) * (vertices+1), get_socket_node(s_i));
+      #pragma omp parallel for
+      for (VertexId v_i=0;v_i<=vertices;v_i++) {
+        outgoing_adj_index[s_i][v_i] = 0;
+      }
     }
-    {
-      std::thread recv_thread_dst([&](){
-        int finished_count = 0;
-        MPI_Status recv_status;
-        while (finished_count < partitions) {
-          MPI_Probe(MPI_ANY_SOURCE, ShuffleGraph, MPI_COMM_WORLD, &recv_status);
-          int i = recv_status.MPI_SOURCE;
-          assert(recv_status.MPI_TAG == ShuffleGraph && i >=0 && i < partitions);
-          int recv_bytes;
-          MPI_Get_count(&recv_status, MPI_CHAR, &recv_bytes);
-          if (recv_bytes==1) {
-            finished_count += 1;
-            char c;
-            MPI_Recv(&c, 1, MPI_CHAR, i, ShuffleGraph, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
-            continue;
+    EdgeId recv_incoming_edges = 0;
+    incoming_edges = new EdgeId [sockets];
+    incoming_adj_index = new EdgeId* [sockets];
+    incoming_adj_list = new AdjUnit<EdgeData>* [sockets];
+    incoming_adj_bitmap = new Bitmap * [sockets];
+    for (int s_i=0;s_i<sockets;s_i++) {
+      incoming_adj_bitmap[s_i] = new Bitmap (vertices);
+      incoming_adj_bitmap[s_i]->clear();
+      incoming_adj_index[s_i] = (EdgeId*)numa_alloc_onnode(sizeof(EdgeId) * (vertices+1), get_socket_node(s_i));
+      #pragma omp parallel for
+      for (VertexId v_i=0;v_i<=vertices;v_i++) {
+        incoming_adj_index[s_i][v_i] = 0;
+      }
+    }
+    auto count_outgoing_edge = [&](EdgeUnit<EdgeData> & edge) {
+      VertexId src = edge.src;
+      VertexId dst = edge.dst;
+      assert(dst >= partition_offset[partition_id] && dst < partition_offset[partition_id+1]);
+      int dst_part = get_local_partition_id(dst);
+      if (!outgoing_adj_bitmap[dst_part]->get_bit(src)) {
+        outgoing_adj_bitmap[dst_part]->set_bit(src);
+      }
+      __sync_fetch_and_add(&outgoing_adj_index[dst_part][src], 1);
+      __sync_fetch_and_add(&in_degree[dst], 1);
+    };
+    auto fill_outgoing_edge = [&](EdgeUnit<EdgeData> & edge) {
+      VertexId src = edge.src;
+      VertexId dst = edge.dst;
+      int dst_part = get_local_partition_id(dst);
+      EdgeId pos = __sync_fetch_and_add(&outgoing_adj_index[dst_part][src], 1);
+      outgoing_adj_list[dst_part][pos].neighbour = dst;
+      if (!std::is_same<EdgeData, Empty>::value) {
+        outgoing_adj_list[dst_part][pos].edge_data = edge.edge_data;
+      }
+    };
+    auto count_incoming_edge = [&](EdgeUnit<EdgeData> & edge) {
+      VertexId src = edge.src;
+      VertexId dst = edge.dst;
+      assert(src >= partition_offset[partition_id] && src < partition_offset[partition_id+1]);
+      int src_part = get_local_partition_id(src);
+      if (!incoming_adj_bitmap[src_part]->get_bit(dst)) {
+        incoming_adj_bitmap[src_part]->set_bit(dst);
+      }
+      __sync_fetch_and_add(&incoming_adj_index[src_part][dst], 1);
+    };
+    auto fill_incoming_edge = [&](EdgeUnit<EdgeData> & edge) {
+      VertexId src = edge.src;
+      VertexId dst = edge.dst;
+      int src_part = get_local_partition_id(src);
+      EdgeId pos = __sync_fetch_and_add(&incoming_adj_index[src_part][dst], 1);
+      incoming_adj_list[src_part][pos].neighbour = src;
+      if (!std::is_same<EdgeData, Empty>::value) {
+        incoming_adj_list[src_part][pos].edge_data = edge.edge_data;
+      }
+    };
+
+    EdgeUnit<EdgeData> * staged_outgoing = nullptr;
+    EdgeUnit<EdgeData> * staged_incoming = nullptr;
+    int staged_outgoing_fd = -1;
+    int staged_incoming_fd = -1;
+    if (staged) {
+      // shuffle every edge once to the owners of both endpoints and keep it in local staging buffers
+      EdgeId staged_outgoing_capacity = 0;
+      EdgeId staged_incoming_capacity = 0;
+      for (VertexId v_i=partition_offset[partition_id];v_i<partition_offset[partition_id+1];v_i++) {
+        staged_outgoing_capacity += load_outgoing ? global_in_degree[v_i] : 0;
+        staged_incoming_capacity += load_incoming ? out_degree[v_i] : 0;
+      }
+      dealloc_node_vertex_array(global_in_degree);
+      staged_outgoing = (EdgeUnit<EdgeData> *)alloc_staging_buffer(edge_unit_size * staged_outgoing_capacity, &staged_outgoing_fd);
+      staged_incoming = (EdgeUnit<EdgeData> *)alloc_staging_buffer(edge_unit_size * staged_incoming_capacity, &staged_incoming_fd);
+      ShuffleTarget target = !load_incoming ? DstOwner : !load_outgoing ? SrcOwner : BothOwners;
+      shuffle_edges(fin, read_offset, bytes_to_read, target, [&](EdgeUnit<EdgeData> * recv_buffer, EdgeId recv_edges){
+        #pragma omp parallel
+        {
+          int t_i = omp_get_thread_num();
+          int t_n = omp_get_num_threads();
+          EdgeId begin_e_i = recv_edges * t_i / t_n;
+          EdgeId end_e_i = recv_edges * (t_i + 1) / t_n;
+          EdgeId local_outgoing_edges = 0;
+          EdgeId local_incoming_edges = 0;
+          for (EdgeId e_i=begin_e_i;e_i<end_e_i;e_i++) {
+            VertexId src = recv_buffer[e_i].src;
+            VertexId dst = recv_buffer[e_i].dst;
+            if (load_outgoing && dst >= partition_offset[partition_id] && dst < partition_offset[partition_id+1]) local_outgoing_edges += 1;
+            if (load_incoming && src >= partition_offset[partition_id] && src < partition_offset[partition_id+1]) local_incoming_edges += 1;
           }
-          assert(recv_bytes % edge_unit_size == 0);
-          int recv_edges = recv_bytes / edge_unit_size;
-          MPI_Recv(recv_buffer, edge_unit_size * recv_edges, MPI_CHAR, i, ShuffleGraph, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
-          // #pragma omp parallel for
-          for (EdgeId e_i=0;e_i<recv_edges;e_i++) {
+          EdgeId outgoing_pos = __sync_fetch_and_add(&recv_outgoing_edges, local_outgoing_edges);
+          EdgeId incoming_pos = __sync_fetch_and_add(&recv_incoming_edges, local_incoming_edges);
+          assert(outgoing_pos + local_outgoing_edges <= staged_outgoing_capacity);
+          assert(incoming_pos + local_incoming_edges <= staged_incoming_capacity);
+          for (EdgeId e_i=begin_e_i;e_i<end_e_i;e_i++) {
             VertexId src = recv_buffer[e_i].src;
             VertexId dst = recv_buffer[e_i].dst;
-            assert(dst >= partition_offset[partition_id] && dst < partition_offset[partition_id+1]);
-            int dst_part = get_local_partition_id(dst);
-            if (!outgoing_adj_bitmap[dst_part]->get_bit(src)) {
-              outgoing_adj_bitmap[dst_part]->set_bit(src);
-              outgoing_adj_index[dst_part][src] = 0;
+            if (load_outgoing && dst >= partition_offset[partition_id] && dst < partition_offset[partition_id+1]) {
+              memcpy(&staged_outgoing[outgoing_pos++], &recv_buffer[e_i], edge_unit_size);
+              count_outgoing_edge(recv_buffer[e_i]);
+            }
+            if (load_incoming && src >= partition_offset[partition_id] && src < partition_offset[partition_id+1]) {
+              memcpy(&staged_incoming[incoming_pos++], &recv_buffer[e_i], edge_unit_size);
+              count_incoming_edge(recv_buffer[e_i]);
             }
-            __sync_fetch_and_add(&outgoing_adj_index[dst_part][src], 1);
-            __sync_fetch_and_add(&in_degree[dst], 1);
           }
-          recv_outgoing_edges += recv_edges;
         }
       });
-      for (int i=0;i<partitions;i++) {
-        buffered_edges[i] = 0;
-      }
-      assert(lseek(fin, read_offset, SEEK_SET)==read_offset);
-      read_bytes = 0;
-      while (read_bytes < bytes_to_read) {
-        long curr_read_bytes;
-        if (bytes_to_read - read_bytes > edge_unit_size * CHUNKSIZE) {
-          curr_read_bytes = read(fin, read_edge_buffer, edge_unit_size * CHUNKSIZE);
-        } else {
-          curr_read_bytes = read(fin, read_edge_buffer, bytes_to_read - read_bytes);
-        }
-        assert(curr_read_bytes>=0);
-        read_bytes += curr_read_bytes;
-        EdgeId curr_read_edges = curr_read_bytes / edge_unit_size;
-        for (EdgeId e_i=0;e_i<curr_read_edges;e_i++) {
-          VertexId dst = read_edge_buffer[e_i].dst;
-          int i = get_partition_id(dst);
-          memcpy(send_buffer[i].data() + edge_unit_size * buffered_edges[i], &read_edge_buffer[e_i], edge_unit_size);
-          buffered_edges[i] += 1;
-          if (buffered_edges[i] == CHUNKSIZE) {
-            MPI_Send(send_buffer[i].data(), edge_unit_size * buffered_edges[i], MPI_CHAR, i, ShuffleGraph, MPI_COMM_WORLD);
-            buffered_edges[i] = 0;
-          }
+      assert(recv_outgoing_edges==staged_outgoing_capacity && recv_incoming_edges==staged_incoming_capacity);
+    } else if (load_outgoing) {
+      shuffle_edges(fin, read_offset, bytes_to_read, DstOwner, [&](EdgeUnit<EdgeData> * recv_buffer, EdgeId recv_edges){
+        #pragma omp parallel for
+        for (EdgeId e_i=0;e_i<recv_edges;e_i++) {
+          count_outgoing_edge(recv_buffer[e_i]);
         }
-      }
-      for (int i=0;i<partitions;i++) {
-        if (buffered_edges[i]==0) continue;
-        MPI_Send(send_buffer[i].data(), edge_unit_size * buffered_edges[i], MPI_CHAR, i, ShuffleGraph, MPI_COMM_WORLD);
-        buffered_edges[i] = 0;
-      }
-      for (int i=0;i<partitions;i++) {
-        char c = 0;
-        MPI_Send(&c, 1, MPI_CHAR, i, ShuffleGraph, MPI_COMM_WORLD);
-      }
-      recv_thread_dst.join();
-      #ifdef PRINT_DEBUG_MESSAGES
-      printf("machine(%d) got %lu sparse mode edges\n", partition_id, recv_outgoing_edges);
-      #endif
+        recv_outgoing_edges += recv_edges;
+      });
     }
+    #ifdef PRINT_DEBUG_MESSAGES
+    printf("machine(%d) got %lu sparse mode edges\n", partition_id, recv_outgoing_edges);
+    #endif
     compressed_outgoing_adj_vertices = new VertexId [sockets];
     compressed_outgoing_adj_index = new CompressedAdjIndexUnit * [sockets];
     for (int s_i=0;s_i<sockets;s_i++) {
@@ -1018,7 +2545,7 @@ public:
           compressed_outgoing_adj_vertices[s_i] += 1;
         }
       }
-      compressed_outgoing_adj_index[s_i] = (CompressedAdjIndexUnit*)numa_alloc_onnode( sizeof(CompressedAdjIndexUnit) * (compressed_outgoing_adj_vertices[s_i] + 1) , s_i );
+      compressed_outgoing_adj_index[s_i] = (CompressedAdjIndexUnit*)numa_alloc_onnode( sizeof(CompressedAdjIndexUnit) * (compressed_outgoing_adj_vertices[s_i] + 1) , get_socket_node(s_i) );
       compressed_outgoing_adj_index[s_i][0].index = 0;
       EdgeId last_e_i = 0;
       compressed_outgoing_adj_vertices[s_i] = 0;
@@ -1039,77 +2566,21 @@ public:
       #ifdef PRINT_DEBUG_MESSAGES
       printf("part(%d) E_%d has %lu sparse mode edges\n", partition_id, s_i, outgoing_edges[s_i]);
       #endif
-      outgoing_adj_list[s_i] = (AdjUnit<EdgeData>*)numa_alloc_onnode(unit_size * outgoing_edges[s_i], s_i);
+      outgoing_adj_list[s_i] = alloc_adj_list(unit_size * outgoing_edges[s_i], s_i);
     }
-    {
-      std::thread recv_thread_dst([&](){
-        int finished_count = 0;
-        MPI_Status recv_status;
-        while (finished_count < partitions) {
-          MPI_Probe(MPI_ANY_SOURCE, ShuffleGraph, MPI_COMM_WORLD, &recv_status);
-          int i = recv_status.MPI_SOURCE;
-          assert(recv_status.MPI_TAG == ShuffleGraph && i >=0 && i < partitions);
-          int recv_bytes;
-          MPI_Get_count(&recv_status, MPI_CHAR, &recv_bytes);
-          if (recv_bytes==1) {
-            finished_count += 1;
-            char c;
-            MPI_Recv(&c, 1, MPI_CHAR, i, ShuffleGraph, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
-            continue;
-          }
-          assert(recv_bytes % edge_unit_size == 0);
-          int recv_edges = recv_bytes / edge_unit_size;
-          MPI_Recv(recv_buffer, edge_unit_size * recv_edges, MPI_CHAR, i, ShuffleGraph, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
-          #pragma omp parallel for
-          for (EdgeId e_i=0;e_i<recv_edges;e_i++) {
-            VertexId src = recv_buffer[e_i].src;
-            VertexId dst = recv_buffer[e_i].dst;
-            assert(dst >= partition_offset[partition_id] && dst < partition_offset[partition_id+1]);
-            int dst_part = get_local_partition_id(dst);
-            EdgeId pos = __sync_fetch_and_add(&outgoing_adj_index[dst_part][src], 1);
-            outgoing_adj_list[dst_part][pos].neighbour = dst;
-            if (!std::is_same<EdgeData, Empty>::value) {
-              outgoing_adj_list[dst_part][pos].edge_data = recv_buffer[e_i].edge_data;
-            }
-          }
+    if (staged) {
+      #pragma omp parallel for
+      for (EdgeId e_i=0;e_i<recv_outgoing_edges;e_i++) {
+        fill_outgoing_edge(staged_outgoing[e_i]);
+      }
+      free_staging_buffer((char *)staged_outgoing, edge_unit_size * recv_outgoing_edges, staged_outgoing_fd);
+    } else if (load_outgoing) {
+      shuffle_edges(fin, read_offset, bytes_to_read, DstOwner, [&](EdgeUnit<EdgeData> * recv_buffer, EdgeId recv_edges){
+        #pragma omp parallel for
+        for (EdgeId e_i=0;e_i<recv_edges;e_i++) {
+          fill_outgoing_edge(recv_buffer[e_i]);
         }
       });
-      for (int i=0;i<partitions;i++) {
-        buffered_edges[i] = 0;
-      }
-      assert(lseek(fin, read_offset, SEEK_SET)==read_offset);
-      read_bytes = 0;
-      while (read_bytes < bytes_to_read) {
-        long curr_read_bytes;
-        if (bytes_to_read - read_bytes > edge_unit_size * CHUNKSIZE) {
-          curr_read_bytes = read(fin, read_edge_buffer, edge_unit_size * CHUNKSIZE);
-        } else {
-          curr_read_bytes = read(fin, read_edge_buffer, bytes_to_read - read_bytes);
-        }
-        assert(curr_read_bytes>=0);
-        read_bytes += curr_read_bytes;
-        EdgeId curr_read_edges = curr_read_bytes / edge_unit_size;
-        for (EdgeId e_i=0;e_i<curr_read_edges;e_i++) {
-          VertexId dst = read_edge_buffer[e_i].dst;
-          int i = get_partition_id(dst);
-          memcpy(send_buffer[i].data() + edge_unit_size * buffered_edges[i], &read_edge_buffer[e_i], edge_unit_size);
-          buffered_edges[i] += 1;
-          if (buffered_edges[i] == CHUNKSIZE) {
-            MPI_Send(send_buffer[i].data(), edge_unit_size * buffered_edges[i], MPI_CHAR, i, ShuffleGraph, MPI_COMM_WORLD);
-            buffered_edges[i] = 0;
-          }
-        }
-      }
-      for (int i=0;i<partitions;i++) {
-        if (buffered_edges[i]==0) continue;
-        MPI_Send(send_buffer[i].data(), edge_unit_size * buffered_edges[i], MPI_CHAR, i, ShuffleGraph, MPI_COMM_WORLD);
-        buffered_edges[i] = 0;
-      }
-      for (int i=0;i<partitions;i++) {
-        char c = 0;
-        MPI_Send(&c, 1, MPI_CHAR, i, ShuffleGraph, MPI_COMM_WORLD);
-      }
-      recv_thread_dst.join();
     }
     for (int s_i=0;s_i<sockets;s_i++) {
       for (VertexId p_v_i=0;p_v_i<compressed_outgoing_adj_vertices[s_i];p_v_i++) {
@@ -1120,90 +2591,18 @@ public:
     }
     MPI_Barrier(MPI_COMM_WORLD);
 
-    EdgeId recv_incoming_edges = 0;
-    incoming_edges = new EdgeId [sockets];
-    incoming_adj_index = new EdgeId* [sockets];
-    incoming_adj_list = new AdjUnit<EdgeData>* [sockets];
-    incoming_adj_bitmap = new Bitmap * [sockets];
-    for (int s_i=0;s_i<sockets;s_i++) {
-      incoming_adj_bitmap[s_i] = new Bitmap (vertices);
-      incoming_adj_bitmap[s_i]->clear();
-      incoming_adj_index[s_i] = (EdgeId*)numa_alloc_onnode(sizeof(EdgeId) * (vertices+1), s_i);
-    }
-    {
-      std::thread recv_thread_src([&](){
-        int finished_count = 0;
-        MPI_Status recv_status;
-        while (finished_count < partitions) {
-          MPI_Probe(MPI_ANY_SOURCE, ShuffleGraph, MPI_COMM_WORLD, &recv_status);
-          int i = recv_status.MPI_SOURCE;
-          assert(recv_status.MPI_TAG == ShuffleGraph && i >=0 && i < partitions);
-          int recv_bytes;
-          MPI_Get_count(&recv_status, MPI_CHAR, &recv_bytes);
-          if (recv_bytes==1) {
-            finished_count += 1;
-            char c;
-            MPI_Recv(&c, 1, MPI_CHAR, i, ShuffleGraph, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
-            continue;
-          }
-          assert(recv_bytes % edge_unit_size == 0);
-          int recv_edges = recv_bytes / edge_unit_size;
-          MPI_Recv(recv_buffer, edge_unit_size * recv_edges, MPI_CHAR, i, ShuffleGraph, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
-          // #pragma omp parallel for
-          for (EdgeId e_i=0;e_i<recv_edges;e_i++) {
-            VertexId src = recv_buffer[e_i].src;
-            VertexId dst = recv_buffer[e_i].dst;
-            assert(src >= partition_offset[partition_id] && src < partition_offset[partition_id+1]);
-            int src_part = get_local_partition_id(src);
-            if (!incoming_adj_bitmap[src_part]->get_bit(dst)) {
-              incoming_adj_bitmap[src_part]->set_bit(dst);
-              incoming_adj_index[src_part][dst] = 0;
-            }
-            __sync_fetch_and_add(&incoming_adj_index[src_part][dst], 1);
-          }
-          recv_incoming_edges += recv_edges;
+    if (!staged && load_incoming) {
+      shuffle_edges(fin, read_offset, bytes_to_read, SrcOwner, [&](EdgeUnit<EdgeData> * recv_buffer, EdgeId recv_edges){
+        #pragma omp parallel for
+        for (EdgeId e_i=0;e_i<recv_edges;e_i++) {
+          count_incoming_edge(recv_buffer[e_i]);
         }
+        recv_incoming_edges += recv_edges;
       });
-      for (int i=0;i<partitions;i++) {
-        buffered_edges[i] = 0;
-      }
-      assert(lseek(fin, read_offset, SEEK_SET)==read_offset);
-      read_bytes = 0;
-      while (read_bytes < bytes_to_read) {
-        long curr_read_bytes;
-        if (bytes_to_read - read_bytes > edge_unit_size * CHUNKSIZE) {
-          curr_read_bytes = read(fin, read_edge_buffer, edge_unit_size * CHUNKSIZE);
-        } else {
-          curr_read_bytes = read(fin, read_edge_buffer, bytes_to_read - read_bytes);
-        }
-        assert(curr_read_bytes>=0);
-        read_bytes += curr_read_bytes;
-        EdgeId curr_read_edges = curr_read_bytes / edge_unit_size;
-        for (EdgeId e_i=0;e_i<curr_read_edges;e_i++) {
-          VertexId src = read_edge_buffer[e_i].src;
-          int i = get_partition_id(src);
-          memcpy(send_buffer[i].data() + edge_unit_size * buffered_edges[i], &read_edge_buffer[e_i], edge_unit_size);
-          buffered_edges[i] += 1;
-          if (buffered_edges[i] == CHUNKSIZE) {
-            MPI_Send(send_buffer[i].data(), edge_unit_size * buffered_edges[i], MPI_CHAR, i, ShuffleGraph, MPI_COMM_WORLD);
-            buffered_edges[i] = 0;
-          }
-        }
-      }
-      for (int i=0;i<partitions;i++) {
-        if (buffered_edges[i]==0) continue;
-        MPI_Send(send_buffer[i].data(), edge_unit_size * buffered_edges[i], MPI_CHAR, i, ShuffleGraph, MPI_COMM_WORLD);
-        buffered_edges[i] = 0;
-      }
-      for (int i=0;i<partitions;i++) {
-        char c = 0;
-        MPI_Send(&c, 1, MPI_CHAR, i, ShuffleGraph, MPI_COMM_WORLD);
-      }
-      recv_thread_src.join();
-      #ifdef PRINT_DEBUG_MESSAGES
-      printf("machine(%d) got %lu dense mode edges\n", partition_id, recv_incoming_edges);
-      #endif
     }
+    #ifdef PRINT_DEBUG_MESSAGES
+    printf("machine(%d) got %lu dense mode edges\n", partition_id, recv_incoming_edges);
+    #endif
     compressed_incoming_adj_vertices = new VertexId [sockets];
     compressed_incoming_adj_index = new CompressedAdjIndexUnit * [sockets];
     for (int s_i=0;s_i<sockets;s_i++) {
@@ -1215,7 +2614,7 @@ public:
           compressed_incoming_adj_vertices[s_i] += 1;
         }
       }
-      compressed_incoming_adj_index[s_i] = (CompressedAdjIndexUnit*)numa_alloc_onnode( sizeof(CompressedAdjIndexUnit) * (compressed_incoming_adj_vertices[s_i] + 1) , s_i );
+      compressed_incoming_adj_index[s_i] = (CompressedAdjIndexUnit*)numa_alloc_onnode( sizeof(CompressedAdjIndexUnit) * (compressed_incoming_adj_vertices[s_i] + 1) , get_socket_node(s_i) );
       compressed_incoming_adj_index[s_i][0].index = 0;
       EdgeId last_e_i = 0;
       compressed_incoming_adj_vertices[s_i] = 0;
@@ -1236,77 +2635,21 @@ public:
       #ifdef PRINT_DEBUG_MESSAGES
       printf("part(%d) E_%d has %lu dense mode edges\n", partition_id, s_i, incoming_edges[s_i]);
       #endif
-      incoming_adj_list[s_i] = (AdjUnit<EdgeData>*)numa_alloc_onnode(unit_size * incoming_edges[s_i], s_i);
+      incoming_adj_list[s_i] = alloc_adj_list(unit_size * incoming_edges[s_i], s_i);
     }
-    {
-      std::thread recv_thread_src([&](){
-        int finished_count = 0;
-        MPI_Status recv_status;
-        while (finished_count < partitions) {
-          MPI_Probe(MPI_ANY_SOURCE, ShuffleGraph, MPI_COMM_WORLD, &recv_status);
-          int i = recv_status.MPI_SOURCE;
-          assert(recv_status.MPI_TAG == ShuffleGraph && i >=0 && i < partitions);
-          int recv_bytes;
-          MPI_Get_count(&recv_status, MPI_CHAR, &recv_bytes);
-          if (recv_bytes==1) {
-            finished_count += 1;
-            char c;
-            MPI_Recv(&c, 1, MPI_CHAR, i, ShuffleGraph, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
-            continue;
-          }
-          assert(recv_bytes % edge_unit_size == 0);
-          int recv_edges = recv_bytes / edge_unit_size;
-          MPI_Recv(recv_buffer, edge_unit_size * recv_edges, MPI_CHAR, i, ShuffleGraph, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
-          #pragma omp parallel for
-          for (EdgeId e_i=0;e_i<recv_edges;e_i++) {
-            VertexId src = recv_buffer[e_i].src;
-            VertexId dst = recv_buffer[e_i].dst;
-            assert(src >= partition_offset[partition_id] && src < partition_offset[partition_id+1]);
-            int src_part = get_local_partition_id(src);
-            EdgeId pos = __sync_fetch_and_add(&incoming_adj_index[src_part][dst], 1);
-            incoming_adj_list[src_part][pos].neighbour = src;
-            if (!std::is_same<EdgeData, Empty>::value) {
-              incoming_adj_list[src_part][pos].edge_data = recv_buffer[e_i].edge_data;
-            }
-          }
+    if (staged) {
+      #pragma omp parallel for
+      for (EdgeId e_i=0;e_i<recv_incoming_edges;e_i++) {
+        fill_incoming_edge(staged_incoming[e_i]);
+      }
+      free_staging_buffer((char *)staged_incoming, edge_unit_size * recv_incoming_edges, staged_incoming_fd);
+    } else if (load_incoming) {
+      shuffle_edges(fin, read_offset, bytes_to_read, SrcOwner, [&](EdgeUnit<EdgeData> * recv_buffer, EdgeId recv_edges){
+        #pragma omp parallel for
+        for (EdgeId e_i=0;e_i<recv_edges;e_i++) {
+          fill_incoming_edge(recv_buffer[e_i]);
         }
       });
-      for (int i=0;i<partitions;i++) {
-        buffered_edges[i] = 0;
-      }
-      assert(lseek(fin, read_offset, SEEK_SET)==read_offset);
-      read_bytes = 0;
-      while (read_bytes < bytes_to_read) {
-        long curr_read_bytes;
-        if (bytes_to_read - read_bytes > edge_unit_size * CHUNKSIZE) {
-          curr_read_bytes = read(fin, read_edge_buffer, edge_unit_size * CHUNKSIZE);
-        } else {
-          curr_read_bytes = read(fin, read_edge_buffer, bytes_to_read - read_bytes);
-        }
-        assert(curr_read_bytes>=0);
-        read_bytes += curr_read_bytes;
-        EdgeId curr_read_edges = curr_read_bytes / edge_unit_size;
-        for (EdgeId e_i=0;e_i<curr_read_edges;e_i++) {
-          VertexId src = read_edge_buffer[e_i].src;
-          int i = get_partition_id(src);
-          memcpy(send_buffer[i].data() + edge_unit_size * buffered_edges[i], &read_edge_buffer[e_i], edge_unit_size);
-          buffered_edges[i] += 1;
-          if (buffered_edges[i] == CHUNKSIZE) {
-            MPI_Send(send_buffer[i].data(), edge_unit_size * buffered_edges[i], MPI_CHAR, i, ShuffleGraph, MPI_COMM_WORLD);
-            buffered_edges[i] = 0;
-          }
-        }
-      }
-      for (int i=0;i<partitions;i++) {
-        if (buffered_edges[i]==0) continue;
-        MPI_Send(send_buffer[i].data(), edge_unit_size * buffered_edges[i], MPI_CHAR, i, ShuffleGraph, MPI_COMM_WORLD);
-        buffered_edges[i] = 0;
-      }
-      for (int i=0;i<partitions;i++) {
-        char c = 0;
-        MPI_Send(&c, 1, MPI_CHAR, i, ShuffleGraph, MPI_COMM_WORLD);
-      }
-      recv_thread_src.join();
     }
     for (int s_i=0;s_i<sockets;s_i++) {
       for (VertexId p_v_i=0;p_v_i<compressed_incoming_adj_vertices[s_i];p_v_i++) {
@@ -1317,18 +2660,21 @@ public:
     }
     MPI_Barrier(MPI_COMM_WORLD);
 
-    delete [] buffered_edges;
-    delete [] send_buffer;
-    delete [] read_edge_buffer;
-    delete [] recv_buffer;
     close(fin);
 
+    split_hubs();
+    compress_adjacency();
     transpose();
     tune_chunks();
     transpose();
     tune_chunks();
 
+    if (snapshot_path!="") {
+      save_snapshot(snapshot_path);
+    }
+
     prep_time += MPI_Wtime();
+    record_load_metrics(prep_time);
 
     #ifdef PRINT_DEBUG_MESSAGES
     if (partition_id==0) {
@@ -1337,42 +2683,304 @@ public:
     #endif
   }
 
-  void tune_chunks() {
-    tuned_chunks_dense = new ThreadState * [partitions];
-    int current_send_part_id = partition_id;
-    for (int step=0;step<partitions;step++) {
-      current_send_part_id = (current_send_part_id + 1) % partitions;
-      int i = current_send_part_id;
-      tuned_chunks_dense[i] = new ThreadState [threads];
-      EdgeId remained_edges;
-      int remained_partitions;
-      VertexId last_p_v_i;
-      VertexId end_p_v_i;
-      for (int t_i=0;t_i<threads;t_i++) {
-        tuned_chunks_dense[i][t_i].status = WORKING;
-        int s_i = get_socket_id(t_i);
-        int s_j = get_socket_offset(t_i);
-        if (s_j==0) {
-          VertexId p_v_i = 0;
-          while (p_v_i<compressed_incoming_adj_vertices[s_i]) {
-            VertexId v_i = compressed_incoming_adj_index[s_i][p_v_i].vertex;
-            if (v_i >= partition_offset[i]) {
-              break;
+  // rebuild the adjacency lists of one direction with a batch of updates, as uncompressed lists with one compressed
+  // index entry per vertex like freshly loaded ones, so that split_hubs and compress_adjacency can be applied again;
+  // a deletion removes one edge to the same neighbour, which has to exist
+  void merge_adjacency(std::vector<AdjUpdate<EdgeData>> & updates, EdgeId * adj_edges, Bitmap ** adj_bitmap, EdgeId ** adj_index, VertexId * compressed_adj_vertices, CompressedAdjIndexUnit ** compressed_adj_index, AdjUnit<EdgeData> ** adj_list) {
+    // per socket and key: the deletions sorted by neighbour, then the insertions
+    std::sort(updates.begin(), updates.end(), [](const AdjUpdate<EdgeData> & a, const AdjUpdate<EdgeData> & b){
+      if (a.socket!=b.socket) return a.socket < b.socket;
+      if (a.key!=b.key) return a.key < b.key;
+      if (a.deleted!=b.deleted) return a.deleted;
+      return a.unit.neighbour < b.unit.neighbour;
+    });
+    size_t begin_u_i = 0;
+    for (int s_i=0;s_i<sockets;s_i++) {
+      size_t end_u_i = begin_u_i;
+      while (end_u_i<updates.size() && updates[end_u_i].socket==s_i) {
+        end_u_i++;
+      }
+      Bitmap touched (vertices);
+      touched.clear();
+      EdgeId * new_adj_index = (EdgeId*)numa_alloc_onnode(sizeof(EdgeId) * (vertices+1), get_socket_node(s_i));
+      #pragma omp parallel for schedule(dynamic, 4096)
+      for (VertexId v_i=0;v_i<vertices;v_i++) {
+        new_adj_index[v_i] = 0;
+        if (adj_bitmap[s_i]->get_bit(v_i)) {
+          VertexAdjList<EdgeData> old_list = get_adj_list(adj_list[s_i], adj_index[s_i][v_i], adj_index[s_i][v_i+1], omp_get_thread_num());
+          new_adj_index[v_i] = old_list.end - old_list.begin;
+        }
+      }
+      for (size_t u_i=begin_u_i;u_i<end_u_i;u_i++) {
+        VertexId v_i = updates[u_i].key;
+        touched.set_bit(v_i);
+        if (updates[u_i].deleted) {
+          assert(new_adj_index[v_i] > 0);
+          new_adj_index[v_i] -= 1;
+        } else {
+          new_adj_index[v_i] += 1;
+        }
+      }
+      EdgeId new_edges = 0;
+      for (VertexId v_i=0;v_i<vertices;v_i++) {
+        EdgeId length = new_adj_index[v_i];
+        new_adj_index[v_i] = new_edges;
+        new_edges += length;
+      }
+      new_adj_index[vertices] = new_edges;
+      AdjUnit<EdgeData> * new_adj_list = alloc_adj_list(unit_size * new_edges, s_i);
+      AdjUpdate<EdgeData> * socket_updates = updates.data() + begin_u_i;
+      AdjUpdate<EdgeData> * socket_updates_end = updates.data() + end_u_i;
+      #pragma omp parallel for schedule(dynamic, 4096)
+      for (VertexId v_i=0;v_i<vertices;v_i++) {
+        AdjUnit<EdgeData> * out = new_adj_list + new_adj_index[v_i];
+        VertexAdjList<EdgeData> old_list;
+        if (adj_bitmap[s_i]->get_bit(v_i)) {
+          old_list = get_adj_list(adj_list[s_i], adj_index[s_i][v_i], adj_index[s_i][v_i+1], omp_get_thread_num());
+        }
+        if (!touched.get_bit(v_i)) {
+          memcpy(out, old_list.begin, unit_size * (old_list.end - old_list.begin));
+          continue;
+        }
+        AdjUpdate<EdgeData> * begin_update = std::lower_bound(socket_updates, socket_updates_end, v_i, [](const AdjUpdate<EdgeData> & update, VertexId v_i){
+          return update.key < v_i;
+        });
+        AdjUpdate<EdgeData> * end_deletion = begin_update;
+        while (end_deletion<socket_updates_end && end_deletion->key==v_i && end_deletion->deleted) {
+          end_deletion++;
+        }
+        // deletions are matched with the first remaining edges to their neighbours
+        std::vector<bool> matched (end_deletion - begin_update, false);
+        EdgeId matched_deletions = 0;
+        for (AdjUnit<EdgeData> * edge=old_list.begin;edge!=old_list.end;edge++) {
+          AdjUpdate<EdgeData> * deletion = std::lower_bound(begin_update, end_deletion, edge->neighbour, [](const AdjUpdate<EdgeData> & update, VertexId neighbour){
+            return update.unit.neighbour < neighbour;
+          });
+          while (deletion<end_deletion && deletion->unit.neighbour==edge->neighbour && matched[deletion - begin_update]) {
+            deletion++;
+          }
+          if (deletion<end_deletion && deletion->unit.neighbour==edge->neighbour) {
+            matched[deletion - begin_update] = true;
+            matched_deletions += 1;
+            continue;
+          }
+          *out++ = *edge;
+        }
+        assert(matched_deletions==(EdgeId)(end_deletion - begin_update));
+        for (AdjUpdate<EdgeData> * insertion=end_deletion;insertion<socket_updates_end && insertion->key==v_i;insertion++) {
+          *out++ = insertion->unit;
+        }
+        assert(out==new_adj_list + new_adj_index[v_i+1]);
+      }
+      // the old lists may live in a mapped snapshot, which update_edges unmaps as a whole
+      if (snapshot_adj_data==NULL) {
+        free_adj_list(adj_list[s_i], get_adj_list_bytes(adj_edges[s_i], compressed_adj_vertices[s_i], compressed_adj_index[s_i]));
+      }
+      numa_free(compressed_adj_index[s_i], sizeof(CompressedAdjIndexUnit) * (compressed_adj_vertices[s_i] + 1));
+      numa_free(adj_index[s_i], sizeof(EdgeId) * (vertices+1));
+      adj_list[s_i] = new_adj_list;
+      adj_index[s_i] = new_adj_index;
+      adj_edges[s_i] = new_edges;
+      adj_bitmap[s_i]->clear();
+      compressed_adj_vertices[s_i] = 0;
+      for (VertexId v_i=0;v_i<vertices;v_i++) {
+        if (new_adj_index[v_i+1] > new_adj_index[v_i]) {
+          adj_bitmap[s_i]->set_bit(v_i);
+          compressed_adj_vertices[s_i] += 1;
+        }
+      }
+      compressed_adj_index[s_i] = (CompressedAdjIndexUnit*)numa_alloc_onnode( sizeof(CompressedAdjIndexUnit) * (compressed_adj_vertices[s_i] + 1) , get_socket_node(s_i) );
+      VertexId p_v_i = 0;
+      for (VertexId v_i=0;v_i<vertices;v_i++) {
+        if (adj_bitmap[s_i]->get_bit(v_i)) {
+          compressed_adj_index[s_i][p_v_i].vertex = v_i;
+          compressed_adj_index[s_i][p_v_i].index = new_adj_index[v_i];
+          p_v_i += 1;
+        }
+      }
+      compressed_adj_index[s_i][p_v_i].index = new_edges;
+      #ifdef PRINT_DEBUG_MESSAGES
+      printf("part(%d) E_%d has %lu edges after %lu updates\n", partition_id, s_i, new_edges, end_u_i - begin_u_i);
+      #endif
+      begin_u_i = end_u_i;
+    }
+  }
+
+  // apply a batch of edge insertions and deletions (in input vertex ids, like the edges of the input file) to the
+  // loaded graph without reloading it; every partition passes its own share of the batch. A deletion removes one
+  // edge between the same endpoints (whatever its data), which has to be in the graph before the batch.
+  // The edges are routed to the owners of their endpoints, keeping the partitioning of the loaded graph, the
+  // adjacency lists of both directions are rebuilt and the chunks of process_edges are tuned again.
+  // The local endpoints of the inserted and deleted edges are added to the given subsets, e.g. to restart an algorithm from them
+  void update_edges(EdgeUnit<EdgeData> * inserted, EdgeId inserted_edges, EdgeUnit<EdgeData> * deleted, EdgeId deleted_edges, VertexSubset * inserted_endpoints = nullptr, VertexSubset * deleted_endpoints = nullptr) {
+    double update_time = 0;
+    update_time -= MPI_Wtime();
+
+    bool update_outgoing = loaded_directions!=IncomingOnly;
+    bool update_incoming = !symmetric && loaded_directions!=OutgoingOnly;
+    std::vector<AdjUpdate<EdgeData>> outgoing_updates;
+    std::vector<AdjUpdate<EdgeData>> incoming_updates;
+    // the sparse-mode update and the in-degree go to the owner of dst, the dense-mode one and the out-degree to the owner of src;
+    // symmetric graphs get the reversed edge instead
+    auto shuffle_updates = [&](EdgeUnit<EdgeData> * batch, EdgeId batch_edges, bool deletion, VertexSubset * endpoints) {
+      shuffle_edges(batch, batch_edges, symmetric ? DstOwnerSymmetric : BothOwners, [&](EdgeUnit<EdgeData> * recv_buffer, EdgeId recv_edges){
+        for (EdgeId e_i=0;e_i<recv_edges;e_i++) {
+          VertexId src = recv_buffer[e_i].src;
+          VertexId dst = recv_buffer[e_i].dst;
+          AdjUpdate<EdgeData> update;
+          update.deleted = deletion;
+          if (!std::is_same<EdgeData, Empty>::value) {
+            update.unit.edge_data = recv_buffer[e_i].edge_data;
+          }
+          if (dst >= partition_offset[partition_id] && dst < partition_offset[partition_id+1]) {
+            assert(!deletion || in_degree[dst] > 0);
+            in_degree[dst] += deletion ? -1 : 1;
+            if (endpoints!=nullptr) {
+              endpoints->set_bit(dst);
+            }
+            if (update_outgoing) {
+              update.socket = get_local_partition_id(dst);
+              update.key = src;
+              update.unit.neighbour = dst;
+              outgoing_updates.push_back(update);
             }
-            p_v_i++;
           }
-          last_p_v_i = p_v_i;
-          while (p_v_i<compressed_incoming_adj_vertices[s_i]) {
-            VertexId v_i = compressed_incoming_adj_index[s_i][p_v_i].vertex;
-            if (v_i >= partition_offset[i+1]) {
-              break;
+          if (!symmetric && src >= partition_offset[partition_id] && src < partition_offset[partition_id+1]) {
+            assert(!deletion || out_degree[src] > 0);
+            out_degree[src] += deletion ? -1 : 1;
+            if (endpoints!=nullptr) {
+              endpoints->set_bit(src);
+            }
+            if (update_incoming) {
+              update.socket = get_local_partition_id(src);
+              update.key = dst;
+              update.unit.neighbour = src;
+              incoming_updates.push_back(update);
             }
-            p_v_i++;
           }
-          end_p_v_i = p_v_i;
-          remained_edges = 0;
-          for (VertexId p_v_i=last_p_v_i;p_v_i<end_p_v_i;p_v_i++) {
-            remained_edges += compressed_incoming_adj_index[s_i][p_v_i+1].index - compressed_incoming_adj_index[s_i][p_v_i].index;
+        }
+      });
+    };
+    shuffle_updates(deleted, deleted_edges, true, deleted_endpoints);
+    shuffle_updates(inserted, inserted_edges, false, inserted_endpoints);
+    EdgeId batch_edges[2] = {inserted_edges, deleted_edges};
+    MPI_Allreduce(MPI_IN_PLACE, batch_edges, 2, get_mpi_data_type<EdgeId>(), MPI_SUM, MPI_COMM_WORLD);
+    edges = edges + batch_edges[0] - batch_edges[1];
+
+    merge_adjacency(outgoing_updates, outgoing_edges, outgoing_adj_bitmap, outgoing_adj_index, compressed_outgoing_adj_vertices, compressed_outgoing_adj_index, outgoing_adj_list);
+    if (!symmetric) {
+      merge_adjacency(incoming_updates, incoming_edges, incoming_adj_bitmap, incoming_adj_index, compressed_incoming_adj_vertices, compressed_incoming_adj_index, incoming_adj_list);
+    }
+    if (snapshot_adj_data!=NULL) {
+      assert(munmap(snapshot_adj_data, snapshot_adj_bytes)==0);
+      snapshot_adj_data = NULL;
+    }
+    if (adj_compression) {
+      for (int t_i=0;t_i<threads;t_i++) {
+        numa_free(adj_scratch[t_i], unit_size * std::max(max_adj_edges, (EdgeId)1));
+      }
+      delete [] adj_scratch;
+      max_adj_edges = 0;
+    }
+    split_hubs();
+    compress_adjacency();
+
+    for (int i=0;i<partitions;i++) {
+      delete [] tuned_chunks_dense[i];
+      if (!symmetric) {
+        delete [] tuned_chunks_sparse[i];
+      }
+    }
+    delete [] tuned_chunks_dense;
+    if (!symmetric) {
+      delete [] tuned_chunks_sparse;
+      transpose();
+      tune_chunks();
+      transpose();
+      tune_chunks();
+    } else {
+      tune_chunks();
+      tuned_chunks_sparse = tuned_chunks_dense;
+    }
+    MPI_Barrier(MPI_COMM_WORLD);
+
+    update_time += MPI_Wtime();
+    record_load_metrics(update_time, "update_edges");
+    #ifdef PRINT_DEBUG_MESSAGES
+    if (partition_id==0) {
+      printf("updated %lu + %lu - %lu edges in %.2lf (s)\n", edges - batch_edges[0] + batch_edges[1], batch_edges[0], batch_edges[1], update_time);
+    }
+    #endif
+  }
+
+  // read the share of this partition of an edge file (split like in load_directed) into memory; none for an empty path
+  EdgeUnit<EdgeData> * read_edge_slice(std::string path, EdgeId & slice_edges) {
+    slice_edges = 0;
+    if (path=="") return nullptr;
+    EdgeId file_edges = file_size(path) / edge_unit_size;
+    slice_edges = file_edges / partitions;
+    if (partition_id==partitions-1) {
+      slice_edges += file_edges % partitions;
+    }
+    EdgeUnit<EdgeData> * slice = new EdgeUnit<EdgeData> [slice_edges];
+    int fin = open(path.c_str(), O_RDONLY);
+    assert(fin!=-1);
+    EdgeId read_edges = 0;
+    read_edge_chunks(fin, edge_unit_size * (file_edges / partitions * partition_id), edge_unit_size * slice_edges, [&](EdgeUnit<EdgeData> * read_edge_buffer, EdgeId curr_read_edges){
+      memcpy(slice + read_edges, read_edge_buffer, edge_unit_size * curr_read_edges);
+      read_edges += curr_read_edges;
+    });
+    assert(read_edges==slice_edges);
+    close(fin);
+    return slice;
+  }
+
+  // apply the edges of two files in the format of the input file (an empty path for none) as one batch of update_edges
+  void update_edges(std::string inserted_path, std::string deleted_path, VertexSubset * inserted_endpoints = nullptr, VertexSubset * deleted_endpoints = nullptr) {
+    EdgeId inserted_edges, deleted_edges;
+    EdgeUnit<EdgeData> * inserted = read_edge_slice(inserted_path, inserted_edges);
+    EdgeUnit<EdgeData> * deleted = read_edge_slice(deleted_path, deleted_edges);
+    update_edges(inserted, inserted_edges, deleted, deleted_edges, inserted_endpoints, deleted_endpoints);
+    delete [] inserted;
+    delete [] deleted;
+  }
+
+  void tune_chunks() {
+    tuned_chunks_dense = new ThreadState * [partitions];
+    int current_send_part_id = partition_id;
+    for (int step=0;step<partitions;step++) {
+      current_send_part_id = (current_send_part_id + 1) % partitions;
+      int i = current_send_part_id;
+      tuned_chunks_dense[i] = new ThreadState [threads];
+      EdgeId remained_edges;
+      int remained_partitions;
+      VertexId last_p_v_i;
+      VertexId end_p_v_i;
+      for (int t_i=0;t_i<threads;t_i++) {
+        tuned_chunks_dense[i][t_i].status = WORKING;
+        int s_i = get_socket_id(t_i);
+        int s_j = get_socket_offset(t_i);
+        if (s_j==0) {
+          VertexId p_v_i = 0;
+          while (p_v_i<compressed_incoming_adj_vertices[s_i]) {
+            VertexId v_i = compressed_incoming_adj_index[s_i][p_v_i].vertex;
+            if (v_i >= partition_offset[i]) {
+              break;
+            }
+            p_v_i++;
+          }
+          last_p_v_i = p_v_i;
+          while (p_v_i<compressed_incoming_adj_vertices[s_i]) {
+            VertexId v_i = compressed_incoming_adj_index[s_i][p_v_i].vertex;
+            if (v_i >= partition_offset[i+1]) {
+              break;
+            }
+            p_v_i++;
+          }
+          end_p_v_i = p_v_i;
+          remained_edges = 0;
+          for (VertexId p_v_i=last_p_v_i;p_v_i<end_p_v_i;p_v_i++) {
+            remained_edges += compressed_incoming_adj_index[s_i][p_v_i+1].index - compressed_incoming_adj_index[s_i][p_v_i].index;
             remained_edges += alpha;
           }
         }
@@ -1396,104 +3004,1190 @@ public:
           for (VertexId p_v_i=tuned_chunks_dense[i][t_i].curr;p_v_i<tuned_chunks_dense[i][t_i].end;p_v_i++) {
             got_edges += compressed_incoming_adj_index[s_i][p_v_i+1].index - compressed_incoming_adj_index[s_i][p_v_i].index + alpha;
           }
-          remained_edges -= got_edges;
+          remained_edges -= got_edges;
+        }
+      }
+    }
+  }
+
+  std::string get_snapshot_filename(std::string path) {
+    return path + "." + std::to_string(partition_id);
+  }
+
+  void write_snapshot_section(int fd, const void * data, size_t bytes) {
+    const char * ptr = (const char *)data;
+    while (bytes > 0) {
+      long written_bytes = write(fd, ptr, bytes);
+      assert(written_bytes > 0);
+      ptr += written_bytes;
+      bytes -= written_bytes;
+    }
+  }
+
+  void write_snapshot_adjacency(int fd, EdgeId * adj_edges, VertexId * compressed_adj_vertices, CompressedAdjIndexUnit ** compressed_adj_index, AdjUnit<EdgeData> ** adj_list) {
+    for (int s_i=0;s_i<sockets;s_i++) {
+      write_snapshot_section(fd, &adj_edges[s_i], sizeof(EdgeId));
+      write_snapshot_section(fd, &compressed_adj_vertices[s_i], sizeof(VertexId));
+      write_snapshot_section(fd, compressed_adj_index[s_i], sizeof(CompressedAdjIndexUnit) * (compressed_adj_vertices[s_i] + 1));
+      write_snapshot_section(fd, adj_list[s_i], get_adj_list_bytes(adj_edges[s_i], compressed_adj_vertices[s_i], compressed_adj_index[s_i]));
+    }
+  }
+
+  void read_snapshot_section(char * & ptr, void * data, size_t bytes) {
+    memcpy(data, ptr, bytes);
+    ptr += bytes;
+  }
+
+  // adjacency indices and bitmaps are rebuilt from the compressed index instead of being stored
+  void read_snapshot_adjacency(char * & ptr, EdgeId * & adj_edges, Bitmap ** & adj_bitmap, EdgeId ** & adj_index, VertexId * & compressed_adj_vertices, CompressedAdjIndexUnit ** & compressed_adj_index, AdjUnit<EdgeData> ** & adj_list) {
+    adj_edges = new EdgeId [sockets];
+    adj_bitmap = new Bitmap * [sockets];
+    adj_index = new EdgeId* [sockets];
+    compressed_adj_vertices = new VertexId [sockets];
+    compressed_adj_index = new CompressedAdjIndexUnit * [sockets];
+    adj_list = new AdjUnit<EdgeData>* [sockets];
+    for (int s_i=0;s_i<sockets;s_i++) {
+      read_snapshot_section(ptr, &adj_edges[s_i], sizeof(EdgeId));
+      read_snapshot_section(ptr, &compressed_adj_vertices[s_i], sizeof(VertexId));
+      compressed_adj_index[s_i] = (CompressedAdjIndexUnit*)numa_alloc_onnode( sizeof(CompressedAdjIndexUnit) * (compressed_adj_vertices[s_i] + 1) , get_socket_node(s_i) );
+      read_snapshot_section(ptr, compressed_adj_index[s_i], sizeof(CompressedAdjIndexUnit) * (compressed_adj_vertices[s_i] + 1));
+      size_t adj_list_bytes = get_adj_list_bytes(adj_edges[s_i], compressed_adj_vertices[s_i], compressed_adj_index[s_i]);
+      if (adj_storage_path=="") {
+        adj_list[s_i] = (AdjUnit<EdgeData>*)numa_alloc_onnode(adj_list_bytes, get_socket_node(s_i));
+        read_snapshot_section(ptr, adj_list[s_i], adj_list_bytes);
+      } else {
+        // out of core: the lists are used in place, straight from the mapped snapshot
+        adj_list[s_i] = (AdjUnit<EdgeData>*)ptr;
+        ptr += adj_list_bytes;
+      }
+      adj_bitmap[s_i] = new Bitmap (vertices);
+      adj_bitmap[s_i]->clear();
+      adj_index[s_i] = (EdgeId*)numa_alloc_onnode(sizeof(EdgeId) * (vertices+1), get_socket_node(s_i));
+      for (VertexId p_v_i=0;p_v_i<compressed_adj_vertices[s_i];p_v_i++) {
+        VertexId v_i = compressed_adj_index[s_i][p_v_i].vertex;
+        adj_bitmap[s_i]->set_bit(v_i);
+        if (p_v_i==0 || compressed_adj_index[s_i][p_v_i-1].vertex!=v_i) { // hubs may span several entries
+          adj_index[s_i][v_i] = compressed_adj_index[s_i][p_v_i].index;
+        }
+        adj_index[s_i][v_i+1] = compressed_adj_index[s_i][p_v_i+1].index;
+      }
+    }
+  }
+
+  // check whether every partition holds a snapshot matching the given graph and configuration
+  bool check_snapshot(std::string path, std::string input_path, VertexId vertices, EdgeId edges, bool symmetric) {
+    // partition 0 identifies the input for all, so that they agree even if their views of the file differ
+    if (partition_id==0) {
+      snapshot_input.size = file_size(input_path);
+      snapshot_input.mtime = file_mtime(input_path);
+      snapshot_input.hash = file_ends_hash(input_path, SNAPSHOT_INPUT_HASH_BYTES);
+    }
+    MPI_Bcast(&snapshot_input, sizeof(SnapshotInput), MPI_CHAR, 0, MPI_COMM_WORLD);
+    int valid = 0;
+    std::string filename = get_snapshot_filename(path);
+    if (file_exists(filename) && file_size(filename) >= (long)sizeof(SnapshotHeader)) {
+      int fd = open(filename.c_str(), O_RDONLY);
+      assert(fd!=-1);
+      SnapshotHeader header;
+      if (read(fd, &header, sizeof(SnapshotHeader))==sizeof(SnapshotHeader)) {
+        valid = header.magic==SNAPSHOT_MAGIC && header.version==SNAPSHOT_VERSION && header.vertex_id_size==(int)sizeof(VertexId)
+          && header.partitions==partitions && header.partition_id==partition_id && header.sockets==sockets
+          && header.edge_unit_size==edge_unit_size && header.symmetric==symmetric && header.vertex_order==vertex_order && header.directions==loaded_directions
+          && header.hub_split_threshold==hub_split_threshold && header.adj_compression==adj_compression
+          && header.vertices==vertices && header.edges==edges
+          && header.input.size==snapshot_input.size && header.input.mtime==snapshot_input.mtime && header.input.hash==snapshot_input.hash;
+      }
+      assert(close(fd)==0);
+    }
+    int global_valid;
+    MPI_Allreduce(&valid, &global_valid, 1, MPI_INT, MPI_MIN, MPI_COMM_WORLD);
+    return global_valid;
+  }
+
+  // save the preprocessed graph to per-partition files (path.<partition_id>)
+  void save_snapshot(std::string path) {
+    std::string filename = get_snapshot_filename(path);
+    std::string tmp_filename = filename + ".tmp";
+    int fd = open(tmp_filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    assert(fd!=-1);
+    SnapshotHeader header;
+    header.magic = SNAPSHOT_MAGIC;
+    header.version = SNAPSHOT_VERSION;
+    header.vertex_id_size = sizeof(VertexId);
+    header.partitions = partitions;
+    header.partition_id = partition_id;
+    header.sockets = sockets;
+    header.threads = threads;
+    header.symmetric = symmetric;
+    header.vertex_order = vertex_order;
+    header.directions = loaded_directions;
+    header.hub_split_threshold = hub_split_threshold;
+    header.adj_compression = adj_compression;
+    header.max_adj_edges = max_adj_edges;
+    header.edge_unit_size = edge_unit_size;
+    header.vertices = vertices;
+    header.edges = edges;
+    header.input = snapshot_input;
+    write_snapshot_section(fd, &header, sizeof(SnapshotHeader));
+    write_snapshot_section(fd, partition_offset, sizeof(VertexId) * (partitions + 1));
+    write_snapshot_section(fd, local_partition_offset, sizeof(VertexId) * (sockets + 1));
+    if (original_id!=NULL) {
+      write_snapshot_section(fd, original_id + partition_offset[partition_id], sizeof(VertexId) * owned_vertices);
+    }
+    write_snapshot_section(fd, out_degree + partition_offset[partition_id], sizeof(VertexId) * owned_vertices);
+    write_snapshot_adjacency(fd, outgoing_edges, compressed_outgoing_adj_vertices, compressed_outgoing_adj_index, outgoing_adj_list);
+    if (!symmetric) {
+      write_snapshot_section(fd, in_degree + partition_offset[partition_id], sizeof(VertexId) * owned_vertices);
+      write_snapshot_adjacency(fd, incoming_edges, compressed_incoming_adj_vertices, compressed_incoming_adj_index, incoming_adj_list);
+    }
+    for (int i=0;i<partitions;i++) {
+      write_snapshot_section(fd, tuned_chunks_dense[i], sizeof(ThreadState) * threads);
+    }
+    if (!symmetric) {
+      for (int i=0;i<partitions;i++) {
+        write_snapshot_section(fd, tuned_chunks_sparse[i], sizeof(ThreadState) * threads);
+      }
+    }
+    assert(fsync(fd)==0);
+    assert(close(fd)==0);
+    assert(rename(tmp_filename.c_str(), filename.c_str())==0);
+    MPI_Barrier(MPI_COMM_WORLD);
+    #ifdef PRINT_DEBUG_MESSAGES
+    if (partition_id==0) {
+      printf("snapshot saved to %s.*\n", path.c_str());
+    }
+    #endif
+  }
+
+  // load a preprocessed graph saved by save_snapshot; the number of partitions and sockets must match
+  void load_snapshot(std::string path) {
+    double load_time = 0;
+    load_time -= MPI_Wtime();
+
+    std::string filename = get_snapshot_filename(path);
+    long length = file_size(filename);
+    int fd = open(filename.c_str(), O_RDONLY);
+    assert(fd!=-1);
+    char * data = (char *)mmap(NULL, length, PROT_READ, MAP_PRIVATE, fd, 0);
+    assert(data!=MAP_FAILED);
+    madvise(data, length, MADV_SEQUENTIAL);
+    char * ptr = data;
+
+    SnapshotHeader header;
+    read_snapshot_section(ptr, &header, sizeof(SnapshotHeader));
+    assert(header.magic==SNAPSHOT_MAGIC && header.version==SNAPSHOT_VERSION);
+    assert(header.partitions==partitions && header.partition_id==partition_id && header.sockets==sockets);
+    assert(header.edge_unit_size==edge_unit_size && header.vertex_order==vertex_order && header.hub_split_threshold==hub_split_threshold);
+    assert(header.adj_compression==adj_compression && header.directions==loaded_directions);
+    max_adj_edges = header.max_adj_edges;
+    symmetric = header.symmetric;
+    vertices = header.vertices;
+    edges = header.edges;
+
+    partition_offset = new VertexId [partitions + 1];
+    read_snapshot_section(ptr, partition_offset, sizeof(VertexId) * (partitions + 1));
+    local_partition_offset = new VertexId [sockets + 1];
+    read_snapshot_section(ptr, local_partition_offset, sizeof(VertexId) * (sockets + 1));
+    owned_vertices = partition_offset[partition_id+1] - partition_offset[partition_id];
+
+    if (vertex_order!=OriginalOrder) {
+      original_id = alloc_node_vertex_array<VertexId>();
+      internal_id = alloc_node_vertex_array<VertexId>();
+      // every partition fills its own range, and the ranges of the other nodes are zeros to be summed
+      if (node_rank==0) {
+        #pragma omp parallel for
+        for (VertexId v_i=0;v_i<vertices;v_i++) {
+          original_id[v_i] = 0;
+        }
+      }
+      sync_node_vertex_array(original_id);
+      read_snapshot_section(ptr, original_id + partition_offset[partition_id], sizeof(VertexId) * owned_vertices);
+      allreduce_node_vertex_array(original_id);
+      if (node_rank==0) {
+        #pragma omp parallel for
+        for (VertexId v_i=0;v_i<vertices;v_i++) {
+          internal_id[original_id[v_i]] = v_i;
+        }
+      }
+      sync_node_vertex_array(internal_id);
+    }
+
+    out_degree = alloc_vertex_array<VertexId>();
+    read_snapshot_section(ptr, out_degree + partition_offset[partition_id], sizeof(VertexId) * owned_vertices);
+    read_snapshot_adjacency(ptr, outgoing_edges, outgoing_adj_bitmap, outgoing_adj_index, compressed_outgoing_adj_vertices, compressed_outgoing_adj_index, outgoing_adj_list);
+    if (symmetric) {
+      in_degree = out_degree;
+      incoming_edges = outgoing_edges;
+      incoming_adj_index = outgoing_adj_index;
+      incoming_adj_list = outgoing_adj_list;
+      incoming_adj_bitmap = outgoing_adj_bitmap;
+      compressed_incoming_adj_vertices = compressed_outgoing_adj_vertices;
+      compressed_incoming_adj_index = compressed_outgoing_adj_index;
+    } else {
+      in_degree = alloc_vertex_array<VertexId>();
+      read_snapshot_section(ptr, in_degree + partition_offset[partition_id], sizeof(VertexId) * owned_vertices);
+      read_snapshot_adjacency(ptr, incoming_edges, incoming_adj_bitmap, incoming_adj_index, compressed_incoming_adj_vertices, compressed_incoming_adj_index, incoming_adj_list);
+    }
+
+    if (hub_split_threshold!=0) {
+      count_hub_split_replicas();
+    }
+    if (adj_compression) {
+      alloc_adj_scratch();
+    }
+
+    if (header.threads==threads) {
+      tuned_chunks_dense = new ThreadState * [partitions];
+      for (int i=0;i<partitions;i++) {
+        tuned_chunks_dense[i] = new ThreadState [threads];
+        read_snapshot_section(ptr, tuned_chunks_dense[i], sizeof(ThreadState) * threads);
+      }
+      if (symmetric) {
+        tuned_chunks_sparse = tuned_chunks_dense;
+      } else {
+        tuned_chunks_sparse = new ThreadState * [partitions];
+        for (int i=0;i<partitions;i++) {
+          tuned_chunks_sparse[i] = new ThreadState [threads];
+          read_snapshot_section(ptr, tuned_chunks_sparse[i], sizeof(ThreadState) * threads);
+        }
+      }
+    } else if (symmetric) {
+      tune_chunks();
+      tuned_chunks_sparse = tuned_chunks_dense;
+    } else {
+      transpose();
+      tune_chunks();
+      transpose();
+      tune_chunks();
+    }
+
+    if (adj_storage_path=="") {
+      assert(munmap(data, length)==0);
+    } else {
+      madvise(data, length, MADV_NORMAL); // the adjacency lists stay mapped
+      snapshot_adj_data = data;
+      snapshot_adj_bytes = length;
+    }
+    assert(close(fd)==0);
+    MPI_Barrier(MPI_COMM_WORLD);
+
+    load_time += MPI_Wtime();
+    #ifdef PRINT_DEBUG_MESSAGES
+    if (partition_id==0) {
+      printf("snapshot loaded from %s.* in %.2lf (s)\n", path.c_str(), load_time);
+    }
+    #endif
+  }
+
+  // count the local active vertices and their out-edges for a metrics record
+  void count_active_metrics(Bitmap * active, CallMetrics & call_metrics) {
+    unsigned long active_vertices = 0;
+    unsigned long active_edges = 0;
+    #pragma omp parallel for reduction(+:active_vertices,active_edges)
+    for (VertexId begin_v_i=partition_offset[partition_id];begin_v_i<partition_offset[partition_id+1];begin_v_i+=64) {
+      unsigned long word = active->data[WORD_OFFSET(begin_v_i)];
+      for_each_bit(word, begin_v_i, [&](VertexId vtx) {
+        active_vertices += 1;
+        active_edges += out_degree[vtx];
+      });
+    }
+    call_metrics.active_vertices = active_vertices;
+    call_metrics.active_edges = active_edges;
+  }
+
+  // process vertices
+  // process: R(VertexId); any callable (a lambda, or a std::function as before) so that it can be inlined;
+  // the vertices of a word of active are all processed by one thread, so process(vtx) may set bit vtx of
+  // another bitmap with set_bit_nonatomic
+  template<typename R, typename Process>
+  R process_vertices(Process process, Bitmap * active) {
+    double stream_time = 0;
+    stream_time -= MPI_Wtime();
+
+    // calls made by process_edges itself are part of its record
+    bool record_metrics = metrics.enabled() && !in_process_edges;
+    CallMetrics call_metrics;
+    if (record_metrics) {
+      call_metrics.reset(partitions, threads);
+      call_metrics.call = "process_vertices";
+      count_active_metrics(active, call_metrics);
+    }
+    R reducer = 0;
+    size_t basic_chunk = 64;
+    for (int t_i=0;t_i<threads;t_i++) {
+      int s_i = get_socket_id(t_i);
+      int s_j = get_socket_offset(t_i);
+      VertexId partition_size = local_partition_offset[s_i+1] - local_partition_offset[s_i];
+      thread_state[t_i]->curr = local_partition_offset[s_i] + partition_size / threads_per_socket  / basic_chunk * basic_chunk * s_j;
+      thread_state[t_i]->end = local_partition_offset[s_i] + partition_size / threads_per_socket / basic_chunk * basic_chunk * (s_j+1);
+      if (s_j == threads_per_socket - 1) {
+        thread_state[t_i]->end = local_partition_offset[s_i+1];
+      }
+      thread_state[t_i]->status = WORKING;
+    }
+    #pragma omp parallel reduction(+:reducer)
+    {
+      R local_reducer = 0;
+      int thread_id = omp_get_thread_num();
+      unsigned long work_chunks = 0;
+      unsigned long steal_chunks = 0;
+      while (true) {
+        VertexId v_i = __sync_fetch_and_add(&thread_state[thread_id]->curr, basic_chunk);
+        if (v_i >= thread_state[thread_id]->end) break;
+        work_chunks += 1;
+        unsigned long word = active->data[WORD_OFFSET(v_i)];
+        for_each_bit(word, v_i, [&](VertexId vtx) {
+          local_reducer += process(vtx);
+        });
+      }
+      thread_state[thread_id]->status = STEALING;
+      for (int t_offset=1;t_offset<threads;t_offset++) {
+        int t_i = (thread_id + t_offset) % threads;
+        while (thread_state[t_i]->status!=STEALING) {
+          VertexId v_i = __sync_fetch_and_add(&thread_state[t_i]->curr, basic_chunk);
+          if (v_i >= thread_state[t_i]->end) continue;
+          steal_chunks += 1;
+          unsigned long word = active->data[WORD_OFFSET(v_i)];
+          for_each_bit(word, v_i, [&](VertexId vtx) {
+            local_reducer += process(vtx);
+          });
+        }
+      }
+      reducer += local_reducer;
+      if (record_metrics) {
+        call_metrics.work_chunks[thread_id] = work_chunks;
+        call_metrics.steal_chunks[thread_id] = steal_chunks;
+      }
+    }
+    R global_reducer;
+    MPI_Datatype dt = get_mpi_data_type<R>();
+    MPI_Allreduce(&reducer, &global_reducer, 1, dt, MPI_SUM, MPI_COMM_WORLD);
+    stream_time += MPI_Wtime();
+    if (record_metrics) {
+      call_metrics.total_time = stream_time;
+      metrics.write(call_metrics);
+    }
+    #ifdef PRINT_DEBUG_MESSAGES
+    if (partition_id==0) {
+      printf("process_vertices took %lf (s)\n", stream_time);
+    }
+    #endif
+    return global_reducer;
+  }
+
+  // find the next non-empty bucket of a bucketed frontier (e.g. of delta-stepping SSSP):
+  // the smallest bucket(v) over the vertices of active, or LONG_MAX if active is empty everywhere
+  // bucket: long(VertexId), non-negative
+  template<typename Bucket>
+  long next_bucket(Bucket bucket, Bitmap * active) {
+    long lowest = LONG_MAX;
+    #pragma omp parallel for reduction(min:lowest)
+    for (VertexId begin_v_i=partition_offset[partition_id];begin_v_i<partition_offset[partition_id+1];begin_v_i+=64) {
+      unsigned long word = active->data[WORD_OFFSET(begin_v_i)];
+      for_each_bit(word, begin_v_i, [&](VertexId vtx) {
+        long b = bucket(vtx);
+        if (b < lowest) lowest = b;
+      });
+    }
+    long global_lowest;
+    MPI_Allreduce(&lowest, &global_lowest, 1, MPI_LONG, MPI_MIN, MPI_COMM_WORLD);
+    return global_lowest;
+  }
+
+  template<typename M>
+  void flush_local_send_buffer(int t_i) {
+    int s_i = get_socket_id(t_i);
+    int pos = __sync_fetch_and_add(&send_buffer[current_send_part_id][s_i]->count, local_send_buffer[t_i]->count);
+    memcpy(send_buffer[current_send_part_id][s_i]->data + sizeof(MsgUnit<M>) * pos, local_send_buffer[t_i]->data, sizeof(MsgUnit<M>) * local_send_buffer[t_i]->count);
+    if (stream_chunk > 0) {
+      // a chunk may be sent once all of its messages have been written
+      VertexId * filled = stream_filled.data() + (current_send_part_id * sockets + s_i) * stream_chunks;
+      VertexId begin = pos;
+      VertexId end = pos + local_send_buffer[t_i]->count;
+      while (begin < end) {
+        VertexId chunk_end = std::min(end, (begin / stream_chunk + 1) * stream_chunk);
+        __sync_fetch_and_add(&filled[begin / stream_chunk], chunk_end - begin);
+        begin = chunk_end;
+      }
+    }
+    local_send_buffer[t_i]->count = 0;
+  }
+
+  // emit a message to a vertex's master (dense) / mirror (sparse)
+  template<typename M>
+  void emit(VertexId vtx, M msg) {
+    int t_i = omp_get_thread_num();
+    MsgUnit<M> * buffer = (MsgUnit<M>*)local_send_buffer[t_i]->data;
+    buffer[local_send_buffer[t_i]->count].vertex = vtx;
+    buffer[local_send_buffer[t_i]->count].msg_data = msg;
+    local_send_buffer[t_i]->count += 1;
+    if (local_send_buffer[t_i]->count==local_send_buffer_limit) {
+      flush_local_send_buffer<M>(t_i);
+    }
+  }
+
+  // decide whether a process_edges call runs in sparse (push) or dense (pull) mode;
+  // active_edges is the global number of out-edges of active vertices
+  bool select_sparse_mode(Bitmap * active, Bitmap * dense_selective, EdgeId active_edges) {
+    if (loaded_directions!=BothDirections) {
+      last_sparse = loaded_directions==OutgoingOnly;
+      return last_sparse;
+    }
+    bool sparse = active_edges < edges * sparse_threshold;
+    if (direction_policy==CostModel) {
+      if (last_sparse) {
+        // the in-edges of vertices outside dense_selective bound what a dense pass has to scan
+        EdgeId unexplored_edges = 0;
+        #pragma omp parallel for reduction(+:unexplored_edges)
+        for (VertexId v_i=partition_offset[partition_id];v_i<partition_offset[partition_id+1];v_i++) {
+          if (dense_selective==nullptr || !dense_selective->get_bit(v_i)) {
+            unexplored_edges += in_degree[v_i];
+          }
+        }
+        MPI_Allreduce(MPI_IN_PLACE, &unexplored_edges, 1, get_mpi_data_type<EdgeId>(), MPI_SUM, MPI_COMM_WORLD);
+        sparse = active_edges <= unexplored_edges / direction_alpha;
+      } else {
+        unsigned long active_vertices = active->count(partition_offset[partition_id], partition_offset[partition_id+1]);
+        MPI_Allreduce(MPI_IN_PLACE, &active_vertices, 1, MPI_UNSIGNED_LONG, MPI_SUM, MPI_COMM_WORLD);
+        sparse = active_vertices < vertices / direction_beta;
+      }
+    } else if (direction_policy==AutoTuned && sparse_samples[0] > 0 && dense_samples[0] > 0) {
+      double n = sparse_samples[0], sx = sparse_samples[1], sy = sparse_samples[2], sxx = sparse_samples[3], sxy = sparse_samples[4];
+      double slope = sx > 0 ? sy / sx : 0;
+      double intercept = 0;
+      double det = n * sxx - sx * sx;
+      if (n >= 2 && det > 1e-9 * n * sxx) {
+        double fitted_slope = (n * sxy - sx * sy) / det;
+        if (fitted_slope > 0) {
+          slope = fitted_slope;
+          intercept = std::max((sy - slope * sx) / n, 0.0);
+        }
+      }
+      double predicted_sparse_time = intercept + slope * active_edges;
+      double predicted_dense_time = dense_samples[1] / dense_samples[0];
+      sparse = predicted_sparse_time < predicted_dense_time;
+      #ifdef PRINT_DEBUG_MESSAGES
+      if (partition_id==0) {
+        printf("predicted sparse=%lf dense=%lf (s)\n", predicted_sparse_time, predicted_dense_time);
+      }
+      #endif
+    }
+    last_sparse = sparse;
+    return sparse;
+  }
+
+  // feed the measured time of a process_edges call to the AutoTuned policy; older samples decay
+  void record_direction_sample(bool sparse, EdgeId active_edges, double time) {
+    const double decay = 0.8;
+    if (sparse) {
+      double x = active_edges;
+      for (int i=0;i<5;i++) {
+        sparse_samples[i] *= decay;
+      }
+      sparse_samples[0] += 1;
+      sparse_samples[1] += x;
+      sparse_samples[2] += time;
+      sparse_samples[3] += x * x;
+      sparse_samples[4] += x * time;
+    } else {
+      for (int i=0;i<2;i++) {
+        dense_samples[i] *= decay;
+      }
+      dense_samples[0] += 1;
+      dense_samples[1] += time;
+    }
+  }
+
+  // encode the messages (to vertices in [offset, offset+range)) into wire->data and set wire->count to its
+  // size in bytes, taking the smallest of the raw, bitmap and varint encodings
+  template<typename M>
+  void encode_messages(MessageBuffer * messages, VertexId offset, VertexId range, MessageBuffer * wire) {
+    MsgUnit<M> * buffer = (MsgUnit<M> *)messages->data;
+    int count = messages->count;
+    bool lossy = wire_lossy && std::is_same<M, double>::value;
+    size_t payload_size = lossy ? sizeof(float) : sizeof(M);
+    size_t raw_bytes = sizeof(MsgUnit<M>) * count;
+    wire->resize(sizeof(WireHeader) + raw_bytes);
+    WireHeader * header = (WireHeader *)wire->data;
+    header->encoding = RawWire;
+    header->count = count;
+    header->index_bytes = 0;
+    header->payload_size = sizeof(M);
+
+    // sort the messages by vertex: through a bitmap of the range if they are not too sparse
+    size_t words = WORD_OFFSET(range) + 1;
+    size_t bitmap_bytes = sizeof(unsigned long) * words;
+    bool unique = true;
+    wire_order.resize(count);
+    if ((size_t)count * 16 >= words) {
+      wire_bitmap.assign(words, 0);
+      wire_rank.resize(words);
+      for (int m_i=0;m_i<count;m_i++) {
+        VertexId v_i = buffer[m_i].vertex - offset;
+        wire_bitmap[WORD_OFFSET(v_i)] |= 1ul << BIT_OFFSET(v_i);
+      }
+      VertexId rank = 0;
+      for (size_t w_i=0;w_i<words;w_i++) {
+        wire_rank[w_i] = rank;
+        rank += __builtin_popcountl(wire_bitmap[w_i]);
+      }
+      unique = rank==(VertexId)count;
+      if (unique) {
+        for (int m_i=0;m_i<count;m_i++) {
+          VertexId v_i = buffer[m_i].vertex - offset;
+          wire_order[wire_rank[WORD_OFFSET(v_i)] + __builtin_popcountl(wire_bitmap[WORD_OFFSET(v_i)] & ((1ul << BIT_OFFSET(v_i)) - 1))] = m_i;
+        }
+      }
+    } else {
+      bitmap_bytes = raw_bytes; // never worth building
+      for (int m_i=0;m_i<count;m_i++) {
+        wire_order[m_i] = m_i;
+      }
+      std::sort(wire_order.begin(), wire_order.end(), [&](VertexId a, VertexId b){
+        return buffer[a].vertex < buffer[b].vertex;
+      });
+      for (int m_i=1;m_i<count;m_i++) {
+        unique = unique && buffer[wire_order[m_i-1]].vertex!=buffer[wire_order[m_i]].vertex;
+      }
+    }
+    if (!unique || count==0) {
+      // split hubs may send several messages for one vertex
+      memcpy(header + 1, buffer, raw_bytes);
+      wire->count = sizeof(WireHeader) + raw_bytes;
+      return;
+    }
+    size_t varint_bytes = 0;
+    for (int m_i=0;m_i<count;m_i++) {
+      VertexId gap = buffer[wire_order[m_i]].vertex - (m_i==0 ? offset : buffer[wire_order[m_i-1]].vertex);
+      varint_bytes += encode_varint(gap, NULL);
+    }
+    size_t payload_bytes = payload_size * count;
+    unsigned char * index = (unsigned char *)(header + 1);
+    if (std::min(bitmap_bytes, varint_bytes) + payload_bytes >= raw_bytes) {
+      memcpy(index, buffer, raw_bytes);
+      wire->count = sizeof(WireHeader) + raw_bytes;
+      return;
+    }
+    if (bitmap_bytes < varint_bytes) {
+      header->encoding = BitmapWire;
+      header->index_bytes = bitmap_bytes;
+      memcpy(index, wire_bitmap.data(), bitmap_bytes);
+    } else {
+      header->encoding = VarintWire;
+      header->index_bytes = varint_bytes;
+      size_t pos = 0;
+      for (int m_i=0;m_i<count;m_i++) {
+        VertexId gap = buffer[wire_order[m_i]].vertex - (m_i==0 ? offset : buffer[wire_order[m_i-1]].vertex);
+        pos += encode_varint(gap, index + pos);
+      }
+    }
+    header->payload_size = payload_size;
+    unsigned char * payload = index + header->index_bytes;
+    for (int m_i=0;m_i<count;m_i++) {
+      M msg_data = buffer[wire_order[m_i]].msg_data;
+      write_wire_payload(msg_data, payload + payload_size * m_i, lossy);
+    }
+    wire->count = sizeof(WireHeader) + header->index_bytes + payload_bytes;
+  }
+
+  // decode a batch from encode_messages back into a MsgUnit<M> array
+  template<typename M>
+  void decode_messages(MessageBuffer * wire, VertexId offset, MessageBuffer * messages) {
+    WireHeader * header = (WireHeader *)wire->data;
+    int count = header->count;
+    messages->resize(sizeof(MsgUnit<M>) * count);
+    MsgUnit<M> * buffer = (MsgUnit<M> *)messages->data;
+    messages->count = count;
+    const unsigned char * index = (const unsigned char *)(header + 1);
+    if (header->encoding==RawWire) {
+      memcpy(buffer, index, sizeof(MsgUnit<M>) * count);
+      return;
+    }
+    bool lossy = header->payload_size!=(int)sizeof(M);
+    const unsigned char * payload = index + header->index_bytes;
+    if (header->encoding==BitmapWire) {
+      const unsigned long * bitmap = (const unsigned long *)index;
+      size_t words = header->index_bytes / sizeof(unsigned long);
+      int pos = 0;
+      for (size_t w_i=0;w_i<words;w_i++) {
+        unsigned long word = bitmap[w_i];
+        while (word != 0) {
+          buffer[pos].vertex = offset + (w_i << 6) + __builtin_ctzl(word);
+          pos++;
+          word &= word - 1;
+        }
+      }
+      assert(pos==count);
+    } else {
+      assert(header->encoding==VarintWire);
+      VertexId vertex = offset;
+      for (int m_i=0;m_i<count;m_i++) {
+        vertex += decode_varint(index);
+        buffer[m_i].vertex = vertex;
+      }
+    }
+    for (int m_i=0;m_i<count;m_i++) {
+      M msg_data;
+      read_wire_payload(msg_data, payload + header->payload_size * m_i, lossy);
+      buffer[m_i].msg_data = msg_data;
+    }
+  }
+
+  // send a batch of messages to partition i (encoded in wire if adaptive wire encoding is enabled); returns the bytes sent
+  template<typename M>
+  size_t send_messages(MessageBuffer * messages, MessageBuffer * wire, int i) {
+    if (!wire_adaptive) {
+      MPI_Send(messages->data, sizeof(MsgUnit<M>) * messages->count, MPI_CHAR, i, PassMessage, MPI_COMM_WORLD);
+      return sizeof(MsgUnit<M>) * messages->count;
+    }
+    MPI_Send(wire->data, wire->count, MPI_CHAR, i, PassMessage, MPI_COMM_WORLD);
+    return wire->count;
+  }
+
+  // receive a batch of messages (to vertices from offset on) from partition i
+  template<typename M>
+  void recv_messages(MessageBuffer * messages, VertexId offset, int i) {
+    MPI_Status recv_status;
+    MPI_Probe(i, PassMessage, MPI_COMM_WORLD, &recv_status);
+    int bytes;
+    MPI_Get_count(&recv_status, MPI_CHAR, &bytes);
+    if (!wire_adaptive) {
+      messages->resize(bytes);
+      MPI_Recv(messages->data, bytes, MPI_CHAR, i, PassMessage, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+      messages->count = bytes / sizeof(MsgUnit<M>);
+      return;
+    }
+    wire_recv_buffer[i]->resize(bytes);
+    MPI_Recv(wire_recv_buffer[i]->data, bytes, MPI_CHAR, i, PassMessage, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+    decode_messages<M>(wire_recv_buffer[i], offset, messages);
+  }
+
+  // point the views of send_buffer[i] (dense mode) or send_buffer[partition_id] (sparse mode) to the place of
+  // their batches in the segment of this partition, with room for units messages per socket
+  template<typename M>
+  void assign_node_send_buffers(bool sparse, int i, size_t units) {
+    send_buffer[i] = node_send_buffer[i];
+    for (int s_i=0;s_i<sockets;s_i++) {
+      send_buffer[i][s_i]->data = node_message_base[node_rank] + node_send_offset(sizeof(MsgUnit<M>), sparse, i, s_i);
+      send_buffer[i][s_i]->capacity = sizeof(MsgUnit<M>) * units;
+      send_buffer[i][s_i]->count = 0;
+    }
+  }
+
+  // announce the batches of send_buffer[i] to partition i (or, for i = -1 in sparse mode, those of
+  // send_buffer[partition_id] to all partitions) as they lie in the node message window: to the partitions of
+  // this node directly, and to the leader of this node for those of other nodes
+  template<typename M>
+  void post_node_batches(int i) {
+    int node_id = node_of[partition_id];
+    MessageBuffer ** buffers = send_buffer[i==-1 ? partition_id : i];
+    std::vector<NodeBatch> batches (sockets);
+    for (int s_i=0;s_i<sockets;s_i++) {
+      batches[s_i].source = partition_id;
+      batches[s_i].target = i;
+      batches[s_i].owner = node_rank;
+      batches[s_i].count = buffers[s_i]->count;
+      batches[s_i].offset = buffers[s_i]->data - node_message_base[node_rank];
+    }
+    MPI_Win_sync(node_message_win);
+    int bytes = sizeof(NodeBatch) * sockets;
+    if (i==-1) {
+      for (int j : node_members[node_id]) {
+        if (j!=partition_id) {
+          MPI_Send(batches.data(), bytes, MPI_CHAR, j, NodeMessage, MPI_COMM_WORLD);
+        }
+      }
+      if (node_members.size() > 1) {
+        MPI_Send(batches.data(), bytes, MPI_CHAR, node_members[node_id][0], NodeForward, MPI_COMM_WORLD);
+      }
+    } else if (node_of[i]==node_id) {
+      MPI_Send(batches.data(), bytes, MPI_CHAR, i, NodeMessage, MPI_COMM_WORLD);
+    } else {
+      MPI_Send(batches.data(), bytes, MPI_CHAR, node_members[node_id][0], NodeForward, MPI_COMM_WORLD);
+    }
+  }
+
+  // take the announcements of the batches from all other partitions, pointing node_recv_buffer[i] to those from
+  // partition i and pushing i to recv_queue
+  template<typename M>
+  void recv_node_batches(SpscQueue<int> & recv_queue) {
+    std::vector<NodeBatch> batches (sockets);
+    for (int step=1;step<partitions;step++) {
+      MPI_Recv(batches.data(), sizeof(NodeBatch) * sockets, MPI_CHAR, MPI_ANY_SOURCE, NodeMessage, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+      MPI_Win_sync(node_message_win);
+      int i = batches[0].source;
+      for (int s_i=0;s_i<sockets;s_i++) {
+        node_recv_buffer[i][s_i]->data = node_message_base[batches[s_i].owner] + batches[s_i].offset;
+        node_recv_buffer[i][s_i]->count = batches[s_i].count;
+      }
+      recv_queue.push(i);
+    }
+  }
+
+  // split an aggregate into messages of about NODE_AGGREGATE_PIECE bytes; returns the first batch of each and the end
+  std::vector<size_t> node_aggregate_pieces(std::vector<NodeBatch> & batches, size_t unit) {
+    std::vector<size_t> pieces (1, 0);
+    size_t bytes = 0;
+    for (size_t b_i=0;b_i<batches.size();b_i++) {
+      if (bytes > 0 && bytes + unit * batches[b_i].count > NODE_AGGREGATE_PIECE) {
+        pieces.push_back(b_i);
+        bytes = 0;
+      }
+      bytes += unit * batches[b_i].count;
+    }
+    pieces.push_back(batches.size());
+    return pieces;
+  }
+
+  // send the batches of this node for the partitions of node node_id to its leader, as one list and the messages
+  // gathered from the segments of this node without copying
+  template<typename M>
+  void send_node_aggregate(int node_id, std::vector<NodeBatch> & batches, CallMetrics & call_metrics) {
+    int leader = node_members[node_id][0];
+    MPI_Send(batches.data(), sizeof(NodeBatch) * batches.size(), MPI_CHAR, leader, NodeAggregate, MPI_COMM_WORLD);
+    MPI_Datatype unit_type;
+    MPI_Type_contiguous(sizeof(MsgUnit<M>), MPI_CHAR, &unit_type);
+    MPI_Type_commit(&unit_type);
+    std::vector<size_t> pieces = node_aggregate_pieces(batches, sizeof(MsgUnit<M>));
+    for (size_t p_i=0;p_i+1<pieces.size();p_i++) {
+      std::vector<int> counts;
+      std::vector<MPI_Aint> addresses;
+      for (size_t b_i=pieces[p_i];b_i<pieces[p_i+1];b_i++) {
+        if (batches[b_i].count==0) continue;
+        MPI_Aint address;
+        MPI_Get_address(node_message_base[batches[b_i].owner] + batches[b_i].offset, &address);
+        counts.push_back(batches[b_i].count);
+        addresses.push_back(address);
+        if (metrics.enabled()) {
+          call_metrics.sent_bytes[leader] += sizeof(MsgUnit<M>) * batches[b_i].count;
+        }
+      }
+      if (counts.empty()) continue;
+      MPI_Datatype piece_type;
+      MPI_Type_create_hindexed(counts.size(), counts.data(), addresses.data(), unit_type, &piece_type);
+      MPI_Type_commit(&piece_type);
+      MPI_Send(MPI_BOTTOM, 1, piece_type, leader, NodeAggregate, MPI_COMM_WORLD);
+      MPI_Type_free(&piece_type);
+    }
+    MPI_Type_free(&unit_type);
+  }
+
+  // node leader: collect the announcements of the batches of this node for other nodes and send one aggregate to
+  // every other node, as soon as all its batches are complete (dense mode) or once for all (sparse mode)
+  template<typename M>
+  void forward_node_batches(bool sparse, CallMetrics & call_metrics) {
+    int node_id = node_of[partition_id];
+    int nodes = node_members.size();
+    std::vector<std::vector<NodeBatch>> pending (nodes);
+    std::vector<int> waiting (nodes);
+    int forwards = 0;
+    for (int n_i=0;n_i<nodes;n_i++) {
+      waiting[n_i] = n_i==node_id ? 0 : node_partitions * (sparse ? 1 : node_members[n_i].size());
+      forwards += waiting[n_i];
+    }
+    if (sparse) {
+      forwards = node_partitions;
+    }
+    std::vector<NodeBatch> batches (sockets);
+    for (int f_i=0;f_i<forwards;f_i++) {
+      MPI_Recv(batches.data(), sizeof(NodeBatch) * sockets, MPI_CHAR, MPI_ANY_SOURCE, NodeForward, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+      MPI_Win_sync(node_message_win);
+      if (sparse) {
+        pending[node_id].insert(pending[node_id].end(), batches.begin(), batches.end());
+        continue;
+      }
+      int n_i = node_of[batches[0].target];
+      pending[n_i].insert(pending[n_i].end(), batches.begin(), batches.end());
+      waiting[n_i] -= 1;
+      if (waiting[n_i]==0) {
+        send_node_aggregate<M>(n_i, pending[n_i], call_metrics);
+      }
+    }
+    if (sparse) {
+      // every other node reads the same batches
+      for (int step=1;step<nodes;step++) {
+        send_node_aggregate<M>((node_id + step) % nodes, pending[node_id], call_metrics);
+      }
+    }
+  }
+
+  // node leader: receive the aggregates of all other nodes after the batches of this node in its segment, and
+  // announce each batch to its target partitions
+  template<typename M>
+  void deliver_node_batches() {
+    MPI_Datatype unit_type;
+    MPI_Type_contiguous(sizeof(MsgUnit<M>), MPI_CHAR, &unit_type);
+    MPI_Type_commit(&unit_type);
+    int node_id = node_of[partition_id];
+    size_t recv_offset = node_message_bytes[0];
+    size_t received = 0;
+    for (int step=1;step<(int)node_members.size();step++) {
+      // the list of an aggregate comes before its messages, which are received from its sender right away
+      MPI_Status recv_status;
+      MPI_Probe(MPI_ANY_SOURCE, NodeAggregate, MPI_COMM_WORLD, &recv_status);
+      int sender = recv_status.MPI_SOURCE;
+      int bytes;
+      MPI_Get_count(&recv_status, MPI_CHAR, &bytes);
+      std::vector<NodeBatch> batches (bytes / sizeof(NodeBatch));
+      MPI_Recv(batches.data(), bytes, MPI_CHAR, sender, NodeAggregate, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+      std::vector<size_t> pieces = node_aggregate_pieces(batches, sizeof(MsgUnit<M>));
+      for (size_t p_i=0;p_i+1<pieces.size();p_i++) {
+        size_t units = 0;
+        for (size_t b_i=pieces[p_i];b_i<pieces[p_i+1];b_i++) {
+          batches[b_i].owner = 0;
+          batches[b_i].offset = recv_offset + received + sizeof(MsgUnit<M>) * units;
+          units += batches[b_i].count;
+        }
+        if (units==0) continue;
+        assert(received + sizeof(MsgUnit<M>) * units <= node_recv_bytes);
+        MPI_Recv(node_message_base[0] + recv_offset + received, units, unit_type, sender, NodeAggregate, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+        received += sizeof(MsgUnit<M>) * units;
+      }
+      MPI_Win_sync(node_message_win);
+      int bytes_per_source = sizeof(NodeBatch) * sockets;
+      for (size_t b_i=0;b_i<batches.size();b_i+=sockets) {
+        if (batches[b_i].target==-1) {
+          for (int j : node_members[node_id]) {
+            MPI_Send(&batches[b_i], bytes_per_source, MPI_CHAR, j, NodeMessage, MPI_COMM_WORLD);
+          }
+        } else {
+          MPI_Send(&batches[b_i], bytes_per_source, MPI_CHAR, batches[b_i].target, NodeMessage, MPI_COMM_WORLD);
+        }
+      }
+    }
+    MPI_Type_free(&unit_type);
+  }
+
+  // move the calling communication thread to the reserved CPUs, if any
+  void bind_comm_thread() {
+    if (CPU_COUNT(&comm_cpus) > 0) {
+      assert(sched_setaffinity(0, sizeof(comm_cpus), &comm_cpus)==0);
+    }
+  }
+
+  // post the chunks of send_buffer[i][s_i] filled up since the last call (from chunk posted on) to partition recipient,
+  // or to all other partitions if recipient is -1; once finished, the remaining ones and the final short (maybe empty) one
+  template<typename M>
+  void post_stream_chunks(int i, int s_i, size_t & posted, bool finished, int recipient, std::vector<MPI_Request> & requests, CallMetrics & call_metrics) {
+    MessageBuffer * buffer = send_buffer[i][s_i];
+    volatile VertexId * filled = stream_filled.data() + (i * sockets + s_i) * stream_chunks;
+    while (true) {
+      VertexId begin = posted * stream_chunk;
+      VertexId end = begin + stream_chunk;
+      if (finished) {
+        end = std::min(end, (VertexId)buffer->count);
+      } else if (filled[posted] < stream_chunk) {
+        break;
+      }
+      __sync_synchronize();
+      for (int step=1;step<partitions;step++) {
+        int j = recipient==-1 ? (partition_id - step + partitions) % partitions : recipient;
+        MPI_Request request;
+        MPI_Isend(buffer->data + sizeof(MsgUnit<M>) * begin, sizeof(MsgUnit<M>) * (end - begin), MPI_CHAR, j, StreamMessage + s_i, MPI_COMM_WORLD, &request);
+        requests.push_back(request);
+        if (metrics.enabled()) {
+          call_metrics.sent_bytes[j] += sizeof(MsgUnit<M>) * (end - begin);
+        }
+        if (recipient!=-1) break;
+      }
+      posted += 1;
+      if (end - begin < stream_chunk) break;
+    }
+  }
+
+  // append incoming chunks to recv_buffer[sender][socket] until all sockets of senders partitions ended their streams,
+  // announcing each of them in received
+  template<typename M>
+  void recv_stream_chunks(int senders, SpscQueue<StreamChunk> & received) {
+    int remaining = senders * sockets;
+    while (remaining > 0) {
+      MPI_Status recv_status;
+      MPI_Probe(MPI_ANY_SOURCE, MPI_ANY_TAG, MPI_COMM_WORLD, &recv_status);
+      int i = recv_status.MPI_SOURCE;
+      int s_i = recv_status.MPI_TAG - StreamMessage;
+      assert(s_i>=0 && s_i<sockets);
+      int bytes;
+      MPI_Get_count(&recv_status, MPI_CHAR, &bytes);
+      MessageBuffer * buffer = recv_buffer[i][s_i];
+      assert(buffer->capacity >= sizeof(MsgUnit<M>) * buffer->count + bytes);
+      MPI_Recv(buffer->data + sizeof(MsgUnit<M>) * buffer->count, bytes, MPI_CHAR, i, recv_status.MPI_TAG, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+      StreamChunk chunk;
+      chunk.partition = i;
+      chunk.socket = s_i;
+      chunk.messages = bytes / sizeof(MsgUnit<M>);
+      buffer->count += chunk.messages;
+      if (chunk.messages < stream_chunk) {
+        remaining -= 1;
+      }
+      received.push(chunk);
+    }
+  }
+
+  // run process(recv_buffer[i], begin, end) on the messages [begin[s_i], end[s_i]) received from partition i so far,
+  // batching at least a chunk unless the partition ended its streams, until all partitions did
+  template<typename Process>
+  void process_stream_chunks(Process process, SpscQueue<StreamChunk> & received, CallMetrics & call_metrics) {
+    std::vector<VertexId> processed(partitions * sockets, 0);
+    std::vector<VertexId> available(partitions * sockets, 0);
+    std::vector<int> ended(partitions, 0);
+    int remaining = (partitions - 1) * sockets;
+    while (remaining > 0) {
+      call_metrics.recv_wait_time -= MPI_Wtime();
+      StreamChunk chunk = received.pop();
+      call_metrics.recv_wait_time += MPI_Wtime();
+      do {
+        available[chunk.partition * sockets + chunk.socket] += chunk.messages;
+        if (chunk.messages < stream_chunk) {
+          ended[chunk.partition] += 1;
+          remaining -= 1;
+        }
+      } while (received.try_pop(chunk));
+      for (int step=1;step<partitions;step++) {
+        int i = (partition_id + step) % partitions;
+        VertexId pending = 0;
+        for (int s_i=0;s_i<sockets;s_i++) {
+          pending += available[i * sockets + s_i] - processed[i * sockets + s_i];
+        }
+        if (pending==0 || (ended[i]<sockets && pending < stream_chunk)) continue;
+        call_metrics.slot_time -= MPI_Wtime();
+        process(recv_buffer[i], processed.data() + i * sockets, available.data() + i * sockets);
+        call_metrics.slot_time += MPI_Wtime();
+        for (int s_i=0;s_i<sockets;s_i++) {
+          processed[i * sockets + s_i] = available[i * sockets + s_i];
+        }
+      }
+    }
+  }
+
+  // the bytes held by the message buffers of this partition
+  size_t message_bytes() {
+    size_t bytes = combine_buffer_size;
+    for (int t_i=0;t_i<threads;t_i++) {
+      bytes += local_send_buffer[t_i]->capacity;
+    }
+    for (int i=0;i<partitions;i++) {
+      for (int s_i=0;s_i<sockets;s_i++) {
+        bytes += send_buffer_sets[i][s_i]->capacity + recv_buffer[i][s_i]->capacity;
+      }
+    }
+    if (node_message_win!=MPI_WIN_NULL) {
+      bytes += node_message_bytes[node_rank] + (node_rank==0 ? node_recv_bytes : 0);
+    }
+    if (wire_adaptive) {
+      for (int s_i=0;s_i<sockets;s_i++) {
+        bytes += wire_send_buffer[s_i]->capacity;
+      }
+      for (int i=0;i<partitions;i++) {
+        bytes += wire_recv_buffer[i]->capacity;
+      }
+    }
+    return bytes;
+  }
+
+  // shrink the receive buffers and the send buffer sets from first_unused_set on, which the next call grows again as needed
+  void trim_message_buffers(int first_unused_set) {
+    for (int i=0;i<partitions;i++) {
+      for (int s_i=0;s_i<sockets;s_i++) {
+        recv_buffer[i][s_i]->shrink(0);
+        if (i >= first_unused_set) {
+          send_buffer_sets[i][s_i]->shrink(0);
+        }
+      }
+    }
+    if (wire_adaptive) {
+      for (int i=0;i<partitions;i++) {
+        wire_recv_buffer[i]->shrink(0);
+      }
+    }
+  }
+
+  // make room for merging messages of msg_size bytes to any partition
+  void alloc_combine_buffer(size_t msg_size) {
+    VertexId max_range = 0;
+    for (int i=0;i<partitions;i++) {
+      max_range = std::max(max_range, partition_offset[i+1] - partition_offset[i]);
+    }
+    if (combine_present==NULL) {
+      combine_present = new Bitmap(max_range);
+      combine_lock = new Bitmap(max_range);
+    }
+    size_t bytes = msg_size * std::max(max_range, (VertexId)1);
+    if (bytes > combine_buffer_size) {
+      if (combine_buffer!=NULL) {
+        numa_free(combine_buffer, combine_buffer_size);
+      }
+      combine_buffer = (char *)numa_alloc_interleaved(bytes);
+      combine_buffer_size = bytes;
+    }
+  }
+
+  // without a combiner, dense-mode messages are sent as emitted
+  template<typename M>
+  void combine_dense_messages(int i, std::nullptr_t combine) { }
+
+  // merge the dense-mode messages to partition i that address the same vertex: a vertex gets one
+  // message per socket holding some of its in-edges, plus one per extra piece of a split hub
+  template<typename M, typename Combine>
+  void combine_dense_messages(int i, Combine combine) {
+    if (sockets==1 && hub_split_replicas==0) return;
+    VertexId offset = partition_offset[i];
+    VertexId range = partition_offset[i+1] - offset;
+    alloc_combine_buffer(sizeof(M));
+    M * combined = (M *)combine_buffer;
+    for (int s_i=0;s_i<sockets;s_i++) {
+      MsgUnit<M> * buffer = (MsgUnit<M> *)send_buffer[i][s_i]->data;
+      #pragma omp parallel for
+      for (int m_i=0;m_i<send_buffer[i][s_i]->count;m_i++) {
+        VertexId v_i = buffer[m_i].vertex - offset;
+        unsigned long * lock = combine_lock->data + WORD_OFFSET(v_i);
+        unsigned long bit = 1ul << BIT_OFFSET(v_i);
+        while (__sync_fetch_and_or(lock, bit) & bit) {
+          __asm volatile ("pause" ::: "memory");
+        }
+        if (combine_present->get_bit(v_i)) {
+          combined[v_i] = combine(combined[v_i], buffer[m_i].msg_data);
+        } else {
+          combined[v_i] = buffer[m_i].msg_data;
+          combine_present->set_bit(v_i);
+        }
+        __sync_fetch_and_and(lock, ~bit);
+      }
+    }
+    // write the merged messages back, each socket's buffer taking the ranges of its threads
+    VertexId words = WORD_OFFSET(range) + 1;
+    VertexId * thread_pos = new VertexId [threads];
+    #pragma omp parallel
+    {
+      int t_i = omp_get_thread_num();
+      VertexId begin_w_i = (EdgeId)words * t_i / threads;
+      VertexId end_w_i = (EdgeId)words * (t_i + 1) / threads;
+      VertexId count = 0;
+      for (VertexId w_i=begin_w_i;w_i<end_w_i;w_i++) {
+        count += __builtin_popcountl(combine_present->data[w_i]);
+      }
+      thread_pos[t_i] = count;
+      #pragma omp barrier
+      #pragma omp single
+      {
+        for (int s_i=0;s_i<sockets;s_i++) {
+          VertexId pos = 0;
+          for (int t_j=s_i*threads_per_socket;t_j<(s_i+1)*threads_per_socket;t_j++) {
+            VertexId thread_count = thread_pos[t_j];
+            thread_pos[t_j] = pos;
+            pos += thread_count;
+          }
+          send_buffer[i][s_i]->count = pos;
         }
       }
+      MsgUnit<M> * buffer = (MsgUnit<M> *)send_buffer[i][get_socket_id(t_i)]->data;
+      VertexId pos = thread_pos[t_i];
+      for (VertexId w_i=begin_w_i;w_i<end_w_i;w_i++) {
+        unsigned long word = combine_present->data[w_i];
+        for_each_bit(word, w_i << 6, [&](VertexId vtx) {
+          buffer[pos].vertex = offset + vtx;
+          buffer[pos].msg_data = combined[vtx];
+          pos++;
+        });
+        combine_present->data[w_i] = 0;
+      }
     }
+    delete [] thread_pos;
   }
 
-  // process vertices
-  template<typename R>
-  R process_vertices(std::function<R(VertexId)> process, Bitmap * active) {
-    double stream_time = 0;
-    stream_time -= MPI_Wtime();
-
-    R reducer = 0;
+  // run sparse_slot on the messages [slot_begin, slot_end) of buffer against the outgoing edges of every socket,
+  // by all threads; returns the sum of the results
+  template<typename R, typename M, typename SparseSlot>
+  R run_sparse_slots(SparseSlot & sparse_slot, MsgUnit<M> * buffer, VertexId slot_begin, VertexId slot_end, CallMetrics & call_metrics) {
     size_t basic_chunk = 64;
+    size_t buffer_size = slot_end - slot_begin;
     for (int t_i=0;t_i<threads;t_i++) {
-      int s_i = get_socket_id(t_i);
+      // int s_i = get_socket_id(t_i);
       int s_j = get_socket_offset(t_i);
-      VertexId partition_size = local_partition_offset[s_i+1] - local_partition_offset[s_i];
-      thread_state[t_i]->curr = local_partition_offset[s_i] + partition_size / threads_per_socket  / basic_chunk * basic_chunk * s_j;
-      thread_state[t_i]->end = local_partition_offset[s_i] + partition_size / threads_per_socket / basic_chunk * basic_chunk * (s_j+1);
+      VertexId partition_size = buffer_size;
+      thread_state[t_i]->curr = slot_begin + partition_size / threads_per_socket  / basic_chunk * basic_chunk * s_j;
+      thread_state[t_i]->end = slot_begin + partition_size / threads_per_socket / basic_chunk * basic_chunk * (s_j+1);
       if (s_j == threads_per_socket - 1) {
-        thread_state[t_i]->end = local_partition_offset[s_i+1];
+        thread_state[t_i]->end = slot_end;
       }
       thread_state[t_i]->status = WORKING;
     }
-    #pragma omp parallel reduction(+:reducer)
+    R slot_reducer = 0;
+    #pragma omp parallel reduction(+:slot_reducer)
     {
       R local_reducer = 0;
       int thread_id = omp_get_thread_num();
+      int s_i = get_socket_id(thread_id);
+      unsigned long work_chunks = 0;
+      unsigned long steal_chunks = 0;
       while (true) {
-        VertexId v_i = __sync_fetch_and_add(&thread_state[thread_id]->curr, basic_chunk);
-        if (v_i >= thread_state[thread_id]->end) break;
-        unsigned long word = active->data[WORD_OFFSET(v_i)];
-        while (word != 0) {
-          if (word & 1) {
-            local_reducer += process(v_i);
+        VertexId b_i = __sync_fetch_and_add(&thread_state[thread_id]->curr, basic_chunk);
+        if (b_i >= thread_state[thread_id]->end) break;
+        work_chunks += 1;
+        VertexId begin_b_i = b_i;
+        VertexId end_b_i = b_i + basic_chunk;
+        if (end_b_i>thread_state[thread_id]->end) {
+          end_b_i = thread_state[thread_id]->end;
+        }
+        for (b_i=begin_b_i;b_i<end_b_i;b_i++) {
+          VertexId v_i = buffer[b_i].vertex;
+          M msg_data = buffer[b_i].msg_data;
+          if (outgoing_adj_bitmap[s_i]->get_bit(v_i)) {
+            local_reducer += sparse_slot(v_i, msg_data, get_adj_list(outgoing_adj_list[s_i], outgoing_adj_index[s_i][v_i], outgoing_adj_index[s_i][v_i+1], thread_id));
           }
-          v_i++;
-          word = word >> 1;
         }
       }
       thread_state[thread_id]->status = STEALING;
       for (int t_offset=1;t_offset<threads;t_offset++) {
         int t_i = (thread_id + t_offset) % threads;
-        while (thread_state[t_i]->status!=STEALING) {
-          VertexId v_i = __sync_fetch_and_add(&thread_state[t_i]->curr, basic_chunk);
-          if (v_i >= thread_state[t_i]->end) continue;
-          unsigned long word = active->data[WORD_OFFSET(v_i)];
-          while (word != 0) {
-            if (word & 1) {
-              local_reducer += process(v_i);
+        if (thread_state[t_i]->status==STEALING) continue;
+        while (true) {
+          VertexId b_i = __sync_fetch_and_add(&thread_state[t_i]->curr, basic_chunk);
+          if (b_i >= thread_state[t_i]->end) break;
+          steal_chunks += 1;
+          VertexId begin_b_i = b_i;
+          VertexId end_b_i = b_i + basic_chunk;
+          if (end_b_i>thread_state[t_i]->end) {
+            end_b_i = thread_state[t_i]->end;
+          }
+          int s_i = get_socket_id(t_i);
+          for (b_i=begin_b_i;b_i<end_b_i;b_i++) {
+            VertexId v_i = buffer[b_i].vertex;
+            M msg_data = buffer[b_i].msg_data;
+            if (outgoing_adj_bitmap[s_i]->get_bit(v_i)) {
+              local_reducer += sparse_slot(v_i, msg_data, get_adj_list(outgoing_adj_list[s_i], outgoing_adj_index[s_i][v_i], outgoing_adj_index[s_i][v_i+1], thread_id));
             }
-            v_i++;
-            word = word >> 1;
           }
         }
       }
-      reducer += local_reducer;
-    }
-    R global_reducer;
-    MPI_Datatype dt = get_mpi_data_type<R>();
-    MPI_Allreduce(&reducer, &global_reducer, 1, dt, MPI_SUM, MPI_COMM_WORLD);
-    stream_time += MPI_Wtime();
-    #ifdef PRINT_DEBUG_MESSAGES
-    if (partition_id==0) {
-      printf("process_vertices took %lf (s)\n", stream_time);
-    }
-    #endif
-    return global_reducer;
-  }
-
-  template<typename M>
-  void flush_local_send_buffer(int t_i) {
-    int s_i = get_socket_id(t_i);
-    int pos = __sync_fetch_and_add(&send_buffer[current_send_part_id][s_i]->count, local_send_buffer[t_i]->count);
-    memcpy(send_buffer[current_send_part_id][s_i]->data + sizeof(MsgUnit<M>) * pos, local_send_buffer[t_i]->data, sizeof(MsgUnit<M>) * local_send_buffer[t_i]->count);
-    local_send_buffer[t_i]->count = 0;
-  }
-
-  // emit a message to a vertex's master (dense) / mirror (sparse)
-  template<typename M>
-  void emit(VertexId vtx, M msg) {
-    int t_i = omp_get_thread_num();
-    MsgUnit<M> * buffer = (MsgUnit<M>*)local_send_buffer[t_i]->data;
-    buffer[local_send_buffer[t_i]->count].vertex = vtx;
-    buffer[local_send_buffer[t_i]->count].msg_data = msg;
-    local_send_buffer[t_i]->count += 1;
-    if (local_send_buffer[t_i]->count==local_send_buffer_limit) {
-      flush_local_send_buffer<M>(t_i);
+      slot_reducer += local_reducer;
+      if (metrics.enabled()) {
+        call_metrics.work_chunks[thread_id] += work_chunks;
+        call_metrics.steal_chunks[thread_id] += steal_chunks;
+      }
     }
+    return slot_reducer;
   }
 
   // process edges
-  template<typename R, typename M>
-  R process_edges(std::function<void(VertexId)> sparse_signal, std::function<R(VertexId, M, VertexAdjList<EdgeData>)> sparse_slot, std::function<void(VertexId, VertexAdjList<EdgeData>)> dense_signal, std::function<R(VertexId, M)> dense_slot, Bitmap * active, Bitmap * dense_selective = nullptr) {
+  // sparse_signal: void(VertexId), sparse_slot: R(VertexId, M, VertexAdjList<EdgeData>),
+  // dense_signal: void(VertexId, VertexAdjList<EdgeData>), dense_slot: R(VertexId, M);
+  // any callables (lambdas, or std::function objects as before) so that they can be inlined into the loops;
+  // dense_selective: optional, the vertices (e.g. already visited ones) dense_signal is not called for;
+  // combine: optional M(M, M), associative and commutative, merging dense-mode messages to the same vertex
+  // before they are sent, which requires dense_slot(v, combine(a, b)) to be equivalent to both slots
+  template<typename R, typename M, typename SparseSignal, typename SparseSlot, typename DenseSignal, typename DenseSlot, typename Combine = std::nullptr_t>
+  R process_edges(SparseSignal sparse_signal, SparseSlot sparse_slot, DenseSignal dense_signal, DenseSlot dense_slot, Bitmap * active, Bitmap * dense_selective = nullptr, Combine combine = nullptr) {
     double stream_time = 0;
     stream_time -= MPI_Wtime();
 
+    in_process_edges = true;
+    CallMetrics call_metrics;
+    if (metrics.enabled()) {
+      call_metrics.reset(partitions, threads);
+      call_metrics.call = "process_edges";
+      count_active_metrics(active, call_metrics);
+    }
+
     for (int t_i=0;t_i<threads;t_i++) {
       local_send_buffer[t_i]->resize( sizeof(MsgUnit<M>) * local_send_buffer_limit );
       local_send_buffer[t_i]->count = 0;
@@ -1505,173 +4199,242 @@ public:
       },
       active
     );
-    bool sparse = (active_edges < edges / 20);
-    if (sparse) {
+    bool sparse = select_sparse_mode(active, dense_selective, active_edges);
+    call_metrics.mode = sparse ? "sparse" : "dense";
+    if (node_messages) {
+      alloc_node_message_window(sizeof(MsgUnit<M>));
+    }
+    // point send_buffer[i] to send_buffer_sets[set] (or to the node message window), with room for the messages of a whole step
+    std::vector<int> send_set(partitions);
+    auto assign_send_buffers = [&](int i, int set) {
+      size_t units = sparse ? owned_vertices * sockets : (partition_offset[i+1] - partition_offset[i]) * sockets + hub_split_replicas;
+      send_set[i] = set;
+      if (node_messages) {
+        assign_node_send_buffers<M>(sparse, i, units);
+        return;
+      }
+      send_buffer[i] = send_buffer_sets[set];
+      for (int s_i=0;s_i<sockets;s_i++) {
+        send_buffer[i][s_i]->resize( sizeof(MsgUnit<M>) * units );
+        send_buffer[i][s_i]->count = 0;
+      }
+    };
+    // with a message budget, the dense steps share as many send buffer sets as fit in it, waiting for the send thread to
+    // free one after sending a partition; streaming posts from all send buffers at once and is not limited
+    int send_sets = sparse ? 1 : partitions;
+    bool flow_control = false;
+    if (!sparse && message_budget > 0 && stream_chunk_bytes==0) {
+      size_t set_bytes = 0;
       for (int i=0;i<partitions;i++) {
-        for (int s_i=0;s_i<sockets;s_i++) {
-          recv_buffer[i][s_i]->resize( sizeof(MsgUnit<M>) * (partition_offset[i+1] - partition_offset[i]) * sockets );
-          send_buffer[i][s_i]->resize( sizeof(MsgUnit<M>) * owned_vertices * sockets );
-          send_buffer[i][s_i]->count = 0;
-          recv_buffer[i][s_i]->count = 0;
-        }
+        set_bytes = std::max(set_bytes, sizeof(MsgUnit<M>) * ((partition_offset[i+1] - partition_offset[i]) * sockets + hub_split_replicas) * sockets);
       }
+      send_sets = std::max((size_t)1, std::min((size_t)partitions, message_budget / set_bytes));
+      flow_control = send_sets < partitions;
+    }
+    SpscQueue<int> free_send_sets(partitions);
+    if (flow_control) {
+      for (int set=0;set<send_sets;set++) {
+        free_send_sets.push(set);
+      }
+    } else if (sparse) {
+      assign_send_buffers(partition_id, 0);
     } else {
+      for (int i=0;i<partitions;i++) {
+        assign_send_buffers(i, i);
+      }
+    }
+    // batches are received into buffers grown to their size; streamed chunks are appended while the slots run
+    for (int i=0;i<partitions;i++) {
+      for (int s_i=0;s_i<sockets;s_i++) {
+        if (stream_chunk_bytes > 0) {
+          recv_buffer[i][s_i]->resize( sizeof(MsgUnit<M>) * (sparse ? (partition_offset[i+1] - partition_offset[i]) * sockets : owned_vertices * sockets + hub_split_replicas) );
+        }
+        recv_buffer[i][s_i]->count = 0;
+      }
+    }
+    stream_chunk = 0;
+    if (stream_chunk_bytes > 0 && partitions > 1) {
+      stream_chunk = std::max((size_t)1, stream_chunk_bytes / sizeof(MsgUnit<M>));
+      size_t capacity = 0;
       for (int i=0;i<partitions;i++) {
         for (int s_i=0;s_i<sockets;s_i++) {
-          recv_buffer[i][s_i]->resize( sizeof(MsgUnit<M>) * owned_vertices * sockets );
-          send_buffer[i][s_i]->resize( sizeof(MsgUnit<M>) * (partition_offset[i+1] - partition_offset[i]) * sockets );
-          send_buffer[i][s_i]->count = 0;
-          recv_buffer[i][s_i]->count = 0;
+          capacity = std::max(capacity, send_buffer[i][s_i]->capacity / sizeof(MsgUnit<M>));
         }
       }
+      stream_chunks = capacity / stream_chunk + 1;
+      stream_filled.assign(partitions * sockets * stream_chunks, 0);
     }
     size_t basic_chunk = 64;
+    // node leaders pass the batches between nodes
+    std::thread node_leader_thread;
+    if (node_messages && node_rank==0 && node_members.size() > 1) {
+      node_leader_thread = std::thread([&](){
+        bind_comm_thread();
+        std::thread deliver_thread([&](){
+          bind_comm_thread();
+          deliver_node_batches<M>();
+        });
+        forward_node_batches<M>(sparse, call_metrics);
+        deliver_thread.join();
+      });
+    }
     if (sparse) {
       #ifdef PRINT_DEBUG_MESSAGES
       if (partition_id==0) {
         printf("sparse mode\n");
       }
       #endif
-      int * recv_queue = new int [partitions];
-      int recv_queue_size = 0;
-      std::mutex recv_queue_mutex;
+      SpscQueue<int> send_queue(partitions);
+      SpscQueue<int> recv_queue(partitions);
+      SpscQueue<StreamChunk> stream_queue(partitions * sockets * 16);
+      std::vector<MPI_Request> stream_requests;
+
+      // run sparse_slot on the messages [slot_begin[s_i], slot_end[s_i]) of each used_buffer[s_i]
+      auto process_sparse_slots = [&](MessageBuffer ** used_buffer, VertexId * slot_begin, VertexId * slot_end) {
+        for (int s_i=0;s_i<sockets;s_i++) {
+          reducer += run_sparse_slots<R,M>(sparse_slot, (MsgUnit<M> *)used_buffer[s_i]->data, slot_begin[s_i], slot_end[s_i], call_metrics);
+        }
+      };
+
+      std::thread send_thread;
+      std::thread recv_thread;
+      if (stream_chunk > 0) {
+        // chunks are sent to all peers while the signals are still filling the send buffers
+        send_thread = std::thread([&](){
+          bind_comm_thread();
+          std::vector<size_t> posted(sockets, 0);
+          while (true) {
+            int i;
+            bool finished = send_queue.try_pop(i);
+            for (int s_i=0;s_i<sockets;s_i++) {
+              post_stream_chunks<M>(partition_id, s_i, posted[s_i], finished, -1, stream_requests, call_metrics);
+            }
+            if (finished) break;
+            std::this_thread::yield(); // the chunk counters can only be polled
+          }
+          call_metrics.send_time -= MPI_Wtime();
+          MPI_Waitall(stream_requests.size(), stream_requests.data(), MPI_STATUSES_IGNORE);
+          call_metrics.send_time += MPI_Wtime();
+        });
+        recv_thread = std::thread([&](){
+          bind_comm_thread();
+          recv_stream_chunks<M>(partitions - 1, stream_queue);
+        });
+      }
 
       current_send_part_id = partition_id;
+      call_metrics.signal_time -= MPI_Wtime();
       #pragma omp parallel for
       for (VertexId begin_v_i=partition_offset[partition_id];begin_v_i<partition_offset[partition_id+1];begin_v_i+=basic_chunk) {
-        VertexId v_i = begin_v_i;
-        unsigned long word = active->data[WORD_OFFSET(v_i)];
-        while (word != 0) {
-          if (word & 1) {
-            sparse_signal(v_i);
-          }
-          v_i++;
-          word = word >> 1;
-        }
+        unsigned long word = active->data[WORD_OFFSET(begin_v_i)];
+        for_each_bit(word, begin_v_i, [&](VertexId vtx) {
+          sparse_signal(vtx);
+        });
       }
+      call_metrics.signal_time += MPI_Wtime();
+      call_metrics.flush_time -= MPI_Wtime();
       #pragma omp parallel for
       for (int t_i=0;t_i<threads;t_i++) {
         flush_local_send_buffer<M>(t_i);
       }
-      recv_queue[recv_queue_size] = partition_id;
-      recv_queue_mutex.lock();
-      recv_queue_size += 1;
-      recv_queue_mutex.unlock();
-      std::thread send_thread([&](){
-        for (int step=1;step<partitions;step++) {
-          int i = (partition_id - step + partitions) % partitions;
-          for (int s_i=0;s_i<sockets;s_i++) {
-            MPI_Send(send_buffer[partition_id][s_i]->data, sizeof(MsgUnit<M>) * send_buffer[partition_id][s_i]->count, MPI_CHAR, i, PassMessage, MPI_COMM_WORLD);
-          }
-        }
-      });
-      std::thread recv_thread([&](){
-        for (int step=1;step<partitions;step++) {
-          int i = (partition_id + step) % partitions;
-          for (int s_i=0;s_i<sockets;s_i++) {
-            MPI_Status recv_status;
-            MPI_Probe(i, PassMessage, MPI_COMM_WORLD, &recv_status);
-            MPI_Get_count(&recv_status, MPI_CHAR, &recv_buffer[i][s_i]->count);
-            MPI_Recv(recv_buffer[i][s_i]->data, recv_buffer[i][s_i]->count, MPI_CHAR, i, PassMessage, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
-            recv_buffer[i][s_i]->count /= sizeof(MsgUnit<M>);
-          }
-          recv_queue[recv_queue_size] = i;
-          recv_queue_mutex.lock();
-          recv_queue_size += 1;
-          recv_queue_mutex.unlock();
-        }
-      });
-      for (int step=0;step<partitions;step++) {
-        while (true) {
-          recv_queue_mutex.lock();
-          bool condition = (recv_queue_size<=step);
-          recv_queue_mutex.unlock();
-          if (!condition) break;
-          __asm volatile ("pause" ::: "memory");
+      call_metrics.flush_time += MPI_Wtime();
+      if (stream_chunk > 0) {
+        send_queue.push(partition_id);
+        std::vector<VertexId> slot_begin(sockets, 0);
+        std::vector<VertexId> slot_end(sockets);
+        for (int s_i=0;s_i<sockets;s_i++) {
+          slot_end[s_i] = send_buffer[partition_id][s_i]->count;
         }
-        int i = recv_queue[step];
-        MessageBuffer ** used_buffer;
-        if (i==partition_id) {
-          used_buffer = send_buffer[i];
+        call_metrics.slot_time -= MPI_Wtime();
+        process_sparse_slots(send_buffer[partition_id], slot_begin.data(), slot_end.data());
+        call_metrics.slot_time += MPI_Wtime();
+        process_stream_chunks(process_sparse_slots, stream_queue, call_metrics);
+      } else {
+        recv_queue.push(partition_id);
+        if (node_messages) {
+          send_thread = std::thread([&](){
+            bind_comm_thread();
+            call_metrics.send_time -= MPI_Wtime();
+            post_node_batches<M>(-1);
+            call_metrics.send_time += MPI_Wtime();
+          });
+          recv_thread = std::thread([&](){
+            bind_comm_thread();
+            recv_node_batches<M>(recv_queue);
+          });
         } else {
-          used_buffer = recv_buffer[i];
-        }
-        for (int s_i=0;s_i<sockets;s_i++) {
-          MsgUnit<M> * buffer = (MsgUnit<M> *)used_buffer[s_i]->data;
-          size_t buffer_size = used_buffer[s_i]->count;
-          for (int t_i=0;t_i<threads;t_i++) {
-            // int s_i = get_socket_id(t_i);
-            int s_j = get_socket_offset(t_i);
-            VertexId partition_size = buffer_size;
-            thread_state[t_i]->curr = partition_size / threads_per_socket  / basic_chunk * basic_chunk * s_j;
-            thread_state[t_i]->end = partition_size / threads_per_socket / basic_chunk * basic_chunk * (s_j+1);
-            if (s_j == threads_per_socket - 1) {
-              thread_state[t_i]->end = buffer_size;
-            }
-            thread_state[t_i]->status = WORKING;
-          }
-          #pragma omp parallel reduction(+:reducer)
-          {
-            R local_reducer = 0;
-            int thread_id = omp_get_thread_num();
-            int s_i = get_socket_id(thread_id);
-            while (true) {
-              VertexId b_i = __sync_fetch_and_add(&thread_state[thread_id]->curr, basic_chunk);
-              if (b_i >= thread_state[thread_id]->end) break;
-              VertexId begin_b_i = b_i;
-              VertexId end_b_i = b_i + basic_chunk;
-              if (end_b_i>thread_state[thread_id]->end) {
-                end_b_i = thread_state[thread_id]->end;
+          send_thread = std::thread([&](){
+            bind_comm_thread();
+            call_metrics.send_time -= MPI_Wtime();
+            if (wire_adaptive && partitions > 1) {
+              // every peer gets the same batches, so they are encoded once
+              for (int s_i=0;s_i<sockets;s_i++) {
+                encode_messages<M>(send_buffer[partition_id][s_i], partition_offset[partition_id], owned_vertices, wire_send_buffer[s_i]);
               }
-              for (b_i=begin_b_i;b_i<end_b_i;b_i++) {
-                VertexId v_i = buffer[b_i].vertex;
-                M msg_data = buffer[b_i].msg_data;
-                if (outgoing_adj_bitmap[s_i]->get_bit(v_i)) {
-                  local_reducer += sparse_slot(v_i, msg_data, VertexAdjList<EdgeData>(outgoing_adj_list[s_i] + outgoing_adj_index[s_i][v_i], outgoing_adj_list[s_i] + outgoing_adj_index[s_i][v_i+1]));
+            }
+            for (int step=1;step<partitions;step++) {
+              int i = (partition_id - step + partitions) % partitions;
+              for (int s_i=0;s_i<sockets;s_i++) {
+                size_t bytes = send_messages<M>(send_buffer[partition_id][s_i], wire_adaptive ? wire_send_buffer[s_i] : NULL, i);
+                if (metrics.enabled()) {
+                  call_metrics.sent_bytes[i] += bytes;
                 }
               }
             }
-            thread_state[thread_id]->status = STEALING;
-            for (int t_offset=1;t_offset<threads;t_offset++) {
-              int t_i = (thread_id + t_offset) % threads;
-              if (thread_state[t_i]->status==STEALING) continue;
-              while (true) {
-                VertexId b_i = __sync_fetch_and_add(&thread_state[t_i]->curr, basic_chunk);
-                if (b_i >= thread_state[t_i]->end) break;
-                VertexId begin_b_i = b_i;
-                VertexId end_b_i = b_i + basic_chunk;
-                if (end_b_i>thread_state[t_i]->end) {
-                  end_b_i = thread_state[t_i]->end;
-                }
-                int s_i = get_socket_id(t_i);
-                for (b_i=begin_b_i;b_i<end_b_i;b_i++) {
-                  VertexId v_i = buffer[b_i].vertex;
-                  M msg_data = buffer[b_i].msg_data;
-                  if (outgoing_adj_bitmap[s_i]->get_bit(v_i)) {
-                    local_reducer += sparse_slot(v_i, msg_data, VertexAdjList<EdgeData>(outgoing_adj_list[s_i] + outgoing_adj_index[s_i][v_i], outgoing_adj_list[s_i] + outgoing_adj_index[s_i][v_i+1]));
-                  }
-                }
+            call_metrics.send_time += MPI_Wtime();
+          });
+          recv_thread = std::thread([&](){
+            bind_comm_thread();
+            for (int step=1;step<partitions;step++) {
+              int i = (partition_id + step) % partitions;
+              for (int s_i=0;s_i<sockets;s_i++) {
+                recv_messages<M>(recv_buffer[i][s_i], partition_offset[i], i);
               }
+              recv_queue.push(i);
             }
-            reducer += local_reducer;
+          });
+        }
+        for (int step=0;step<partitions;step++) {
+          call_metrics.recv_wait_time -= MPI_Wtime();
+          int i = recv_queue.pop();
+          call_metrics.recv_wait_time += MPI_Wtime();
+          call_metrics.slot_time -= MPI_Wtime();
+          MessageBuffer ** used_buffer;
+          if (i==partition_id) {
+            used_buffer = send_buffer[i];
+          } else if (node_messages) {
+            used_buffer = node_recv_buffer[i];
+          } else {
+            used_buffer = recv_buffer[i];
           }
+          std::vector<VertexId> slot_begin(sockets, 0);
+          std::vector<VertexId> slot_end(sockets);
+          for (int s_i=0;s_i<sockets;s_i++) {
+            slot_end[s_i] = used_buffer[s_i]->count;
+          }
+          process_sparse_slots(used_buffer, slot_begin.data(), slot_end.data());
+          call_metrics.slot_time += MPI_Wtime();
         }
       }
       send_thread.join();
       recv_thread.join();
-      delete [] recv_queue;
     } else {
       // dense selective bitmap
       if (dense_selective!=nullptr && partitions>1) {
         double sync_time = 0;
         sync_time -= get_time();
         std::thread send_thread([&](){
+          bind_comm_thread();
           for (int step=1;step<partitions;step++) {
             int recipient_id = (partition_id + step) % partitions;
             MPI_Send(dense_selective->data + WORD_OFFSET(partition_offset[partition_id]), (owned_vertices + 63) / 64, MPI_UNSIGNED_LONG, recipient_id, PassMessage, MPI_COMM_WORLD);
+            if (metrics.enabled()) {
+              call_metrics.sent_bytes[recipient_id] += sizeof(unsigned long) * ((owned_vertices + 63) / 64);
+            }
           }
         });
         std::thread recv_thread([&](){
+          bind_comm_thread();
           for (int step=1;step<partitions;step++) {
             int sender_id = (partition_id - step + partitions) % partitions;
             MPI_Recv(dense_selective->data + WORD_OFFSET(partition_offset[sender_id]), (partition_offset[sender_id + 1] - partition_offset[sender_id] + 63) / 64, MPI_UNSIGNED_LONG, sender_id, PassMessage, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
@@ -1681,6 +4444,7 @@ public:
         recv_thread.join();
         MPI_Barrier(MPI_COMM_WORLD);
         sync_time += get_time();
+        call_metrics.send_time += sync_time;
         #ifdef PRINT_DEBUG_MESSAGES
         if (partition_id==0) {
           printf("sync_time = %lf\n", sync_time);
@@ -1692,81 +4456,157 @@ public:
         printf("dense mode\n");
       }
       #endif
-      int * send_queue = new int [partitions];
-      int * recv_queue = new int [partitions];
-      volatile int send_queue_size = 0;
-      volatile int recv_queue_size = 0;
-      std::mutex send_queue_mutex;
-      std::mutex recv_queue_mutex;
-
-      std::thread send_thread([&](){
-        for (int step=0;step<partitions;step++) {
-          if (step==partitions-1) {
-            break;
-          }
-          while (true) {
-            send_queue_mutex.lock();
-            bool condition = (send_queue_size<=step);
-            send_queue_mutex.unlock();
-            if (!condition) break;
-            __asm volatile ("pause" ::: "memory");
+      SpscQueue<int> send_queue(partitions);
+      SpscQueue<int> recv_queue(partitions);
+
+      SpscQueue<StreamChunk> stream_queue(partitions * sockets * 16);
+      std::vector<MPI_Request> stream_requests;
+
+      std::thread send_thread;
+      std::thread recv_thread;
+      if (stream_chunk > 0) {
+        // the chunks of each partition are sent while its signals are still filling the send buffers
+        send_thread = std::thread([&](){
+          bind_comm_thread();
+          for (int step=0;step<partitions-1;step++) {
+            int i = (partition_id + 1 + step) % partitions;
+            std::vector<size_t> posted(sockets, 0);
+            while (true) {
+              int j;
+              bool finished = send_queue.try_pop(j);
+              assert(!finished || j==i);
+              for (int s_i=0;s_i<sockets;s_i++) {
+                post_stream_chunks<M>(i, s_i, posted[s_i], finished, i, stream_requests, call_metrics);
+              }
+              if (finished) break;
+              std::this_thread::yield();
+            }
           }
-          int i = send_queue[step];
-          for (int s_i=0;s_i<sockets;s_i++) {
-            MPI_Send(send_buffer[i][s_i]->data, sizeof(MsgUnit<M>) * send_buffer[i][s_i]->count, MPI_CHAR, i, PassMessage, MPI_COMM_WORLD);
+          call_metrics.send_time -= MPI_Wtime();
+          MPI_Waitall(stream_requests.size(), stream_requests.data(), MPI_STATUSES_IGNORE);
+          call_metrics.send_time += MPI_Wtime();
+        });
+        recv_thread = std::thread([&](){
+          bind_comm_thread();
+          recv_stream_chunks<M>(partitions - 1, stream_queue);
+        });
+      } else if (node_messages) {
+        send_thread = std::thread([&](){
+          bind_comm_thread();
+          for (int step=0;step<partitions-1;step++) {
+            int i = send_queue.pop();
+            call_metrics.send_time -= MPI_Wtime();
+            post_node_batches<M>(i);
+            call_metrics.send_time += MPI_Wtime();
           }
-        }
-      });
-      std::thread recv_thread([&](){
-        std::vector<std::thread> threads;
-        for (int step=1;step<partitions;step++) {
-          int i = (partition_id - step + partitions) % partitions;
-          threads.emplace_back([&](int i){
+        });
+        recv_thread = std::thread([&](){
+          bind_comm_thread();
+          recv_node_batches<M>(recv_queue);
+          recv_queue.push(partition_id);
+        });
+      } else {
+        send_thread = std::thread([&](){
+          bind_comm_thread();
+          for (int step=0;step<partitions;step++) {
+            if (step==partitions-1) {
+              break;
+            }
+            int i = send_queue.pop();
+            double send_time = 0;
+            send_time -= MPI_Wtime();
             for (int s_i=0;s_i<sockets;s_i++) {
-              MPI_Status recv_status;
-              MPI_Probe(i, PassMessage, MPI_COMM_WORLD, &recv_status);
-              MPI_Get_count(&recv_status, MPI_CHAR, &recv_buffer[i][s_i]->count);
-              MPI_Recv(recv_buffer[i][s_i]->data, recv_buffer[i][s_i]->count, MPI_CHAR, i, PassMessage, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
-              recv_buffer[i][s_i]->count /= sizeof(MsgUnit<M>);
+              if (wire_adaptive) {
+                encode_messages<M>(send_buffer[i][s_i], partition_offset[i], partition_offset[i+1] - partition_offset[i], wire_send_buffer[s_i]);
+              }
+              size_t bytes = send_messages<M>(send_buffer[i][s_i], wire_adaptive ? wire_send_buffer[s_i] : NULL, i);
+              if (metrics.enabled()) {
+                call_metrics.sent_bytes[i] += bytes;
+              }
             }
-          }, i);
-        }
-        for (int step=1;step<partitions;step++) {
-          int i = (partition_id - step + partitions) % partitions;
-          threads[step-1].join();
-          recv_queue[recv_queue_size] = i;
-          recv_queue_mutex.lock();
-          recv_queue_size += 1;
-          recv_queue_mutex.unlock();
-        }
-        recv_queue[recv_queue_size] = partition_id;
-        recv_queue_mutex.lock();
-        recv_queue_size += 1;
-        recv_queue_mutex.unlock();
-      });
+            send_time += MPI_Wtime();
+            call_metrics.send_time += send_time;
+            if (flow_control) {
+              free_send_sets.push(send_set[i]);
+            }
+          }
+        });
+        recv_thread = std::thread([&](){
+          bind_comm_thread();
+          std::vector<std::thread> threads;
+          for (int step=1;step<partitions;step++) {
+            int i = (partition_id - step + partitions) % partitions;
+            threads.emplace_back([&](int i){
+              bind_comm_thread();
+              for (int s_i=0;s_i<sockets;s_i++) {
+                recv_messages<M>(recv_buffer[i][s_i], partition_offset[partition_id], i);
+              }
+            }, i);
+          }
+          for (int step=1;step<partitions;step++) {
+            int i = (partition_id - step + partitions) % partitions;
+            threads[step-1].join();
+            recv_queue.push(i);
+          }
+          recv_queue.push(partition_id);
+        });
+      }
+      // run dense_signal on the entries [begin_p_v_i, end_p_v_i) of the compressed incoming index of socket s_i,
+      // skipping the vertices in dense_selective (a whole 64-vertex word at a time if it is full, by binary search)
+      unsigned long * selective = dense_selective==nullptr ? nullptr : dense_selective->data;
+      auto process_dense_signals = [&](int s_i, VertexId begin_p_v_i, VertexId end_p_v_i, int thread_id) {
+        CompressedAdjIndexUnit * index = compressed_incoming_adj_index[s_i];
+        for (VertexId p_v_i = begin_p_v_i; p_v_i < end_p_v_i; p_v_i ++) {
+          VertexId v_i = index[p_v_i].vertex;
+          if (selective!=nullptr) {
+            unsigned long word = selective[WORD_OFFSET(v_i)];
+            if (word==~0ul) {
+              // jump to the last entry of the word; the entries are sorted by vertex
+              VertexId word_end = (WORD_OFFSET(v_i) + 1) << 6;
+              p_v_i = std::lower_bound(index + p_v_i + 1, index + end_p_v_i, word_end, [](const CompressedAdjIndexUnit & unit, VertexId vertex){
+                return unit.vertex < vertex;
+              }) - index - 1;
+              continue;
+            }
+            if (word & (1ul << BIT_OFFSET(v_i))) continue;
+          }
+          dense_signal(v_i, get_adj_list(incoming_adj_list[s_i], index[p_v_i].index, index[p_v_i+1].index, thread_id));
+        }
+      };
       current_send_part_id = partition_id;
+      prefetch_dense_adj_lists((partition_id + 1) % partitions);
       for (int step=0;step<partitions;step++) {
         current_send_part_id = (current_send_part_id + 1) % partitions;
         int i = current_send_part_id;
+        if (step + 1 < partitions) {
+          prefetch_dense_adj_lists((i + 1) % partitions);
+        }
+        if (flow_control) {
+          call_metrics.buffer_wait_time -= MPI_Wtime();
+          int set = free_send_sets.pop();
+          call_metrics.buffer_wait_time += MPI_Wtime();
+          assign_send_buffers(i, set);
+        }
         for (int t_i=0;t_i<threads;t_i++) {
           *thread_state[t_i] = tuned_chunks_dense[i][t_i];
         }
+        call_metrics.signal_time -= MPI_Wtime();
         #pragma omp parallel
         {
           int thread_id = omp_get_thread_num();
           int s_i = get_socket_id(thread_id);
+          unsigned long work_chunks = 0;
+          unsigned long steal_chunks = 0;
           VertexId final_p_v_i = thread_state[thread_id]->end;
           while (true) {
             VertexId begin_p_v_i = __sync_fetch_and_add(&thread_state[thread_id]->curr, basic_chunk);
             if (begin_p_v_i >= final_p_v_i) break;
+            work_chunks += 1;
             VertexId end_p_v_i = begin_p_v_i + basic_chunk;
             if (end_p_v_i > final_p_v_i) {
               end_p_v_i = final_p_v_i;
             }
-            for (VertexId p_v_i = begin_p_v_i; p_v_i < end_p_v_i; p_v_i ++) {
-              VertexId v_i = compressed_incoming_adj_index[s_i][p_v_i].vertex;
-              dense_signal(v_i, VertexAdjList<EdgeData>(incoming_adj_list[s_i] + compressed_incoming_adj_index[s_i][p_v_i].index, incoming_adj_list[s_i] + compressed_incoming_adj_index[s_i][p_v_i+1].index));
-            }
+            process_dense_signals(s_i, begin_p_v_i, end_p_v_i, thread_id);
           }
           thread_state[thread_id]->status = STEALING;
           for (int t_offset=1;t_offset<threads;t_offset++) {
@@ -1775,63 +4615,59 @@ public:
             while (thread_state[t_i]->status!=STEALING) {
               VertexId begin_p_v_i = __sync_fetch_and_add(&thread_state[t_i]->curr, basic_chunk);
               if (begin_p_v_i >= thread_state[t_i]->end) break;
+              steal_chunks += 1;
               VertexId end_p_v_i = begin_p_v_i + basic_chunk;
               if (end_p_v_i > thread_state[t_i]->end) {
                 end_p_v_i = thread_state[t_i]->end;
               }
-              for (VertexId p_v_i = begin_p_v_i; p_v_i < end_p_v_i; p_v_i ++) {
-                VertexId v_i = compressed_incoming_adj_index[s_i][p_v_i].vertex;
-                dense_signal(v_i, VertexAdjList<EdgeData>(incoming_adj_list[s_i] + compressed_incoming_adj_index[s_i][p_v_i].index, incoming_adj_list[s_i] + compressed_incoming_adj_index[s_i][p_v_i+1].index));
-              }
+              process_dense_signals(s_i, begin_p_v_i, end_p_v_i, thread_id);
             }
           }
+          if (metrics.enabled()) {
+            call_metrics.work_chunks[thread_id] += work_chunks;
+            call_metrics.steal_chunks[thread_id] += steal_chunks;
+          }
         }
+        call_metrics.signal_time += MPI_Wtime();
+        call_metrics.flush_time -= MPI_Wtime();
         #pragma omp parallel for
         for (int t_i=0;t_i<threads;t_i++) {
           flush_local_send_buffer<M>(t_i);
         }
+        if (stream_chunk==0) {
+          // streamed chunks may already be on their way
+          combine_dense_messages<M>(i, combine);
+        }
+        call_metrics.flush_time += MPI_Wtime();
         if (i!=partition_id) {
-          send_queue[send_queue_size] = i;
-          send_queue_mutex.lock();
-          send_queue_size += 1;
-          send_queue_mutex.unlock();
+          send_queue.push(i);
         }
       }
-      for (int step=0;step<partitions;step++) {
-        while (true) {
-          recv_queue_mutex.lock();
-          bool condition = (recv_queue_size<=step);
-          recv_queue_mutex.unlock();
-          if (!condition) break;
-          __asm volatile ("pause" ::: "memory");
-        }
-        int i = recv_queue[step];
-        MessageBuffer ** used_buffer;
-        if (i==partition_id) {
-          used_buffer = send_buffer[i];
-        } else {
-          used_buffer = recv_buffer[i];
-        }
+      // run dense_slot on the messages [slot_begin[s_i], slot_end[s_i]) of each used_buffer[s_i], by the threads of socket s_i
+      auto process_dense_slots = [&](MessageBuffer ** used_buffer, VertexId * slot_begin, VertexId * slot_end) {
         for (int t_i=0;t_i<threads;t_i++) {
           int s_i = get_socket_id(t_i);
           int s_j = get_socket_offset(t_i);
-          VertexId partition_size = used_buffer[s_i]->count;
-          thread_state[t_i]->curr = partition_size / threads_per_socket  / basic_chunk * basic_chunk * s_j;
-          thread_state[t_i]->end = partition_size / threads_per_socket / basic_chunk * basic_chunk * (s_j+1);
+          VertexId partition_size = slot_end[s_i] - slot_begin[s_i];
+          thread_state[t_i]->curr = slot_begin[s_i] + partition_size / threads_per_socket  / basic_chunk * basic_chunk * s_j;
+          thread_state[t_i]->end = slot_begin[s_i] + partition_size / threads_per_socket / basic_chunk * basic_chunk * (s_j+1);
           if (s_j == threads_per_socket - 1) {
-            thread_state[t_i]->end = used_buffer[s_i]->count;
+            thread_state[t_i]->end = slot_end[s_i];
           }
           thread_state[t_i]->status = WORKING;
         }
-        #pragma omp parallel reduction(+:reducer)
+        R slot_reducer = 0;
+        #pragma omp parallel reduction(+:slot_reducer)
         {
           R local_reducer = 0;
           int thread_id = omp_get_thread_num();
           int s_i = get_socket_id(thread_id);
           MsgUnit<M> * buffer = (MsgUnit<M> *)used_buffer[s_i]->data;
+          unsigned long work_chunks = 0;
           while (true) {
             VertexId b_i = __sync_fetch_and_add(&thread_state[thread_id]->curr, basic_chunk);
             if (b_i >= thread_state[thread_id]->end) break;
+            work_chunks += 1;
             VertexId begin_b_i = b_i;
             VertexId end_b_i = b_i + basic_chunk;
             if (end_b_i>thread_state[thread_id]->end) {
@@ -1844,19 +4680,74 @@ public:
             }
           }
           thread_state[thread_id]->status = STEALING;
-          reducer += local_reducer;
+          slot_reducer += local_reducer;
+          if (metrics.enabled()) {
+            call_metrics.work_chunks[thread_id] += work_chunks;
+          }
+        }
+        reducer += slot_reducer;
+      };
+      if (stream_chunk > 0) {
+        std::vector<VertexId> slot_begin(sockets, 0);
+        std::vector<VertexId> slot_end(sockets);
+        for (int s_i=0;s_i<sockets;s_i++) {
+          slot_end[s_i] = send_buffer[partition_id][s_i]->count;
+        }
+        call_metrics.slot_time -= MPI_Wtime();
+        process_dense_slots(send_buffer[partition_id], slot_begin.data(), slot_end.data());
+        call_metrics.slot_time += MPI_Wtime();
+        process_stream_chunks(process_dense_slots, stream_queue, call_metrics);
+      } else {
+        for (int step=0;step<partitions;step++) {
+          call_metrics.recv_wait_time -= MPI_Wtime();
+          int i = recv_queue.pop();
+          call_metrics.recv_wait_time += MPI_Wtime();
+          call_metrics.slot_time -= MPI_Wtime();
+          MessageBuffer ** used_buffer;
+          if (i==partition_id) {
+            used_buffer = send_buffer[i];
+          } else if (node_messages) {
+            used_buffer = node_recv_buffer[i];
+          } else {
+            used_buffer = recv_buffer[i];
+          }
+          std::vector<VertexId> slot_begin(sockets, 0);
+          std::vector<VertexId> slot_end(sockets);
+          for (int s_i=0;s_i<sockets;s_i++) {
+            slot_end[s_i] = used_buffer[s_i]->count;
+          }
+          process_dense_slots(used_buffer, slot_begin.data(), slot_end.data());
+          call_metrics.slot_time += MPI_Wtime();
         }
       }
       send_thread.join();
       recv_thread.join();
-      delete [] send_queue;
-      delete [] recv_queue;
+    }
+    if (node_leader_thread.joinable()) {
+      node_leader_thread.join();
     }
 
     R global_reducer;
     MPI_Datatype dt = get_mpi_data_type<R>();
     MPI_Allreduce(&reducer, &global_reducer, 1, dt, MPI_SUM, MPI_COMM_WORLD);
     stream_time += MPI_Wtime();
+    if (direction_policy==AutoTuned) {
+      // every partition has to fit the same samples to take the same decisions
+      double max_stream_time;
+      MPI_Allreduce(&stream_time, &max_stream_time, 1, MPI_DOUBLE, MPI_MAX, MPI_COMM_WORLD);
+      record_direction_sample(sparse, active_edges, max_stream_time);
+    }
+    size_t held_bytes = message_bytes();
+    peak_message_bytes = std::max(peak_message_bytes, held_bytes);
+    call_metrics.message_bytes = held_bytes;
+    if (message_budget > 0 && held_bytes > message_budget) {
+      trim_message_buffers(send_sets);
+    }
+    in_process_edges = false;
+    if (metrics.enabled()) {
+      call_metrics.total_time = stream_time;
+      metrics.write(call_metrics);
+    }
     #ifdef PRINT_DEBUG_MESSAGES
     if (partition_id==0) {
       printf("process_edges took %lf (s)\n", stream_time);
@@ -1865,6 +4756,191 @@ public:
     return global_reducer;
   }
 
+  // whether a computation with active_vertices (global) active vertices should go on with process_edges_async
+  bool async_frontier(VertexId active_vertices) {
+    return active_vertices > 0 && active_vertices <= vertices * async_threshold;
+  }
+
+  // process edges asynchronously, for monotone updates (e.g. write_min of labels or distances) whose outcome does not
+  // depend on the order the messages are applied in: the vertices of active call sparse_signal, the slots set the bits
+  // of the vertices they improve in activated, and these signal in turn as soon as their partition gets to them, without
+  // waiting for the other partitions; it returns once no partition has active vertices or messages in flight, with
+  // active and activated empty, and gives the sum of the results of all slots.
+  // sparse_signal: void(VertexId), sparse_slot: R(VertexId, M, VertexAdjList<EdgeData>), as in sparse mode;
+  // only owned vertices may be activated, which holds for the destinations of the outgoing edges given to the slots
+  template<typename R, typename M, typename SparseSignal, typename SparseSlot>
+  R process_edges_async(SparseSignal sparse_signal, SparseSlot sparse_slot, Bitmap * active, Bitmap * activated) {
+    assert(loaded_directions!=IncomingOnly);
+    double stream_time = 0;
+    stream_time -= MPI_Wtime();
+
+    in_process_edges = true;
+    CallMetrics call_metrics;
+    if (metrics.enabled()) {
+      call_metrics.reset(partitions, threads);
+      call_metrics.call = "process_edges_async";
+      call_metrics.mode = "async";
+      count_active_metrics(active, call_metrics);
+    }
+
+    for (int t_i=0;t_i<threads;t_i++) {
+      local_send_buffer[t_i]->resize( sizeof(MsgUnit<M>) * local_send_buffer_limit );
+      local_send_buffer[t_i]->count = 0;
+    }
+    send_buffer[partition_id] = send_buffer_sets[0];
+    for (int s_i=0;s_i<sockets;s_i++) {
+      send_buffer[partition_id][s_i]->resize( sizeof(MsgUnit<M>) * owned_vertices * sockets );
+    }
+    stream_chunk = 0;
+    current_send_part_id = partition_id;
+    R reducer = 0;
+
+    // receive and process the batches that have arrived; returns whether there were any
+    long sent_batches = 0;
+    long received_batches = 0;
+    auto receive_batches = [&]() {
+      bool received = false;
+      while (true) {
+        int flag;
+        MPI_Status recv_status;
+        MPI_Iprobe(MPI_ANY_SOURCE, AsyncMessage, MPI_COMM_WORLD, &flag, &recv_status);
+        if (!flag) break;
+        int i = recv_status.MPI_SOURCE;
+        int bytes;
+        MPI_Get_count(&recv_status, MPI_CHAR, &bytes);
+        MessageBuffer * messages = recv_buffer[i][0];
+        messages->resize(bytes);
+        MPI_Recv(messages->data, bytes, MPI_CHAR, i, AsyncMessage, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+        messages->count = bytes / sizeof(MsgUnit<M>);
+        received_batches += 1;
+        received = true;
+        call_metrics.slot_time -= MPI_Wtime();
+        reducer += run_sparse_slots<R,M>(sparse_slot, (MsgUnit<M> *)messages->data, 0, messages->count, call_metrics);
+        call_metrics.slot_time += MPI_Wtime();
+      }
+      return received;
+    };
+
+    // termination: a partition without work takes part in a wave of non-blocking sums of the batches sent and received
+    // so far; when two consecutive waves find them equal and unchanged, every partition sat idle in between while
+    // nothing was in flight (each partition joins a wave only after the one before has completed everywhere)
+    long wave_counts[2];
+    long wave_sums[2];
+    long last_wave_sums[2] = {-1, -1};
+    MPI_Request wave = MPI_REQUEST_NULL;
+    bool pending = true; // whether slots may have activated vertices since the last signal pass
+    std::vector<MPI_Request> send_requests;
+    while (true) {
+      if (pending) {
+        pending = false;
+        for (int s_i=0;s_i<sockets;s_i++) {
+          send_buffer[partition_id][s_i]->count = 0;
+        }
+        VertexId signalled = 0;
+        call_metrics.signal_time -= MPI_Wtime();
+        #pragma omp parallel for reduction(+:signalled)
+        for (VertexId begin_v_i=partition_offset[partition_id];begin_v_i<partition_offset[partition_id+1];begin_v_i+=64) {
+          size_t w_i = WORD_OFFSET(begin_v_i);
+          unsigned long word = active->data[w_i] | activated->data[w_i];
+          if (word==0) continue;
+          active->data[w_i] = 0;
+          activated->data[w_i] = 0;
+          for_each_bit(word, begin_v_i, [&](VertexId vtx) {
+            sparse_signal(vtx);
+            signalled += 1;
+          });
+        }
+        call_metrics.signal_time += MPI_Wtime();
+        if (signalled > 0) {
+          call_metrics.flush_time -= MPI_Wtime();
+          #pragma omp parallel for
+          for (int t_i=0;t_i<threads;t_i++) {
+            flush_local_send_buffer<M>(t_i);
+          }
+          call_metrics.flush_time += MPI_Wtime();
+          call_metrics.send_time -= MPI_Wtime();
+          for (int step=1;step<partitions;step++) {
+            int i = (partition_id + step) % partitions;
+            for (int s_i=0;s_i<sockets;s_i++) {
+              MessageBuffer * messages = send_buffer[partition_id][s_i];
+              if (messages->count==0) continue;
+              send_requests.emplace_back();
+              MPI_Isend(messages->data, sizeof(MsgUnit<M>) * messages->count, MPI_CHAR, i, AsyncMessage, MPI_COMM_WORLD, &send_requests.back());
+              sent_batches += 1;
+              if (metrics.enabled()) {
+                call_metrics.sent_bytes[i] += sizeof(MsgUnit<M>) * messages->count;
+              }
+            }
+          }
+          call_metrics.send_time += MPI_Wtime();
+          call_metrics.slot_time -= MPI_Wtime();
+          for (int s_i=0;s_i<sockets;s_i++) {
+            MessageBuffer * messages = send_buffer[partition_id][s_i];
+            reducer += run_sparse_slots<R,M>(sparse_slot, (MsgUnit<M> *)messages->data, 0, messages->count, call_metrics);
+            pending = pending || messages->count > 0;
+          }
+          call_metrics.slot_time += MPI_Wtime();
+          // the send buffers are refilled by the next pass; meanwhile the incoming batches are processed, which keeps
+          // partitions sending to each other from waiting on one another
+          call_metrics.send_time -= MPI_Wtime();
+          while (true) {
+            int completed;
+            MPI_Testall(send_requests.size(), send_requests.data(), &completed, MPI_STATUSES_IGNORE);
+            if (completed) break;
+            call_metrics.send_time += MPI_Wtime();
+            pending = receive_batches() || pending;
+            call_metrics.send_time -= MPI_Wtime();
+          }
+          call_metrics.send_time += MPI_Wtime();
+          send_requests.clear();
+          continue;
+        }
+      }
+      if (receive_batches()) {
+        pending = true;
+        continue;
+      }
+      call_metrics.recv_wait_time -= MPI_Wtime();
+      if (wave==MPI_REQUEST_NULL) {
+        wave_counts[0] = sent_batches;
+        wave_counts[1] = received_batches;
+        MPI_Iallreduce(wave_counts, wave_sums, 2, MPI_LONG, MPI_SUM, MPI_COMM_WORLD, &wave);
+      }
+      int completed;
+      MPI_Test(&wave, &completed, MPI_STATUS_IGNORE);
+      call_metrics.recv_wait_time += MPI_Wtime();
+      if (completed) {
+        if (wave_sums[0]==wave_sums[1] && wave_sums[0]==last_wave_sums[0] && wave_sums[1]==last_wave_sums[1]) {
+          break;
+        }
+        last_wave_sums[0] = wave_sums[0];
+        last_wave_sums[1] = wave_sums[1];
+      }
+    }
+
+    R global_reducer;
+    MPI_Datatype dt = get_mpi_data_type<R>();
+    MPI_Allreduce(&reducer, &global_reducer, 1, dt, MPI_SUM, MPI_COMM_WORLD);
+    stream_time += MPI_Wtime();
+    size_t held_bytes = message_bytes();
+    peak_message_bytes = std::max(peak_message_bytes, held_bytes);
+    call_metrics.message_bytes = held_bytes;
+    if (message_budget > 0 && held_bytes > message_budget) {
+      trim_message_buffers(1);
+    }
+    in_process_edges = false;
+    if (metrics.enabled()) {
+      call_metrics.total_time = stream_time;
+      metrics.write(call_metrics);
+    }
+    #ifdef PRINT_DEBUG_MESSAGES
+    if (partition_id==0) {
+      printf("process_edges_async took %lf (s), %ld batches sent\n", stream_time, sent_batches);
+    }
+    #endif
+    return global_reducer;
+  }
+
 };
 
 #endif
@@ -0,0 +1,144 @@
+/*
+Copyright (c) 2015-2016 Xiaowei Zhu, Tsinghua University
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#ifndef METRICS_HPP
+#define METRICS_HPP
+
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+
+#include <string>
+#include <vector>
+
+enum MetricsFormat {
+  JsonMetrics, // one JSON object per line
+  CsvMetrics // one row per call after a header row
+};
+
+// the measurements of one engine call on one partition
+struct CallMetrics {
+  const char * call; // "process_edges", "process_edges_async", "process_vertices", "load", "update_edges" or "checkpoint"
+  const char * mode; // "sparse", "dense", "async" or "-"
+  unsigned long active_vertices; // local active vertices
+  unsigned long active_edges; // out-edges of the local active vertices
+  double total_time;
+  double signal_time;
+  double flush_time;
+  double send_time; // time the send thread spent sending
+  double recv_wait_time; // time the computing threads waited for incoming messages
+  double slot_time;
+  double buffer_wait_time; // time the computing threads waited for a free send buffer set (GEMINI_MESSAGE_BUDGET)
+  unsigned long message_bytes; // bytes held by the message buffers at the end of the call
+  std::vector<unsigned long> sent_bytes; // [partitions]
+  std::vector<unsigned long> work_chunks; // [threads]; chunks taken from the thread's own range
+  std::vector<unsigned long> steal_chunks; // [threads]; chunks stolen from other threads
+
+  CallMetrics() {
+    reset(0, 0);
+  }
+  void reset(int partitions, int threads) {
+    call = "";
+    mode = "-";
+    active_vertices = 0;
+    active_edges = 0;
+    total_time = 0;
+    signal_time = 0;
+    flush_time = 0;
+    send_time = 0;
+    recv_wait_time = 0;
+    slot_time = 0;
+    buffer_wait_time = 0;
+    message_bytes = 0;
+    sent_bytes.assign(partitions, 0);
+    work_chunks.assign(threads, 0);
+    steal_chunks.assign(threads, 0);
+  }
+};
+
+// writes one record per engine call to a per-partition file
+class MetricsWriter {
+  FILE * fout;
+  MetricsFormat format;
+  int partition_id;
+  unsigned long records;
+
+  void write_list(const std::vector<unsigned long> & values, const char * separator) {
+    for (size_t i=0;i<values.size();i++) {
+      fprintf(fout, "%s%lu", i==0 ? "" : separator, values[i]);
+    }
+  }
+public:
+  MetricsWriter() {
+    fout = NULL;
+    format = JsonMetrics;
+    partition_id = 0;
+    records = 0;
+  }
+  ~MetricsWriter() {
+    close();
+  }
+  bool enabled() {
+    return fout!=NULL;
+  }
+  // open path.[partition_id]
+  void open(std::string path, MetricsFormat format, int partition_id) {
+    close();
+    this->format = format;
+    this->partition_id = partition_id;
+    records = 0;
+    fout = fopen((path + "." + std::to_string(partition_id)).c_str(), "w");
+    assert(fout!=NULL);
+    if (format==CsvMetrics) {
+      fprintf(fout, "partition,seq,call,mode,active_vertices,active_edges,total_time,signal_time,flush_time,send_time,recv_wait_time,slot_time,buffer_wait_time,message_bytes,sent_bytes,work_chunks,steal_chunks\n");
+    }
+  }
+  void close() {
+    if (fout!=NULL) {
+      fclose(fout);
+      fout = NULL;
+    }
+  }
+  void write(const CallMetrics & metrics) {
+    if (fout==NULL) return;
+    if (format==JsonMetrics) {
+      fprintf(fout, "{\"partition\":%d,\"seq\":%lu,\"call\":\"%s\",\"mode\":\"%s\",\"active_vertices\":%lu,\"active_edges\":%lu,", partition_id, records, metrics.call, metrics.mode, metrics.active_vertices, metrics.active_edges);
+      fprintf(fout, "\"total_time\":%.6lf,\"signal_time\":%.6lf,\"flush_time\":%.6lf,\"send_time\":%.6lf,\"recv_wait_time\":%.6lf,\"slot_time\":%.6lf,", metrics.total_time, metrics.signal_time, metrics.flush_time, metrics.send_time, metrics.recv_wait_time, metrics.slot_time);
+      fprintf(fout, "\"buffer_wait_time\":%.6lf,\"message_bytes\":%lu,", metrics.buffer_wait_time, metrics.message_bytes);
+      fprintf(fout, "\"sent_bytes\":[");
+      write_list(metrics.sent_bytes, ",");
+      fprintf(fout, "],\"work_chunks\":[");
+      write_list(metrics.work_chunks, ",");
+      fprintf(fout, "],\"steal_chunks\":[");
+      write_list(metrics.steal_chunks, ",");
+      fprintf(fout, "]}\n");
+    } else {
+      fprintf(fout, "%d,%lu,%s,%s,%lu,%lu,", partition_id, records, metrics.call, metrics.mode, metrics.active_vertices, metrics.active_edges);
+      fprintf(fout, "%.6lf,%.6lf,%.6lf,%.6lf,%.6lf,%.6lf,", metrics.total_time, metrics.signal_time, metrics.flush_time, metrics.send_time, metrics.recv_wait_time, metrics.slot_time);
+      fprintf(fout, "%.6lf,%lu,", metrics.buffer_wait_time, metrics.message_bytes);
+      write_list(metrics.sent_bytes, ";");
+      fprintf(fout, ",");
+      write_list(metrics.work_chunks, ";");
+      fprintf(fout, ",");
+      write_list(metrics.steal_chunks, ";");
+      fprintf(fout, "\n");
+    }
+    fflush(fout);
+    records += 1;
+  }
+};
+
+#endif
@@ -0,0 +1,97 @@
+/*
+Copyright (c) 2015-2016 Xiaowei Zhu, Tsinghua University
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#ifndef QUEUE_HPP
+#define QUEUE_HPP
+
+#include <assert.h>
+
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+
+#define QUEUE_SPIN_ROUNDS 4096 // polls before a waiting thread goes to sleep
+
+// a bounded lock-free queue between one producer and one consumer thread;
+// a side that has to wait (empty or full queue) spins for a while, then sleeps until the other side wakes it
+template <typename T>
+class SpscQueue {
+  T * items;
+  size_t capacity;
+  std::atomic<size_t> head; // next item to pop; written by the consumer only
+  std::atomic<size_t> tail; // next item to push; written by the producer only
+  std::atomic<int> sleepers;
+  std::mutex mutex;
+  std::condition_variable cond;
+
+  template <typename Condition>
+  void wait(Condition condition) {
+    for (int r_i=0;r_i<QUEUE_SPIN_ROUNDS;r_i++) {
+      if (condition()) return;
+      __asm volatile ("pause" ::: "memory");
+    }
+    std::unique_lock<std::mutex> lock(mutex);
+    sleepers += 1;
+    cond.wait(lock, condition);
+    sleepers -= 1;
+  }
+  // the other side checks its condition after announcing itself in sleepers, so it cannot miss the update
+  void wake() {
+    if (sleepers.load() > 0) {
+      std::lock_guard<std::mutex> lock(mutex);
+      cond.notify_all();
+    }
+  }
+public:
+  SpscQueue(size_t capacity) : capacity(capacity), head(0), tail(0), sleepers(0) {
+    assert(capacity > 0);
+    items = new T [capacity];
+  }
+  ~SpscQueue() {
+    delete [] items;
+  }
+  SpscQueue(const SpscQueue &) = delete;
+  SpscQueue & operator=(const SpscQueue &) = delete;
+
+  // producer: append an item, waiting while the queue is full
+  void push(const T & item) {
+    size_t t = tail.load(std::memory_order_relaxed);
+    wait([&](){ return t - head.load() < capacity; });
+    items[t % capacity] = item;
+    tail.store(t + 1);
+    wake();
+  }
+  // consumer: take the oldest item if there is one
+  bool try_pop(T & item) {
+    size_t h = head.load(std::memory_order_relaxed);
+    if (h==tail.load()) return false;
+    item = items[h % capacity];
+    head.store(h + 1);
+    wake();
+    return true;
+  }
+  // consumer: take the oldest item, waiting while the queue is empty
+  T pop() {
+    size_t h = head.load(std::memory_order_relaxed);
+    wait([&](){ return h!=tail.load(); });
+    T item = items[h % capacity];
+    head.store(h + 1);
+    wake();
+    return item;
+  }
+};
+
+#endif
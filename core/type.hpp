@@ -18,10 +18,19 @@ Copyright (c) 2015-2016 Xiaowei Zhu, Tsinghua University
 #define TYPE_HPP
 
 #include <stdint.h>
+#include <inttypes.h>
 
 struct Empty { };
 
+// vertex IDs (and the on-disk edge format) are 32-bit unless built with -D VERTEXID_64;
+// PRIvid is the matching printf conversion, e.g. printf("%" PRIvid "\n", vertex)
+#ifdef VERTEXID_64
+typedef uint64_t VertexId;
+#define PRIvid PRIu64
+#else
 typedef uint32_t VertexId;
+#define PRIvid PRIu32
+#endif
 typedef uint64_t EdgeId;
 
 template <typename EdgeData>
@@ -0,0 +1,51 @@
+/*
+Copyright (c) 2015-2016 Xiaowei Zhu, Tsinghua University
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#ifndef VARINT_HPP
+#define VARINT_HPP
+
+#include <stddef.h>
+#include <stdint.h>
+
+// write the LEB128 encoding of value to out (only measure it if out is NULL); returns its length in bytes
+inline size_t encode_varint(uint64_t value, unsigned char * out) {
+  size_t bytes = 0;
+  while (value >= 0x80) {
+    if (out!=NULL) out[bytes] = (unsigned char)(value | 0x80);
+    value >>= 7;
+    bytes += 1;
+  }
+  if (out!=NULL) out[bytes] = (unsigned char)value;
+  return bytes + 1;
+}
+
+// read a LEB128 value at in and advance in past it
+inline uint64_t decode_varint(const unsigned char * & in) {
+  if (!(*in & 0x80)) {
+    return *in++;
+  }
+  uint64_t value = 0;
+  int shift = 0;
+  unsigned char byte;
+  do {
+    byte = *in++;
+    value |= (uint64_t)(byte & 0x7f) << shift;
+    shift += 7;
+  } while (byte & 0x80);
+  return value;
+}
+
+#endif
@@ -0,0 +1,221 @@
+/*
+Copyright (c) 2015-2016 Xiaowei Zhu, Tsinghua University
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#ifndef VERTEX_FILE_HPP
+#define VERTEX_FILE_HPP
+
+#include <assert.h>
+#include <string.h>
+#include <mpi.h>
+#include <zlib.h>
+#include <omp.h>
+
+#include <string>
+#include <vector>
+#include <algorithm>
+
+// Vertex arrays are stored either raw (the values in order, nothing else) or compressed, in independently
+// deflated blocks of up to VERTEX_FILE_BLOCK values behind a header and a table of the blocks.
+// Every process of a communicator writes or reads a contiguous range of the values, collectively.
+
+#define VERTEX_FILE_MAGIC 0x5854524556494d47ul // "GMIVERTX"
+#define VERTEX_FILE_BLOCK (1ul<<16) // values per compressed block
+#define MPI_IO_PIECE (1ul<<30) // bytes per MPI-IO call, whose counts are ints
+
+struct VertexFileHeader {
+  unsigned long magic;
+  unsigned long value_size;
+  unsigned long values;
+  unsigned long blocks; // VertexFileBlock entries following the header
+} __attribute__((packed));
+
+struct VertexFileBlock {
+  unsigned long begin; // index of the first value
+  unsigned long offset; // position of the deflated data in the file
+  unsigned long bytes;
+} __attribute__((packed));
+
+// open path collectively; names without a directory are given one, which some MPI-IO implementations need to find the file system
+inline MPI_File open_vertex_file(std::string path, int mode, MPI_Comm comm) {
+  if (path.find('/')==std::string::npos) {
+    path = "./" + path;
+  }
+  MPI_File fh;
+  int ret = MPI_File_open(comm, path.c_str(), mode, MPI_INFO_NULL, &fh);
+  assert(ret==MPI_SUCCESS);
+  return fh;
+}
+
+// write bytes at offset (maybe none) collectively; the processes of comm may write different amounts
+inline void write_file_at_all(MPI_File fh, MPI_Offset offset, const char * data, size_t bytes, MPI_Comm comm) {
+  unsigned long pieces = (bytes + MPI_IO_PIECE - 1) / MPI_IO_PIECE;
+  MPI_Allreduce(MPI_IN_PLACE, &pieces, 1, MPI_LONG, MPI_MAX, comm);
+  for (unsigned long p_i=0;p_i<pieces;p_i++) {
+    size_t begin = std::min(bytes, MPI_IO_PIECE * p_i);
+    size_t end = std::min(bytes, MPI_IO_PIECE * (p_i + 1));
+    int ret = MPI_File_write_at_all(fh, offset + begin, data + begin, end - begin, MPI_CHAR, MPI_STATUS_IGNORE);
+    assert(ret==MPI_SUCCESS);
+  }
+}
+
+// read bytes at offset (maybe none) collectively
+inline void read_file_at_all(MPI_File fh, MPI_Offset offset, char * data, size_t bytes, MPI_Comm comm) {
+  unsigned long pieces = (bytes + MPI_IO_PIECE - 1) / MPI_IO_PIECE;
+  MPI_Allreduce(MPI_IN_PLACE, &pieces, 1, MPI_LONG, MPI_MAX, comm);
+  for (unsigned long p_i=0;p_i<pieces;p_i++) {
+    size_t begin = std::min(bytes, MPI_IO_PIECE * p_i);
+    size_t end = std::min(bytes, MPI_IO_PIECE * (p_i + 1));
+    int ret = MPI_File_read_at_all(fh, offset + begin, data + begin, end - begin, MPI_CHAR, MPI_STATUS_IGNORE);
+    assert(ret==MPI_SUCCESS);
+  }
+}
+
+// deflate count values; their bytes are grouped by significance first, which lets zlib find the runs in
+// e.g. the exponents of doubles or the high bytes of small integers
+inline void compress_values(const char * values, size_t count, size_t value_size, std::vector<char> & out) {
+  std::vector<char> shuffled (count * value_size);
+  for (size_t i=0;i<count;i++) {
+    for (size_t b_i=0;b_i<value_size;b_i++) {
+      shuffled[b_i * count + i] = values[i * value_size + b_i];
+    }
+  }
+  uLongf bytes = compressBound(shuffled.size());
+  out.resize(bytes);
+  int ret = compress2((Bytef *)out.data(), &bytes, (const Bytef *)shuffled.data(), shuffled.size(), Z_BEST_SPEED);
+  assert(ret==Z_OK);
+  out.resize(bytes);
+}
+
+// inflate count values written by compress_values
+inline void decompress_values(const char * data, size_t bytes, size_t count, size_t value_size, char * values) {
+  std::vector<char> shuffled (count * value_size);
+  uLongf shuffled_bytes = shuffled.size();
+  int ret = uncompress((Bytef *)shuffled.data(), &shuffled_bytes, (const Bytef *)data, bytes);
+  assert(ret==Z_OK && shuffled_bytes==shuffled.size());
+  for (size_t i=0;i<count;i++) {
+    for (size_t b_i=0;b_i<value_size;b_i++) {
+      values[i * value_size + b_i] = shuffled[b_i * count + i];
+    }
+  }
+}
+
+// write values [begin, begin + count) of an array of total values to path, collectively on comm, whose processes
+// hold consecutive ranges in rank order; blocks are compressed by all OpenMP threads if parallel is set
+inline void write_vertex_file(std::string path, const char * values, unsigned long begin, unsigned long count, unsigned long total, size_t value_size, bool compressed, bool parallel, MPI_Comm comm) {
+  MPI_File fh = open_vertex_file(path, MPI_MODE_WRONLY | MPI_MODE_CREATE, comm);
+  int ret;
+  int rank;
+  MPI_Comm_rank(comm, &rank);
+  if (!compressed) {
+    ret = MPI_File_set_size(fh, value_size * total);
+    assert(ret==MPI_SUCCESS);
+    write_file_at_all(fh, value_size * begin, values, value_size * count, comm);
+  } else {
+    unsigned long local_blocks = (count + VERTEX_FILE_BLOCK - 1) / VERTEX_FILE_BLOCK;
+    std::vector<std::vector<char>> block_data (local_blocks);
+    #pragma omp parallel for schedule(dynamic, 1) if(parallel)
+    for (unsigned long b_i=0;b_i<local_blocks;b_i++) {
+      unsigned long block_values = std::min(VERTEX_FILE_BLOCK, count - VERTEX_FILE_BLOCK * b_i);
+      compress_values(values + value_size * VERTEX_FILE_BLOCK * b_i, block_values, value_size, block_data[b_i]);
+    }
+    unsigned long local_bytes = 0;
+    for (unsigned long b_i=0;b_i<local_blocks;b_i++) {
+      local_bytes += block_data[b_i].size();
+    }
+    // the blocks of rank r follow those of the ranks before it, both in the table and in the data
+    unsigned long first_block = 0;
+    unsigned long data_offset = 0;
+    MPI_Exscan(&local_blocks, &first_block, 1, MPI_UNSIGNED_LONG, MPI_SUM, comm);
+    MPI_Exscan(&local_bytes, &data_offset, 1, MPI_UNSIGNED_LONG, MPI_SUM, comm);
+    if (rank==0) {
+      first_block = 0;
+      data_offset = 0;
+    }
+    VertexFileHeader header;
+    header.magic = VERTEX_FILE_MAGIC;
+    header.value_size = value_size;
+    header.values = total;
+    header.blocks = local_blocks;
+    unsigned long total_bytes = local_bytes;
+    MPI_Allreduce(MPI_IN_PLACE, &header.blocks, 1, MPI_UNSIGNED_LONG, MPI_SUM, comm);
+    MPI_Allreduce(MPI_IN_PLACE, &total_bytes, 1, MPI_UNSIGNED_LONG, MPI_SUM, comm);
+    unsigned long data_begin = sizeof(VertexFileHeader) + sizeof(VertexFileBlock) * header.blocks;
+    ret = MPI_File_set_size(fh, data_begin + total_bytes);
+    assert(ret==MPI_SUCCESS);
+
+    std::vector<VertexFileBlock> table (local_blocks);
+    std::vector<char> data (local_bytes);
+    unsigned long offset = 0;
+    for (unsigned long b_i=0;b_i<local_blocks;b_i++) {
+      table[b_i].begin = begin + VERTEX_FILE_BLOCK * b_i;
+      table[b_i].offset = data_begin + data_offset + offset;
+      table[b_i].bytes = block_data[b_i].size();
+      memcpy(data.data() + offset, block_data[b_i].data(), block_data[b_i].size());
+      offset += block_data[b_i].size();
+    }
+    write_file_at_all(fh, 0, (const char *)&header, rank==0 ? sizeof(VertexFileHeader) : 0, comm);
+    write_file_at_all(fh, sizeof(VertexFileHeader) + sizeof(VertexFileBlock) * first_block, (const char *)table.data(), sizeof(VertexFileBlock) * local_blocks, comm);
+    write_file_at_all(fh, data_begin + data_offset, data.data(), local_bytes, comm);
+  }
+  ret = MPI_File_close(&fh);
+  assert(ret==MPI_SUCCESS);
+}
+
+// read values [begin, begin + count) of an array of total values from a raw or compressed file, collectively on comm
+inline void read_vertex_file(std::string path, char * values, unsigned long begin, unsigned long count, unsigned long total, size_t value_size, MPI_Comm comm) {
+  MPI_File fh = open_vertex_file(path, MPI_MODE_RDONLY, comm);
+  MPI_Offset file_bytes;
+  int ret = MPI_File_get_size(fh, &file_bytes);
+  assert(ret==MPI_SUCCESS);
+  if ((unsigned long)file_bytes==value_size * total) {
+    read_file_at_all(fh, value_size * begin, values, value_size * count, comm);
+  } else {
+    VertexFileHeader header;
+    read_file_at_all(fh, 0, (char *)&header, sizeof(VertexFileHeader), comm);
+    assert(header.magic==VERTEX_FILE_MAGIC && header.value_size==value_size && header.values==total);
+    std::vector<VertexFileBlock> table (header.blocks);
+    read_file_at_all(fh, sizeof(VertexFileHeader), (char *)table.data(), sizeof(VertexFileBlock) * header.blocks, comm);
+    // the blocks overlapping the range, which are contiguous in the file
+    unsigned long first_block = 0;
+    unsigned long end_block = 0;
+    if (count > 0) {
+      first_block = std::upper_bound(table.begin(), table.end(), begin, [](unsigned long value, const VertexFileBlock & block){
+        return value < block.begin;
+      }) - table.begin() - 1;
+      end_block = std::lower_bound(table.begin(), table.end(), begin + count, [](const VertexFileBlock & block, unsigned long value){
+        return block.begin < value;
+      }) - table.begin();
+    }
+    unsigned long data_begin = first_block < end_block ? table[first_block].offset : 0;
+    unsigned long data_end = first_block < end_block ? table[end_block-1].offset + table[end_block-1].bytes : 0;
+    std::vector<char> data (data_end - data_begin);
+    read_file_at_all(fh, data_begin, data.data(), data.size(), comm);
+    #pragma omp parallel for schedule(dynamic, 1)
+    for (unsigned long b_i=first_block;b_i<end_block;b_i++) {
+      unsigned long block_begin = table[b_i].begin;
+      unsigned long block_end = b_i + 1 < header.blocks ? table[b_i+1].begin : total;
+      std::vector<char> block_values (value_size * (block_end - block_begin));
+      decompress_values(data.data() + table[b_i].offset - data_begin, table[b_i].bytes, block_end - block_begin, value_size, block_values.data());
+      unsigned long copy_begin = std::max(block_begin, begin);
+      unsigned long copy_end = std::min(block_end, begin + count);
+      memcpy(values + value_size * (copy_begin - begin), block_values.data() + value_size * (copy_begin - block_begin), value_size * (copy_end - copy_begin));
+    }
+  }
+  ret = MPI_File_close(&fh);
+  assert(ret==MPI_SUCCESS);
+}
+
+#endif
@@ -16,10 +16,23 @@ Copyright (c) 2014-2015 Xiaowei Zhu, Tsinghua University
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "core/graph.hpp"
 
 #define COMPACT 0
+#define BATCH 64 // roots per batched traversal, at most 64 (the bits of a mask)
+
+// one value per root of a batch
+struct BatchValues {
+  double value[BATCH];
+};
+
+// a message of the batched traversals: the roots it carries values for, and the values
+struct BatchMessage {
+  unsigned long mask;
+  double value[BATCH];
+};
 
 void compute(Graph<Empty> * graph, VertexId root) {
   double exec_time = 0;
@@ -27,6 +40,7 @@ void compute(Graph<Empty> * graph, VertexId root) {
 
   double * num_paths = graph->alloc_vertex_array<double>();
   double * dependencies = graph->alloc_vertex_array<double>();
+  VertexId * level = graph->alloc_vertex_array<VertexId>(); // the index in levels of the visited vertices, -1 for the others
   VertexSubset * active_all = graph->alloc_vertex_subset();
   active_all->fill();
   VertexSubset * visited = graph->alloc_vertex_subset();
@@ -41,13 +55,53 @@ void compute(Graph<Empty> * graph, VertexId root) {
   levels.push_back(active_in);
   graph->fill_vertex_array(num_paths, 0.0);
   num_paths[root] = 1.0;
-  VertexId i_i;
-  if (graph->partition_id==0) {
+  graph->fill_vertex_array(level, (VertexId)-1);
+  level[root] = 0;
+  VertexId i_i = 0;
+  VertexId backward_levels = 0; // levels.size() in the backward phase, 0 in the forward phase
+
+  // with GEMINI_CHECKPOINT, a restarted job continues after the last checkpointed step of either phase;
+  // visited is checkpointed as it stood, and the levels still on the stack are rebuilt from level
+  graph->checkpoint_vertex_array(num_paths, "num_paths");
+  graph->checkpoint_vertex_array(dependencies, "dependencies");
+  graph->checkpoint_vertex_array(level, "level");
+  graph->checkpoint_vertex_subset(visited, "visited");
+  graph->checkpoint_value(i_i, "iteration");
+  graph->checkpoint_value(active_vertices, "active_vertices");
+  graph->checkpoint_value(backward_levels, "backward_levels");
+  int step = graph->restore_checkpoint() + 1;
+  if (step > 0) {
+    // a forward step i_i ends with the levels 0..i_i+1 (the last one its frontier), a backward one with backward_levels
+    VertexId restored_levels = backward_levels > 0 ? backward_levels : i_i + 2;
+    for (VertexSubset * subset : levels) {
+      delete subset;
+    }
+    levels.clear();
+    for (VertexId l_i=0;l_i<restored_levels;l_i++) {
+      levels.push_back(graph->alloc_vertex_subset());
+      levels.back()->clear();
+    }
+    graph->process_vertices<VertexId>(
+      [&](VertexId vtx) {
+        if (level[vtx] < restored_levels) {
+          levels[level[vtx]]->set_bit_nonatomic(vtx);
+        }
+        return 0;
+      },
+      active_all
+    );
+    active_in = levels.back();
+    if (backward_levels==0) {
+      i_i += 1;
+    }
+  }
+
+  if (graph->partition_id==0 && backward_levels==0) {
     printf("forward\n");
   }
-  for (i_i=0;active_vertices>0;i_i++) {
+  for (;active_vertices>0;i_i++) {
     if (graph->partition_id==0) {
-      printf("active(%d)>=%u\n", i_i, active_vertices);
+      printf("active(%" PRIvid ")>=%" PRIvid "\n", i_i, active_vertices);
     }
     VertexSubset * active_out = graph->alloc_vertex_subset();
     active_out->clear();
@@ -68,7 +122,6 @@ void compute(Graph<Empty> * graph, VertexId root) {
         return 0;
       },
       [&](VertexId dst, VertexAdjList<Empty> incoming_adj) {
-        if (visited->get_bit(dst)) return;
         double sum = 0;
         for (AdjUnit<Empty> * ptr=incoming_adj.begin;ptr!=incoming_adj.end;ptr++) {
           VertexId src = ptr->neighbour;
@@ -91,33 +144,37 @@ void compute(Graph<Empty> * graph, VertexId root) {
     );
     active_vertices = graph->process_vertices<VertexId>(
       [&](VertexId vtx) {
-        visited->set_bit(vtx);
+        visited->set_bit_nonatomic(vtx);
+        level[vtx] = i_i + 1;
         return 1;
       },
       active_out
     );
     levels.push_back(active_out);
     active_in = active_out;
+    graph->checkpoint(step++);
   }
 
   double * inv_num_paths = num_paths;
-  graph->process_vertices<VertexId>(
-    [&](VertexId vtx){
-      inv_num_paths[vtx] = 1 / num_paths[vtx];
-      dependencies[vtx] = 0;
-      return 1;
-    },
-    active_all
-  );
-  visited->clear();
-  graph->process_vertices<VertexId>(
-    [&](VertexId vtx){
-      visited->set_bit(vtx);
-      dependencies[vtx] += inv_num_paths[vtx];
-      return 1;
-    },
-    levels.back()
-  );
+  if (backward_levels==0) {
+    graph->process_vertices<VertexId>(
+      [&](VertexId vtx){
+        inv_num_paths[vtx] = 1 / num_paths[vtx];
+        dependencies[vtx] = 0;
+        return 1;
+      },
+      active_all
+    );
+    visited->clear();
+    graph->process_vertices<VertexId>(
+      [&](VertexId vtx){
+        visited->set_bit_nonatomic(vtx);
+        dependencies[vtx] += inv_num_paths[vtx];
+        return 1;
+      },
+      levels.back()
+    );
+  }
   graph->transpose();
   if (graph->partition_id==0) {
     printf("backward\n");
@@ -137,7 +194,6 @@ void compute(Graph<Empty> * graph, VertexId root) {
         return 0;
       },
       [&](VertexId dst, VertexAdjList<Empty> incoming_adj) {
-        if (visited->get_bit(dst)) return;
         double sum = 0;
         for (AdjUnit<Empty> * ptr=incoming_adj.begin;ptr!=incoming_adj.end;ptr++) {
           VertexId src = ptr->neighbour;
@@ -159,13 +215,16 @@ void compute(Graph<Empty> * graph, VertexId root) {
     levels.pop_back();
     graph->process_vertices<VertexId>(
       [&](VertexId vtx){
-        visited->set_bit(vtx);
+        visited->set_bit_nonatomic(vtx);
         dependencies[vtx] += inv_num_paths[vtx];
         return 1;
       },
       levels.back()
     );
+    backward_levels = levels.size();
+    graph->checkpoint(step++);
   }
+  graph->finish_checkpoints();
 
   graph->process_vertices<VertexId>(
     [&](VertexId vtx){
@@ -191,6 +250,7 @@ void compute(Graph<Empty> * graph, VertexId root) {
 
   graph->dealloc_vertex_array(dependencies);
   graph->dealloc_vertex_array(inv_num_paths);
+  graph->dealloc_vertex_array(level);
   delete visited;
   delete active_all;
 }
@@ -233,7 +293,7 @@ void compute_compact(Graph<Empty> * graph, VertexId root) {
   }
   for (i_i=0;active_vertices>0;i_i++) {
     if (graph->partition_id==0) {
-      printf("active(%d)>=%u\n", i_i, active_vertices);
+      printf("active(%" PRIvid ")>=%" PRIvid "\n", i_i, active_vertices);
     }
     active_out->clear();
     graph->process_edges<VertexId,double>(
@@ -253,7 +313,6 @@ void compute_compact(Graph<Empty> * graph, VertexId root) {
         return 0;
       },
       [&](VertexId dst, VertexAdjList<Empty> incoming_adj) {
-        if (visited->get_bit(dst)) return;
         double sum = 0;
         for (AdjUnit<Empty> * ptr=incoming_adj.begin;ptr!=incoming_adj.end;ptr++) {
           VertexId src = ptr->neighbour;
@@ -276,7 +335,7 @@ void compute_compact(Graph<Empty> * graph, VertexId root) {
     );
     active_vertices = graph->process_vertices<VertexId>(
       [&](VertexId vtx) {
-        visited->set_bit(vtx);
+        visited->set_bit_nonatomic(vtx);
         level[vtx] = i_i + 1;
         return 1;
       },
@@ -299,7 +358,7 @@ void compute_compact(Graph<Empty> * graph, VertexId root) {
   graph->process_vertices<VertexId>(
     [&](VertexId vtx){
       if (level[vtx]==i_i) {
-        active_in->set_bit(vtx);
+        active_in->set_bit_nonatomic(vtx);
         return 1;
       }
       return 0;
@@ -308,7 +367,7 @@ void compute_compact(Graph<Empty> * graph, VertexId root) {
   );
   graph->process_vertices<VertexId>(
     [&](VertexId vtx){
-      visited->set_bit(vtx);
+      visited->set_bit_nonatomic(vtx);
       dependencies[vtx] += inv_num_paths[vtx];
       return 1;
     },
@@ -333,7 +392,6 @@ void compute_compact(Graph<Empty> * graph, VertexId root) {
         return 0;
       },
       [&](VertexId dst, VertexAdjList<Empty> incoming_adj) {
-        if (visited->get_bit(dst)) return;
         double sum = 0;
         for (AdjUnit<Empty> * ptr=incoming_adj.begin;ptr!=incoming_adj.end;ptr++) {
           VertexId src = ptr->neighbour;
@@ -356,7 +414,7 @@ void compute_compact(Graph<Empty> * graph, VertexId root) {
     active_vertices = graph->process_vertices<VertexId>(
       [&](VertexId vtx){
         if (level[vtx]==i_i) {
-          active_in->set_bit(vtx);
+          active_in->set_bit_nonatomic(vtx);
           return 1;
         }
         return 0;
@@ -365,7 +423,7 @@ void compute_compact(Graph<Empty> * graph, VertexId root) {
     );
     graph->process_vertices<VertexId>(
       [&](VertexId vtx){
-        visited->set_bit(vtx);
+        visited->set_bit_nonatomic(vtx);
         dependencies[vtx] += inv_num_paths[vtx];
         return 1;
       },
@@ -403,30 +461,310 @@ void compute_compact(Graph<Empty> * graph, VertexId root) {
   delete active_out;
 }
 
+// multi-source BC: the roots are traversed in batches of BATCH at once, the frontiers being bit masks
+// of roots per vertex and the messages carrying one path count (forward) or dependency (backward)
+// per root in the mask; the dependencies of all roots are summed into one centrality per vertex
+void compute_batched(Graph<Empty> * graph, std::vector<VertexId> & roots) {
+  double exec_time = 0;
+
+  BatchValues * num_paths = graph->alloc_vertex_array<BatchValues>();
+  BatchValues * dependencies = graph->alloc_vertex_array<BatchValues>();
+  VertexId (* depth)[BATCH] = graph->alloc_vertex_array<VertexId [BATCH]>(); // only valid for the roots in seen
+  unsigned long * seen = graph->alloc_vertex_array<unsigned long>();
+  unsigned long * frontier_in = graph->alloc_vertex_array<unsigned long>();
+  unsigned long * frontier_out = graph->alloc_vertex_array<unsigned long>();
+  double * centrality = graph->alloc_vertex_array<double>();
+  VertexSubset * active_all = graph->alloc_vertex_subset();
+  active_all->fill();
+  VertexSubset * done = graph->alloc_vertex_subset(); // reached by all roots of the batch (forward)
+  VertexSubset * skip = graph->alloc_vertex_subset(); // not on the level being reached (backward)
+  std::vector<VertexSubset *> levels;
+  graph->fill_vertex_array(centrality, 0.0);
+
+  auto combine = [&](BatchMessage a, BatchMessage b) {
+    a.mask |= b.mask;
+    for (int r_i=0;r_i<BATCH;r_i++) {
+      a.value[r_i] += b.value[r_i];
+    }
+    return a;
+  };
+  // emit the values of the roots in mask
+  auto emit_values = [&](VertexId vtx, unsigned long mask, BatchValues * values) {
+    BatchMessage msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.mask = mask;
+    for (;mask!=0;mask&=mask-1) {
+      int r_i = __builtin_ctzl(mask);
+      msg.value[r_i] = values[vtx].value[r_i];
+    }
+    graph->emit(vtx, msg);
+  };
+  // the sum of the values of the roots in frontier[src] over the incoming edges of dst
+  auto emit_pulled = [&](VertexId dst, VertexAdjList<Empty> incoming_adj, unsigned long * frontier, BatchValues * values) {
+    BatchMessage msg;
+    memset(&msg, 0, sizeof(msg));
+    for (AdjUnit<Empty> * ptr=incoming_adj.begin;ptr!=incoming_adj.end;ptr++) {
+      VertexId src = ptr->neighbour;
+      msg.mask |= frontier[src];
+      for (unsigned long mask=frontier[src];mask!=0;mask&=mask-1) {
+        int r_i = __builtin_ctzl(mask);
+        msg.value[r_i] += values[src].value[r_i];
+      }
+    }
+    if (msg.mask!=0) graph->emit(dst, msg);
+  };
+  // add the values of the roots in msg & mask to values[dst]
+  auto add_values = [&](VertexId dst, BatchMessage & msg, unsigned long mask, BatchValues * values) {
+    for (mask&=msg.mask;mask!=0;mask&=mask-1) {
+      int r_i = __builtin_ctzl(mask);
+      write_add(&values[dst].value[r_i], msg.value[r_i]);
+    }
+  };
+
+  for (size_t b_i=0;b_i<roots.size();b_i+=BATCH) {
+    exec_time -= get_time();
+    int batch = std::min(roots.size() - b_i, (size_t)BATCH);
+    unsigned long all = batch==64 ? ~0ul : (1ul << batch) - 1;
+    BatchValues zero;
+    memset(&zero, 0, sizeof(zero));
+    graph->fill_vertex_array(num_paths, zero);
+    graph->fill_vertex_array(seen, 0ul);
+    graph->fill_vertex_array(frontier_in, 0ul);
+    graph->fill_vertex_array(frontier_out, 0ul);
+    done->clear();
+    VertexSubset * active_in = graph->alloc_vertex_subset();
+    active_in->clear();
+    for (int r_i=0;r_i<batch;r_i++) {
+      VertexId root = roots[b_i + r_i];
+      seen[root] |= 1ul << r_i;
+      frontier_in[root] |= 1ul << r_i;
+      num_paths[root].value[r_i] = 1.0;
+      depth[root][r_i] = 0;
+      active_in->set_bit(root);
+    }
+    VertexId active_vertices = graph->process_vertices<VertexId>(
+      [&](VertexId vtx) {
+        if (seen[vtx]==all) done->set_bit_nonatomic(vtx);
+        return 1;
+      },
+      active_in
+    );
+    levels.push_back(active_in);
+    // forward: count the shortest paths from every root
+    auto reach = [&](VertexId dst, BatchMessage & msg, VertexSubset * active_out) {
+      unsigned long reached = msg.mask & ~seen[dst];
+      if (reached==0) return;
+      if (__sync_fetch_and_or(&frontier_out[dst], reached)==0) {
+        active_out->set_bit(dst);
+      }
+      add_values(dst, msg, reached, num_paths);
+    };
+    if (graph->partition_id==0) {
+      printf("forward\n");
+    }
+    VertexId i_i;
+    for (i_i=0;active_vertices>0;i_i++) {
+      if (graph->partition_id==0) {
+        printf("active(%" PRIvid ")>=%" PRIvid "\n", i_i, active_vertices);
+      }
+      VertexSubset * active_out = graph->alloc_vertex_subset();
+      active_out->clear();
+      graph->process_edges<VertexId,BatchMessage>(
+        [&](VertexId src){
+          emit_values(src, frontier_in[src], num_paths);
+        },
+        [&](VertexId src, BatchMessage msg, VertexAdjList<Empty> outgoing_adj){
+          for (AdjUnit<Empty> * ptr=outgoing_adj.begin;ptr!=outgoing_adj.end;ptr++) {
+            reach(ptr->neighbour, msg, active_out);
+          }
+          return 0;
+        },
+        [&](VertexId dst, VertexAdjList<Empty> incoming_adj) {
+          emit_pulled(dst, incoming_adj, frontier_in, num_paths);
+        },
+        [&](VertexId dst, BatchMessage msg) {
+          reach(dst, msg, active_out);
+          return 0;
+        },
+        active_in, done, combine
+      );
+      graph->process_vertices<VertexId>(
+        [&](VertexId vtx) {
+          frontier_in[vtx] = 0;
+          return 1;
+        },
+        active_in
+      );
+      active_vertices = graph->process_vertices<VertexId>(
+        [&](VertexId vtx) {
+          seen[vtx] |= frontier_out[vtx];
+          for (unsigned long mask=frontier_out[vtx];mask!=0;mask&=mask-1) {
+            depth[vtx][__builtin_ctzl(mask)] = i_i + 1;
+          }
+          if (seen[vtx]==all) done->set_bit_nonatomic(vtx);
+          return 1;
+        },
+        active_out
+      );
+      if (active_vertices==0) {
+        delete active_out;
+      } else {
+        levels.push_back(active_out);
+        active_in = active_out;
+      }
+      std::swap(frontier_in, frontier_out);
+    }
+
+    // backward: accumulate the dependencies level by level, from the deepest one
+    BatchValues * inv_num_paths = num_paths;
+    graph->process_vertices<VertexId>(
+      [&](VertexId vtx){
+        for (unsigned long mask=seen[vtx];mask!=0;mask&=mask-1) {
+          int r_i = __builtin_ctzl(mask);
+          inv_num_paths[vtx].value[r_i] = 1 / num_paths[vtx].value[r_i];
+          dependencies[vtx].value[r_i] = 0;
+        }
+        return 1;
+      },
+      active_all
+    );
+    // the roots at depth d of vtx go to frontier
+    auto select_level = [&](VertexId d, unsigned long * frontier) {
+      graph->process_vertices<VertexId>(
+        [&](VertexId vtx){
+          frontier[vtx] = 0;
+          for (unsigned long mask=seen[vtx];mask!=0;mask&=mask-1) {
+            int r_i = __builtin_ctzl(mask);
+            if (depth[vtx][r_i]==d) {
+              frontier[vtx] |= 1ul << r_i;
+              dependencies[vtx].value[r_i] += inv_num_paths[vtx].value[r_i];
+            }
+          }
+          return 1;
+        },
+        levels[d]
+      );
+    };
+    graph->fill_vertex_array(frontier_in, 0ul);
+    graph->fill_vertex_array(frontier_out, 0ul);
+    VertexId d = levels.size() - 1;
+    select_level(d, frontier_in);
+    graph->transpose();
+    if (graph->partition_id==0) {
+      printf("backward\n");
+    }
+    while (d > 0) {
+      select_level(d - 1, frontier_out);
+      skip->clear();
+      graph->process_vertices<VertexId>(
+        [&](VertexId vtx){
+          if (!levels[d - 1]->get_bit(vtx)) skip->set_bit_nonatomic(vtx);
+          return 0;
+        },
+        active_all
+      );
+      graph->process_edges<VertexId,BatchMessage>(
+        [&](VertexId src){
+          emit_values(src, frontier_in[src], dependencies);
+        },
+        [&](VertexId src, BatchMessage msg, VertexAdjList<Empty> outgoing_adj){
+          for (AdjUnit<Empty> * ptr=outgoing_adj.begin;ptr!=outgoing_adj.end;ptr++) {
+            VertexId dst = ptr->neighbour;
+            add_values(dst, msg, frontier_out[dst], dependencies);
+          }
+          return 0;
+        },
+        [&](VertexId dst, VertexAdjList<Empty> incoming_adj) {
+          emit_pulled(dst, incoming_adj, frontier_in, dependencies);
+        },
+        [&](VertexId dst, BatchMessage msg) {
+          add_values(dst, msg, frontier_out[dst], dependencies);
+          return 0;
+        },
+        levels[d], skip, combine
+      );
+      graph->process_vertices<VertexId>(
+        [&](VertexId vtx) {
+          frontier_in[vtx] = 0;
+          return 1;
+        },
+        levels[d]
+      );
+      delete levels[d];
+      levels.pop_back();
+      d--;
+      std::swap(frontier_in, frontier_out);
+    }
+    graph->transpose();
+
+    // the roots themselves are not counted
+    graph->process_vertices<VertexId>(
+      [&](VertexId vtx){
+        for (unsigned long mask=seen[vtx];mask!=0;mask&=mask-1) {
+          int r_i = __builtin_ctzl(mask);
+          if (depth[vtx][r_i]!=0) {
+            centrality[vtx] += (dependencies[vtx].value[r_i] - inv_num_paths[vtx].value[r_i]) / inv_num_paths[vtx].value[r_i];
+          }
+        }
+        return 1;
+      },
+      active_all
+    );
+    delete levels.back();
+    levels.pop_back();
+    exec_time += get_time();
+  }
+
+  if (graph->partition_id==0) {
+    printf("exec_time=%lf(s)\n", exec_time);
+  }
+
+  graph->gather_vertex_array(centrality, 0);
+  if (graph->partition_id==0) {
+    for (VertexId v_i=0;v_i<20;v_i++) {
+      printf("%lf\n", centrality[v_i]);
+    }
+  }
+
+  graph->dealloc_vertex_array(num_paths);
+  graph->dealloc_vertex_array(dependencies);
+  graph->dealloc_vertex_array(depth);
+  graph->dealloc_vertex_array(seen);
+  graph->dealloc_vertex_array(frontier_in);
+  graph->dealloc_vertex_array(frontier_out);
+  graph->dealloc_vertex_array(centrality);
+  delete active_all;
+  delete done;
+  delete skip;
+}
+
 int main(int argc, char ** argv) {
   MPI_Instance mpi(&argc, &argv);
 
   if (argc<4) {
-    printf("bc [file] [vertices] [root]\n");
+    printf("bc [file] [vertices] [root[,root...]]\n");
     exit(-1);
   }
 
   Graph<Empty> * graph;
   graph = new Graph<Empty>();
-  VertexId root = std::atoi(argv[3]);
-  graph->load_directed(argv[1], std::atoi(argv[2]));
-
-  #if COMPACT
-  compute_compact(graph, root);
-  #else
-  compute(graph, root);
-  #endif
-  for (int run=0;run<5;run++) {
-    #if COMPACT
-    compute_compact(graph, root);
-    #else
-    compute(graph, root);
-    #endif
+  graph->load_directed(argv[1], std::atol(argv[2]));
+  std::vector<VertexId> roots;
+  for (char * root=strtok(argv[3], ",");root!=NULL;root=strtok(NULL, ",")) {
+    roots.push_back(graph->get_internal_id(std::atol(root)));
+  }
+  assert(roots.size() > 0);
+
+  for (int run=0;run<6;run++) {
+    if (roots.size() > 1) {
+      compute_batched(graph, roots);
+    } else {
+      #if COMPACT
+      compute_compact(graph, roots[0]);
+      #else
+      compute(graph, roots[0]);
+      #endif
+    }
   }
 
   delete graph;
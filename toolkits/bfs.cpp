@@ -16,6 +16,7 @@ Copyright (c) 2014-2015 Xiaowei Zhu, Tsinghua University
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "core/graph.hpp"
 
@@ -39,7 +40,7 @@ void compute(Graph<Empty> * graph, VertexId root) {
 
   for (int i_i=0;active_vertices>0;i_i++) {
     if (graph->partition_id==0) {
-      printf("active(%d)>=%u\n", i_i, active_vertices);
+      printf("active(%d)>=%" PRIvid "\n", i_i, active_vertices);
     }
     active_out->clear();
     active_vertices = graph->process_edges<VertexId,VertexId>(
@@ -58,7 +59,6 @@ void compute(Graph<Empty> * graph, VertexId root) {
         return activated;
       },
       [&](VertexId dst, VertexAdjList<Empty> incoming_adj) {
-        if (visited->get_bit(dst)) return;
         for (AdjUnit<Empty> * ptr=incoming_adj.begin;ptr!=incoming_adj.end;ptr++) {
           VertexId src = ptr->neighbour;
           if (active_in->get_bit(src)) {
@@ -78,7 +78,7 @@ void compute(Graph<Empty> * graph, VertexId root) {
     );
     active_vertices = graph->process_vertices<VertexId>(
       [&](VertexId vtx) {
-        visited->set_bit(vtx);
+        visited->set_bit_nonatomic(vtx);
         return 1;
       },
       active_out
@@ -99,7 +99,7 @@ void compute(Graph<Empty> * graph, VertexId root) {
         found_vertices += 1;
       }
     }
-    printf("found_vertices = %u\n", found_vertices);
+    printf("found_vertices = %" PRIvid "\n", found_vertices);
   }
 
   graph->dealloc_vertex_array(parent);
@@ -108,22 +108,151 @@ void compute(Graph<Empty> * graph, VertexId root) {
   delete visited;
 }
 
+// multi-source BFS: the roots are traversed in batches of 64 at once, every vertex keeping a bit mask
+// of the roots of the batch that reached it, so that a batch takes a single traversal
+void compute_batched(Graph<Empty> * graph, std::vector<VertexId> & roots) {
+  double exec_time = 0;
+
+  unsigned long * seen = graph->alloc_vertex_array<unsigned long>();
+  unsigned long * frontier_in = graph->alloc_vertex_array<unsigned long>();
+  unsigned long * frontier_out = graph->alloc_vertex_array<unsigned long>();
+  VertexSubset * done = graph->alloc_vertex_subset(); // reached by all roots of the batch
+  VertexSubset * active_in = graph->alloc_vertex_subset();
+  VertexSubset * active_out = graph->alloc_vertex_subset();
+  std::vector<VertexId> found_vertices(roots.size(), 0);
+
+  for (size_t b_i=0;b_i<roots.size();b_i+=64) {
+    exec_time -= get_time();
+    int batch = std::min(roots.size() - b_i, (size_t)64);
+    unsigned long all = batch==64 ? ~0ul : (1ul << batch) - 1;
+    graph->fill_vertex_array(seen, 0ul);
+    graph->fill_vertex_array(frontier_in, 0ul);
+    graph->fill_vertex_array(frontier_out, 0ul);
+    done->clear();
+    active_in->clear();
+    for (int r_i=0;r_i<batch;r_i++) {
+      seen[roots[b_i + r_i]] |= 1ul << r_i;
+      frontier_in[roots[b_i + r_i]] |= 1ul << r_i;
+      active_in->set_bit(roots[b_i + r_i]);
+    }
+    VertexId active_vertices = graph->process_vertices<VertexId>(
+      [&](VertexId vtx) {
+        if (seen[vtx]==all) done->set_bit_nonatomic(vtx);
+        return 1;
+      },
+      active_in
+    );
+    // the roots in msg which had not reached dst before this step
+    auto reach = [&](VertexId dst, unsigned long msg) {
+      unsigned long reached = msg & ~seen[dst];
+      if (reached==0) return 0;
+      if (__sync_fetch_and_or(&frontier_out[dst], reached)==0) {
+        active_out->set_bit(dst);
+        return 1;
+      }
+      return 0;
+    };
+
+    for (int i_i=0;active_vertices>0;i_i++) {
+      if (graph->partition_id==0) {
+        printf("active(%d)>=%" PRIvid "\n", i_i, active_vertices);
+      }
+      active_out->clear();
+      graph->process_edges<VertexId,unsigned long>(
+        [&](VertexId src){
+          graph->emit(src, frontier_in[src]);
+        },
+        [&](VertexId src, unsigned long msg, VertexAdjList<Empty> outgoing_adj){
+          VertexId activated = 0;
+          for (AdjUnit<Empty> * ptr=outgoing_adj.begin;ptr!=outgoing_adj.end;ptr++) {
+            activated += reach(ptr->neighbour, msg);
+          }
+          return activated;
+        },
+        [&](VertexId dst, VertexAdjList<Empty> incoming_adj) {
+          unsigned long msg = 0;
+          for (AdjUnit<Empty> * ptr=incoming_adj.begin;ptr!=incoming_adj.end;ptr++) {
+            msg |= frontier_in[ptr->neighbour];
+            if (msg==all) break;
+          }
+          if (msg!=0) graph->emit(dst, msg);
+        },
+        [&](VertexId dst, unsigned long msg) {
+          return reach(dst, msg);
+        },
+        active_in, done,
+        [&](unsigned long a, unsigned long b) {
+          return a | b;
+        }
+      );
+      graph->process_vertices<VertexId>(
+        [&](VertexId vtx) {
+          frontier_in[vtx] = 0;
+          return 1;
+        },
+        active_in
+      );
+      active_vertices = graph->process_vertices<VertexId>(
+        [&](VertexId vtx) {
+          seen[vtx] |= frontier_out[vtx];
+          if (seen[vtx]==all) done->set_bit_nonatomic(vtx);
+          return 1;
+        },
+        active_out
+      );
+      std::swap(frontier_in, frontier_out);
+      std::swap(active_in, active_out);
+    }
+    exec_time += get_time();
+
+    graph->gather_vertex_array(seen, 0);
+    if (graph->partition_id==0) {
+      for (VertexId v_i=0;v_i<graph->vertices;v_i++) {
+        for (unsigned long mask=seen[v_i];mask!=0;mask&=mask-1) {
+          found_vertices[b_i + __builtin_ctzl(mask)] += 1;
+        }
+      }
+    }
+  }
+
+  if (graph->partition_id==0) {
+    printf("exec_time=%lf(s)\n", exec_time);
+    for (size_t r_i=0;r_i<roots.size();r_i++) {
+      printf("found_vertices[%" PRIvid "] = %" PRIvid "\n", graph->get_original_id(roots[r_i]), found_vertices[r_i]);
+    }
+  }
+
+  graph->dealloc_vertex_array(seen);
+  graph->dealloc_vertex_array(frontier_in);
+  graph->dealloc_vertex_array(frontier_out);
+  delete done;
+  delete active_in;
+  delete active_out;
+}
+
 int main(int argc, char ** argv) {
   MPI_Instance mpi(&argc, &argv);
 
   if (argc<4) {
-    printf("bfs [file] [vertices] [root]\n");
+    printf("bfs [file] [vertices] [root[,root...]]\n");
     exit(-1);
   }
 
   Graph<Empty> * graph;
   graph = new Graph<Empty>();
-  VertexId root = std::atoi(argv[3]);
-  graph->load_directed(argv[1], std::atoi(argv[2]));
+  graph->load_directed(argv[1], std::atol(argv[2]));
+  std::vector<VertexId> roots;
+  for (char * root=strtok(argv[3], ",");root!=NULL;root=strtok(NULL, ",")) {
+    roots.push_back(graph->get_internal_id(std::atol(root)));
+  }
+  assert(roots.size() > 0);
 
-  compute(graph, root);
-  for (int run=0;run<5;run++) {
-    compute(graph, root);
+  for (int run=0;run<6;run++) {
+    if (roots.size()==1) {
+      compute(graph, roots[0]);
+    } else {
+      compute_batched(graph, roots);
+    }
   }
 
   delete graph;
@@ -19,44 +19,91 @@ Copyright (c) 2014-2015 Xiaowei Zhu, Tsinghua University
 
 #include "core/graph.hpp"
 
-void compute(Graph<Empty> * graph) {
+// label propagation: every vertex ends up with the smallest vertex id in its component. Given the labels of the graph
+// before an update_edges batch (previous_label), the propagation restarts from the endpoints of the batch instead:
+// the components of deleted edges, which may fall apart, start over from the ids of their vertices, and the other
+// vertices keep their labels (the id of some vertex in their component, not necessarily the smallest one)
+void compute(Graph<Empty> * graph, VertexId * previous_label, VertexSubset * inserted_endpoints, VertexSubset * deleted_endpoints, std::string label_path) {
   double exec_time = 0;
   exec_time -= get_time();
 
   VertexId * label = graph->alloc_vertex_array<VertexId>();
+  VertexSubset * all = graph->alloc_vertex_subset();
+  all->fill();
   VertexSubset * active_in = graph->alloc_vertex_subset();
-  active_in->fill();
   VertexSubset * active_out = graph->alloc_vertex_subset();
 
-  VertexId active_vertices = graph->process_vertices<VertexId>(
-    [&](VertexId vtx){
-      label[vtx] = vtx;
-      return 1;
-    },
-    active_in
-  );
+  VertexId active_vertices;
+  if (previous_label==nullptr) {
+    active_in->fill();
+    active_vertices = graph->process_vertices<VertexId>(
+      [&](VertexId vtx){
+        label[vtx] = vtx;
+        return 1;
+      },
+      active_in
+    );
+  } else {
+    // the labels of the components to recompute; the dense signal relies on labels never exceeding the ids of their
+    // vertices, so components where one does (after the vertices were renumbered) start over as well
+    Bitmap * reset = new Bitmap (graph->vertices);
+    graph->process_vertices<VertexId>(
+      [&](VertexId vtx){
+        if (deleted_endpoints->get_bit(vtx) || previous_label[vtx] > vtx) {
+          reset->set_bit(previous_label[vtx]);
+        }
+        return 0;
+      },
+      all
+    );
+    MPI_Allreduce(MPI_IN_PLACE, reset->data, WORD_OFFSET(graph->vertices) + 1, MPI_UNSIGNED_LONG, MPI_BOR, MPI_COMM_WORLD);
+    active_in->clear();
+    active_vertices = graph->process_vertices<VertexId>(
+      [&](VertexId vtx){
+        if (reset->get_bit(previous_label[vtx])) {
+          label[vtx] = vtx;
+        } else {
+          label[vtx] = previous_label[vtx];
+          if (!inserted_endpoints->get_bit(vtx)) {
+            return 0;
+          }
+        }
+        active_in->set_bit(vtx);
+        return 1;
+      },
+      all
+    );
+    delete reset;
+  }
 
+  auto sparse_signal = [&](VertexId src){
+    graph->emit(src, label[src]);
+  };
+  auto sparse_slot = [&](VertexId src, VertexId msg, VertexAdjList<Empty> outgoing_adj){
+    VertexId activated = 0;
+    for (AdjUnit<Empty> * ptr=outgoing_adj.begin;ptr!=outgoing_adj.end;ptr++) {
+      VertexId dst = ptr->neighbour;
+      if (msg < label[dst]) {
+        write_min(&label[dst], msg);
+        active_out->set_bit(dst);
+        activated += 1;
+      }
+    }
+    return activated;
+  };
   for (int i_i=0;active_vertices>0;i_i++) {
     if (graph->partition_id==0) {
-      printf("active(%d)>=%u\n", i_i, active_vertices);
+      printf("active(%d)>=%" PRIvid "\n", i_i, active_vertices);
     }
     active_out->clear();
+    if (graph->async_frontier(active_vertices)) {
+      // the tail of small frontiers propagates without the rounds
+      graph->process_edges_async<VertexId,VertexId>(sparse_signal, sparse_slot, active_in, active_out);
+      break;
+    }
     active_vertices = graph->process_edges<VertexId,VertexId>(
-      [&](VertexId src){
-        graph->emit(src, label[src]);
-      },
-      [&](VertexId src, VertexId msg, VertexAdjList<Empty> outgoing_adj){
-        VertexId activated = 0;
-        for (AdjUnit<Empty> * ptr=outgoing_adj.begin;ptr!=outgoing_adj.end;ptr++) {
-          VertexId dst = ptr->neighbour;
-          if (msg < label[dst]) {
-            write_min(&label[dst], msg);
-            active_out->set_bit(dst);
-            activated += 1;
-          }
-        }
-        return activated;
-      },
+      sparse_signal,
+      sparse_slot,
       [&](VertexId dst, VertexAdjList<Empty> incoming_adj) {
         VertexId msg = dst;
         for (AdjUnit<Empty> * ptr=incoming_adj.begin;ptr!=incoming_adj.end;ptr++) {
@@ -77,7 +124,10 @@ void compute(Graph<Empty> * graph) {
         }
         return 0u;
       },
-      active_in
+      active_in, nullptr,
+      [&](VertexId a, VertexId b) {
+        return a < b ? a : b;
+      }
     );
     std::swap(active_in, active_out);
   }
@@ -87,10 +137,29 @@ void compute(Graph<Empty> * graph) {
     printf("exec_time=%lf(s)\n", exec_time);
   }
 
+  if (label_path!="") {
+    // labels are stored as input ids, so that they stay valid if the vertices are renumbered on the next loading
+    graph->process_vertices<int>(
+      [&](VertexId vtx){
+        label[vtx] = graph->get_original_id(label[vtx]);
+        return 0;
+      },
+      all
+    );
+    graph->dump_vertex_array_async(label, label_path);
+    graph->process_vertices<int>(
+      [&](VertexId vtx){
+        label[vtx] = graph->get_internal_id(label[vtx]);
+        return 0;
+      },
+      all
+    );
+  }
+
   graph->gather_vertex_array(label, 0);
   if (graph->partition_id==0) {
     VertexId * count = graph->alloc_vertex_array<VertexId>();
-    graph->fill_vertex_array(count, 0u);
+    graph->fill_vertex_array(count, (VertexId)0);
     for (VertexId v_i=0;v_i<graph->vertices;v_i++) {
       count[label[v_i]] += 1;
     }
@@ -100,10 +169,11 @@ void compute(Graph<Empty> * graph) {
         components += 1;
       }
     }
-    printf("components = %u\n", components);
+    printf("components = %" PRIvid "\n", components);
   }
   
   graph->dealloc_vertex_array(label);
+  delete all;
   delete active_in;
   delete active_out;
 }
@@ -112,18 +182,48 @@ int main(int argc, char ** argv) {
   MPI_Instance mpi(&argc, &argv);
 
   if (argc<3) {
-    printf("cc [file] [vertices]\n");
+    printf("cc [file] [vertices] [labels] [inserted edges] [deleted edges]\n");
     exit(-1);
   }
 
   Graph<Empty> * graph;
   graph = new Graph<Empty>();
-  graph->load_undirected_from_directed(argv[1], std::atoi(argv[2]));
+  graph->load_undirected_from_directed(argv[1], std::atol(argv[2]));
+  std::string label_path = argc > 3 ? argv[3] : "";
+
+  // with edge files ("-" for none), the graph is updated and the labels in label_path are recomputed for it
+  VertexId * previous_label = nullptr;
+  VertexSubset * inserted_endpoints = graph->alloc_vertex_subset();
+  VertexSubset * deleted_endpoints = graph->alloc_vertex_subset();
+  inserted_endpoints->clear();
+  deleted_endpoints->clear();
+  if (argc > 4) {
+    std::string inserted_path = strcmp(argv[4], "-")==0 ? "" : argv[4];
+    std::string deleted_path = argc > 5 && strcmp(argv[5], "-")!=0 ? argv[5] : "";
+    graph->update_edges(inserted_path, deleted_path, inserted_endpoints, deleted_endpoints);
+    previous_label = graph->alloc_vertex_array<VertexId>();
+    graph->restore_vertex_array(previous_label, label_path);
+    VertexSubset * all = graph->alloc_vertex_subset();
+    all->fill();
+    graph->process_vertices<int>(
+      [&](VertexId vtx){
+        previous_label[vtx] = graph->get_internal_id(previous_label[vtx]);
+        return 0;
+      },
+      all
+    );
+    delete all;
+  }
+
+  for (int run=0;run<6;run++) {
+    compute(graph, previous_label, inserted_endpoints, deleted_endpoints, label_path);
+  }
 
-  compute(graph);
-  for (int run=0;run<5;run++) {
-    compute(graph);
+  if (previous_label!=nullptr) {
+    graph->dealloc_vertex_array(previous_label);
   }
+  delete inserted_endpoints;
+  delete deleted_endpoints;
 
   delete graph;
   return 0;
@@ -44,7 +44,12 @@ void compute(Graph<Empty> * graph, int iterations) {
   );
   delta /= graph->vertices;
 
-  for (int i_i=0;i_i<iterations;i_i++) {
+  // with GEMINI_CHECKPOINT, a restarted job continues after the last checkpointed iteration
+  graph->checkpoint_vertex_array(curr, "curr");
+  graph->checkpoint_value(delta, "delta");
+  int first_iteration = graph->restore_checkpoint() + 1;
+
+  for (int i_i=first_iteration;i_i<iterations;i_i++) {
     if (graph->partition_id==0) {
       printf("delta(%d)=%lf\n", i_i, delta);
     }
@@ -72,7 +77,10 @@ void compute(Graph<Empty> * graph, int iterations) {
         write_add(&next[dst], msg);
         return 0;
       },
-      active
+      active, nullptr,
+      [&](double a, double b) {
+        return a + b;
+      }
     );
     if (i_i==iterations-1) {
       delta = graph->process_vertices<double>(
@@ -97,7 +105,9 @@ void compute(Graph<Empty> * graph, int iterations) {
     }
     delta /= graph->vertices;
     std::swap(curr, next);
+    graph->checkpoint(i_i);
   }
+  graph->finish_checkpoints();
 
   exec_time += get_time();
   if (graph->partition_id==0) {
@@ -120,7 +130,7 @@ void compute(Graph<Empty> * graph, int iterations) {
     for (VertexId v_i=0;v_i<graph->vertices;v_i++) {
       if (curr[v_i] > curr[max_v_i]) max_v_i = v_i;
     }
-    printf("pr[%u]=%lf\n", max_v_i, curr[max_v_i]);
+    printf("pr[%" PRIvid "]=%lf\n", max_v_i, curr[max_v_i]);
   }
 
   graph->dealloc_vertex_array(curr);
@@ -138,7 +148,7 @@ int main(int argc, char ** argv) {
 
   Graph<Empty> * graph;
   graph = new Graph<Empty>();
-  graph->load_directed(argv[1], std::atoi(argv[2]));
+  graph->load_directed(argv[1], std::atol(argv[2]), IncomingOnly); // every iteration runs in dense mode
   int iterations = std::atoi(argv[3]);
 
   compute(graph, iterations);
@@ -0,0 +1,301 @@
+/*
+Copyright (c) 2014-2015 Xiaowei Zhu, Tsinghua University
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "core/graph.hpp"
+
+#include <math.h>
+
+const double d = (double)0.85;
+
+// PageRank propagating changes only: rank + residual is the current PageRank value of a vertex, of which only rank
+// has been propagated; vertices whose residual exceeds epsilon add it to their rank and propagate it in the next
+// iteration, so that without epsilon it computes the same iterates as the power method of pagerank.cpp.
+// Given the ranks of the graph before an update_edges batch (previous_rank) and the endpoints of the batch, it starts
+// from those ranks instead; only the vertices whose in-edges or in-neighbours' out-degrees changed get a new residual
+void compute(Graph<Empty> * graph, double epsilon, int max_iterations, double * previous_rank, VertexSubset * updated, std::string rank_path) {
+  double exec_time = 0;
+  exec_time -= get_time();
+
+  double * rank = graph->alloc_vertex_array<double>();
+  double * residual = graph->alloc_vertex_array<double>();
+  double * contribution = graph->alloc_vertex_array<double>();
+  VertexSubset * all = graph->alloc_vertex_subset();
+  all->fill();
+  VertexSubset * active_in = graph->alloc_vertex_subset();
+  VertexSubset * active_out = graph->alloc_vertex_subset();
+  VertexSubset * touched = graph->alloc_vertex_subset(); // vertices whose residual changed in this iteration
+
+  // turn the residuals of the touched vertices exceeding epsilon into the contributions of the next iteration
+  auto activate = [&]() {
+    active_out->clear();
+    VertexId activated = graph->process_vertices<VertexId>(
+      [&](VertexId vtx) {
+        if (fabs(residual[vtx]) > epsilon * rank[vtx]) {
+          rank[vtx] += residual[vtx];
+          contribution[vtx] = graph->out_degree[vtx]>0 ? d * residual[vtx] / graph->out_degree[vtx] : 0;
+          residual[vtx] = 0;
+          active_out->set_bit_nonatomic(vtx);
+          return 1;
+        }
+        return 0;
+      },
+      touched
+    );
+    touched->clear();
+    std::swap(active_in, active_out);
+    return activated;
+  };
+
+  VertexId active_vertices;
+  if (previous_rank==nullptr) {
+    active_in->fill();
+    touched->fill();
+    active_vertices = graph->process_vertices<VertexId>(
+      [&](VertexId vtx){
+        rank[vtx] = 1;
+        residual[vtx] = 1 - d - rank[vtx];
+        contribution[vtx] = graph->out_degree[vtx]>0 ? d * rank[vtx] / graph->out_degree[vtx] : 0;
+        return 1;
+      },
+      all
+    );
+  } else {
+    // the affected vertices: the endpoints of the batch and the out-neighbours of its sources
+    VertexSubset * affected = graph->alloc_vertex_subset();
+    affected->clear();
+    affected->unite(updated);
+    graph->process_edges<int,int>(
+      [&](VertexId src){
+        graph->emit(src, 0);
+      },
+      [&](VertexId src, int msg, VertexAdjList<Empty> outgoing_adj){
+        for (AdjUnit<Empty> * ptr=outgoing_adj.begin;ptr!=outgoing_adj.end;ptr++) {
+          affected->set_bit(ptr->neighbour);
+        }
+        return 0;
+      },
+      [&](VertexId dst, VertexAdjList<Empty> incoming_adj) {
+        for (AdjUnit<Empty> * ptr=incoming_adj.begin;ptr!=incoming_adj.end;ptr++) {
+          if (updated->get_bit(ptr->neighbour)) {
+            graph->emit(dst, 0);
+            break;
+          }
+        }
+      },
+      [&](VertexId dst, int msg) {
+        affected->set_bit(dst);
+        return 0;
+      },
+      updated
+    );
+    // their residuals are recomputed by pulling the contributions of all their in-neighbours; the others are
+    // taken to be converged
+    graph->process_vertices<int>(
+      [&](VertexId vtx){
+        rank[vtx] = previous_rank[vtx];
+        residual[vtx] = affected->get_bit(vtx) ? 1 - d - rank[vtx] : 0;
+        contribution[vtx] = graph->out_degree[vtx]>0 ? d * rank[vtx] / graph->out_degree[vtx] : 0;
+        return 0;
+      },
+      all
+    );
+    VertexSubset * unaffected = graph->alloc_vertex_subset();
+    unaffected->fill();
+    unaffected->subtract(affected);
+    graph->process_edges<int,double>(
+      [&](VertexId src){
+        graph->emit(src, contribution[src]);
+      },
+      [&](VertexId src, double msg, VertexAdjList<Empty> outgoing_adj){
+        for (AdjUnit<Empty> * ptr=outgoing_adj.begin;ptr!=outgoing_adj.end;ptr++) {
+          VertexId dst = ptr->neighbour;
+          if (affected->get_bit(dst)) {
+            write_add(&residual[dst], msg);
+          }
+        }
+        return 0;
+      },
+      [&](VertexId dst, VertexAdjList<Empty> incoming_adj) {
+        double sum = 0;
+        for (AdjUnit<Empty> * ptr=incoming_adj.begin;ptr!=incoming_adj.end;ptr++) {
+          VertexId src = ptr->neighbour;
+          sum += contribution[src];
+        }
+        if (sum!=0) {
+          graph->emit(dst, sum);
+        }
+      },
+      [&](VertexId dst, double msg) {
+        write_add(&residual[dst], msg);
+        return 0;
+      },
+      all, unaffected,
+      [&](double a, double b) {
+        return a + b;
+      }
+    );
+    graph->fill_vertex_array(contribution, (double)0);
+    touched->clear();
+    touched->unite(affected);
+    active_vertices = activate();
+    delete affected;
+    delete unaffected;
+  }
+
+  // with GEMINI_CHECKPOINT, a restarted job continues after the last checkpointed iteration
+  graph->checkpoint_vertex_array(rank, "rank");
+  graph->checkpoint_vertex_array(residual, "residual");
+  graph->checkpoint_vertex_array(contribution, "contribution");
+  graph->checkpoint_vertex_subset(active_in, "active");
+  graph->checkpoint_value(active_vertices, "active_vertices");
+  int first_iteration = graph->restore_checkpoint() + 1;
+
+  for (int i_i=first_iteration;active_vertices>0 && i_i<max_iterations;i_i++) {
+    if (graph->partition_id==0) {
+      printf("active(%d)=%" PRIvid "\n", i_i, active_vertices);
+    }
+    graph->process_edges<int,double>(
+      [&](VertexId src){
+        graph->emit(src, contribution[src]);
+      },
+      [&](VertexId src, double msg, VertexAdjList<Empty> outgoing_adj){
+        for (AdjUnit<Empty> * ptr=outgoing_adj.begin;ptr!=outgoing_adj.end;ptr++) {
+          VertexId dst = ptr->neighbour;
+          write_add(&residual[dst], msg);
+          touched->set_bit(dst);
+        }
+        return 0;
+      },
+      [&](VertexId dst, VertexAdjList<Empty> incoming_adj) {
+        // inactive vertices contribute 0
+        double sum = 0;
+        for (AdjUnit<Empty> * ptr=incoming_adj.begin;ptr!=incoming_adj.end;ptr++) {
+          VertexId src = ptr->neighbour;
+          sum += contribution[src];
+        }
+        if (sum!=0) {
+          graph->emit(dst, sum);
+        }
+      },
+      [&](VertexId dst, double msg) {
+        write_add(&residual[dst], msg);
+        touched->set_bit(dst);
+        return 0;
+      },
+      active_in, nullptr,
+      [&](double a, double b) {
+        return a + b;
+      }
+    );
+    graph->process_vertices<int>(
+      [&](VertexId vtx) {
+        contribution[vtx] = 0;
+        return 0;
+      },
+      active_in
+    );
+    active_vertices = activate();
+    graph->checkpoint(i_i);
+  }
+  graph->finish_checkpoints();
+  // the residuals left behind are below epsilon each
+  graph->process_vertices<int>(
+    [&](VertexId vtx) {
+      rank[vtx] += residual[vtx];
+      return 0;
+    },
+    all
+  );
+
+  exec_time += get_time();
+  if (graph->partition_id==0) {
+    printf("exec_time=%lf(s)\n", exec_time);
+  }
+
+  if (rank_path!="") {
+    graph->dump_vertex_array_async(rank, rank_path);
+  }
+
+  double pr_sum = graph->process_vertices<double>(
+    [&](VertexId vtx) {
+      return rank[vtx];
+    },
+    all
+  );
+  if (graph->partition_id==0) {
+    printf("pr_sum=%lf\n", pr_sum);
+  }
+
+  graph->gather_vertex_array(rank, 0);
+  if (graph->partition_id==0) {
+    VertexId max_v_i = 0;
+    for (VertexId v_i=0;v_i<graph->vertices;v_i++) {
+      if (rank[v_i] > rank[max_v_i]) max_v_i = v_i;
+    }
+    printf("pr[%" PRIvid "]=%lf\n", max_v_i, rank[max_v_i]);
+  }
+
+  graph->dealloc_vertex_array(rank);
+  graph->dealloc_vertex_array(residual);
+  graph->dealloc_vertex_array(contribution);
+  delete all;
+  delete active_in;
+  delete active_out;
+  delete touched;
+}
+
+int main(int argc, char ** argv) {
+  MPI_Instance mpi(&argc, &argv);
+
+  if (argc<4) {
+    printf("pagerank_delta [file] [vertices] [epsilon] [max iterations=100] [ranks] [inserted edges] [deleted edges]\n");
+    exit(-1);
+  }
+
+  Graph<Empty> * graph;
+  graph = new Graph<Empty>();
+  graph->load_directed(argv[1], std::atol(argv[2]));
+  double epsilon = std::atof(argv[3]);
+  int max_iterations = argc > 4 ? std::atoi(argv[4]) : 100;
+  std::string rank_path = argc > 5 ? argv[5] : "";
+
+  // with edge files ("-" for none), the graph is updated and the ranks in rank_path are recomputed for it
+  double * previous_rank = nullptr;
+  VertexSubset * updated = graph->alloc_vertex_subset();
+  updated->clear();
+  if (argc > 6) {
+    std::string inserted_path = strcmp(argv[6], "-")==0 ? "" : argv[6];
+    std::string deleted_path = argc > 7 && strcmp(argv[7], "-")!=0 ? argv[7] : "";
+    graph->update_edges(inserted_path, deleted_path, updated, updated);
+    previous_rank = graph->alloc_vertex_array<double>();
+    graph->restore_vertex_array(previous_rank, rank_path);
+  }
+
+  for (int run=0;run<6;run++) {
+    compute(graph, epsilon, max_iterations, previous_rank, updated, rank_path);
+  }
+
+  if (previous_rank!=nullptr) {
+    graph->dealloc_vertex_array(previous_rank);
+  }
+  delete updated;
+
+  delete graph;
+  return 0;
+}
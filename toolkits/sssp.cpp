@@ -21,42 +21,144 @@ Copyright (c) 2014-2015 Xiaowei Zhu, Tsinghua University
 
 typedef float Weight;
 
-void compute(Graph<Weight> * graph, VertexId root) {
-  double exec_time = 0;
-  exec_time -= get_time();
-
-  Weight * distance = graph->alloc_vertex_array<Weight>();
+// delta-stepping: vertices are expanded bucket by bucket (distances in [k*delta, (k+1)*delta)),
+// relaxing the light edges (weight < delta) until the bucket is stable, then the heavy edges once
+void delta_stepping(Graph<Weight> * graph, Weight * distance, VertexId root, Weight delta) {
+  VertexSubset * pending = graph->alloc_vertex_subset(); // improved vertices of later buckets
   VertexSubset * active_in = graph->alloc_vertex_subset();
   VertexSubset * active_out = graph->alloc_vertex_subset();
-  active_in->clear();
-  active_in->set_bit(root);
-  graph->fill_vertex_array(distance, (Weight)1e9);
-  distance[root] = (Weight)0;
-  VertexId active_vertices = 1;
-  
-  for (int i_i=0;active_vertices>0;i_i++) {
-    if (graph->partition_id==0) {
-      printf("active(%d)>=%u\n", i_i, active_vertices);
+  VertexSubset * settled = graph->alloc_vertex_subset(); // expanded in the current bucket
+  pending->clear();
+  pending->set_bit(root);
+  auto bucket = [&](VertexId v_i) {
+    return (long)(distance[v_i] / delta);
+  };
+  long k = 0;
+  // an improved vertex is expanded next if it falls into the current bucket, and waits in pending otherwise
+  auto improved = [&](VertexId v_i) {
+    if (bucket(v_i) <= k) {
+      pending->clear_bit(v_i);
+      active_out->set_bit(v_i);
+      settled->set_bit(v_i);
+      return 1;
     }
-    active_out->clear();
-    active_vertices = graph->process_edges<VertexId,Weight>(
+    pending->set_bit(v_i);
+    return 0;
+  };
+  // relax the light or the heavy out-edges of active; returns the vertices added to the current bucket
+  auto relax = [&](VertexSubset * active, bool light) {
+    return graph->process_edges<VertexId,Weight>(
       [&](VertexId src){
         graph->emit(src, distance[src]);
       },
       [&](VertexId src, Weight msg, VertexAdjList<Weight> outgoing_adj){
         VertexId activated = 0;
         for (AdjUnit<Weight> * ptr=outgoing_adj.begin;ptr!=outgoing_adj.end;ptr++) {
+          if ((ptr->edge_data < delta) != light) continue;
           VertexId dst = ptr->neighbour;
           Weight relax_dist = msg + ptr->edge_data;
           if (relax_dist < distance[dst]) {
             if (write_min(&distance[dst], relax_dist)) {
-              active_out->set_bit(dst);
-              activated += 1;
+              activated += improved(dst);
             }
           }
         }
         return activated;
       },
+      [&](VertexId dst, VertexAdjList<Weight> incoming_adj) {
+        Weight msg = 1e9;
+        for (AdjUnit<Weight> * ptr=incoming_adj.begin;ptr!=incoming_adj.end;ptr++) {
+          if ((ptr->edge_data < delta) != light) continue;
+          VertexId src = ptr->neighbour;
+          if (active->get_bit(src)) {
+            Weight relax_dist = distance[src] + ptr->edge_data;
+            if (relax_dist < msg) {
+              msg = relax_dist;
+            }
+          }
+        }
+        if (msg < 1e9) graph->emit(dst, msg);
+      },
+      [&](VertexId dst, Weight msg) {
+        if (msg < distance[dst]) {
+          write_min(&distance[dst], msg);
+          return improved(dst);
+        }
+        return 0;
+      },
+      active, nullptr,
+      [&](Weight a, Weight b) {
+        return a < b ? a : b;
+      }
+    );
+  };
+
+  for (int i_i=0;true;) {
+    k = graph->next_bucket(bucket, pending);
+    if (k == LONG_MAX) break;
+    settled->clear();
+    active_out->clear();
+    VertexId active_vertices = graph->process_vertices<VertexId>(
+      [&](VertexId v_i) {
+        return bucket(v_i) <= k ? improved(v_i) : 0;
+      },
+      pending
+    );
+    while (active_vertices>0) {
+      if (graph->partition_id==0) {
+        printf("active(%d)>=%" PRIvid "\n", i_i++, active_vertices);
+      }
+      std::swap(active_in, active_out);
+      active_out->clear();
+      active_vertices = relax(active_in, true);
+    }
+    // heavy edges only lead to later buckets, so they are relaxed once per settled vertex
+    relax(settled, false);
+  }
+
+  delete pending;
+  delete active_in;
+  delete active_out;
+  delete settled;
+}
+
+void bellman_ford(Graph<Weight> * graph, Weight * distance, VertexId root) {
+  VertexSubset * active_in = graph->alloc_vertex_subset();
+  VertexSubset * active_out = graph->alloc_vertex_subset();
+  active_in->clear();
+  active_in->set_bit(root);
+  VertexId active_vertices = 1;
+  
+  auto sparse_signal = [&](VertexId src){
+    graph->emit(src, distance[src]);
+  };
+  auto sparse_slot = [&](VertexId src, Weight msg, VertexAdjList<Weight> outgoing_adj){
+    VertexId activated = 0;
+    for (AdjUnit<Weight> * ptr=outgoing_adj.begin;ptr!=outgoing_adj.end;ptr++) {
+      VertexId dst = ptr->neighbour;
+      Weight relax_dist = msg + ptr->edge_data;
+      if (relax_dist < distance[dst]) {
+        if (write_min(&distance[dst], relax_dist)) {
+          active_out->set_bit(dst);
+          activated += 1;
+        }
+      }
+    }
+    return activated;
+  };
+  for (int i_i=0;active_vertices>0;i_i++) {
+    if (graph->partition_id==0) {
+      printf("active(%d)>=%" PRIvid "\n", i_i, active_vertices);
+    }
+    active_out->clear();
+    if (graph->async_frontier(active_vertices)) {
+      // the tail of small frontiers is relaxed without the rounds
+      graph->process_edges_async<VertexId,Weight>(sparse_signal, sparse_slot, active_in, active_out);
+      break;
+    }
+    active_vertices = graph->process_edges<VertexId,Weight>(
+      sparse_signal,
+      sparse_slot,
       [&](VertexId dst, VertexAdjList<Weight> incoming_adj) {
         Weight msg = 1e9;
         for (AdjUnit<Weight> * ptr=incoming_adj.begin;ptr!=incoming_adj.end;ptr++) {
@@ -78,11 +180,31 @@ void compute(Graph<Weight> * graph, VertexId root) {
         }
         return 0;
       },
-      active_in
+      active_in, nullptr,
+      [&](Weight a, Weight b) {
+        return a < b ? a : b;
+      }
     );
     std::swap(active_in, active_out);
   }
 
+  delete active_in;
+  delete active_out;
+}
+
+void compute(Graph<Weight> * graph, VertexId root, Weight delta) {
+  double exec_time = 0;
+  exec_time -= get_time();
+
+  Weight * distance = graph->alloc_vertex_array<Weight>();
+  graph->fill_vertex_array(distance, (Weight)1e9);
+  distance[root] = (Weight)0;
+  if (delta > 0) {
+    delta_stepping(graph, distance, root, delta);
+  } else {
+    bellman_ford(graph, distance, root);
+  }
+
   exec_time += get_time();
   if (graph->partition_id==0) {
     printf("exec_time=%lf(s)\n", exec_time);
@@ -90,36 +212,35 @@ void compute(Graph<Weight> * graph, VertexId root) {
 
   graph->gather_vertex_array(distance, 0);
   if (graph->partition_id==0) {
-    VertexId max_v_i = root;
+    VertexId max_v_i = graph->get_original_id(root);
     for (VertexId v_i=0;v_i<graph->vertices;v_i++) {
       if (distance[v_i] < 1e9 && distance[v_i] > distance[max_v_i]) {
         max_v_i = v_i;
       }
     }
-    printf("distance[%u]=%f\n", max_v_i, distance[max_v_i]);
+    printf("distance[%" PRIvid "]=%f\n", max_v_i, distance[max_v_i]);
   }
 
   graph->dealloc_vertex_array(distance);
-  delete active_in;
-  delete active_out;
 }
 
 int main(int argc, char ** argv) {
   MPI_Instance mpi(&argc, &argv);
 
   if (argc<4) {
-    printf("sssp [file] [vertices] [root]\n");
+    printf("sssp [file] [vertices] [root] [delta=0]\n");
     exit(-1);
   }
 
   Graph<Weight> * graph;
   graph = new Graph<Weight>();
-  graph->load_directed(argv[1], std::atoi(argv[2]));
-  VertexId root = std::atoi(argv[3]);
+  graph->load_directed(argv[1], std::atol(argv[2]));
+  VertexId root = graph->get_internal_id(std::atol(argv[3]));
+  Weight delta = argc > 4 ? std::atof(argv[4]) : 0;
 
-  compute(graph, root);
+  compute(graph, root, delta);
   for (int run=0;run<5;run++) {
-    compute(graph, root);
+    compute(graph, root, delta);
   }
 
   delete graph;